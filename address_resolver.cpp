@@ -0,0 +1,310 @@
+#include <algorithm>
+
+#include <asio/io_service.hpp>
+
+#include "address_resolver.hpp"
+#include "config.hpp"
+#include "socket_helper.hpp"
+
+namespace arelion {
+	address_resolver netresolver;
+
+	address_resolver::address_resolver()
+		: m_lookup_func(system_lookup)
+		, m_positive_time(config::resolver_cache_secs)
+		, m_negative_time(config::resolver_negative_cache_secs)
+	{
+	}
+
+	address_resolver::~address_resolver() {
+		{
+			std::lock_guard<std::mutex> scoped_lock(m_mutex);
+			m_stop_worker = true;
+		}
+
+		m_worker_cond.notify_one();
+
+		// a lookup in progress is waited for, those still queued are abandoned
+		if (m_worker.joinable())
+			m_worker.join();
+	}
+
+
+	asio::error_code address_resolver::system_lookup(const std::string& host, std::vector<asio::ip::address>& addresses) {
+		asio::error_code error_code;
+		asio::io_service io_service;
+		asio::ip::udp::resolver resolver(io_service);
+		asio::ip::udp::resolver::query query(host, "0");
+		asio::ip::udp::resolver::iterator iter = wrap_resolve(resolver, query, &error_code);
+		asio::ip::udp::resolver::iterator end;
+
+		if (error_code)
+			return error_code;
+
+		for (; iter != end; ++iter) {
+			const asio::ip::address address = iter->endpoint().address();
+
+			if (std::find(addresses.begin(), addresses.end(), address) == addresses.end())
+				addresses.push_back(address);
+		}
+
+		return error_code;
+	}
+
+
+	void address_resolver::resolve(const std::string& host, uint16_t port, resolve_callback callback) {
+		asio::ip::udp::endpoint endpoint;
+		asio::error_code error_code;
+
+		if (find_cached(host, port, endpoint, error_code)) {
+			callback(error_code, endpoint);
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> scoped_lock(m_mutex);
+
+			const auto iter = m_cache.find(host);
+
+			if (iter == m_cache.end())
+				evict_entries(std::chrono::high_resolution_clock::now());
+
+			cache_entry& entry = (iter != m_cache.end())? iter->second: m_cache[host];
+
+			// found fresh by another thread in the meantime, run below
+			if (is_fresh(entry, std::chrono::high_resolution_clock::now())) {
+				endpoint = make_endpoint(entry, port);
+				error_code = entry.error_code;
+			} else {
+				entry.callbacks.emplace_back(port, std::move(callback));
+
+				if (entry.pending)
+					return;
+
+				entry.pending = true;
+				m_lookup_queue.push_back(host);
+
+				if (!m_worker.joinable())
+					m_worker = std::thread(&address_resolver::run_worker, this);
+
+				m_worker_cond.notify_one();
+				return;
+			}
+		}
+
+		callback(error_code, endpoint);
+	}
+
+	asio::ip::udp::endpoint address_resolver::resolve_now(const std::string& host, uint16_t port, asio::error_code* error_code) {
+		asio::ip::udp::endpoint endpoint;
+		asio::error_code ec;
+
+		if (!find_cached(host, port, endpoint, ec)) {
+			std::vector<asio::ip::address> addresses;
+			lookup_func func;
+
+			{
+				std::lock_guard<std::mutex> scoped_lock(m_mutex);
+				func = m_lookup_func;
+			}
+
+			ec = run_lookup(func, host, addresses);
+
+			if (!ec)
+				endpoint = asio::ip::udp::endpoint(addresses[0], port);
+
+			std::lock_guard<std::mutex> scoped_lock(m_mutex);
+
+			const time_point cur_time = std::chrono::high_resolution_clock::now();
+			const auto iter = m_cache.find(host);
+
+			if (iter == m_cache.end())
+				evict_entries(cur_time);
+
+			cache_entry& entry = (iter != m_cache.end())? iter->second: m_cache[host];
+
+			// a pending lookup stores its own result and runs its callbacks
+			if (!entry.pending)
+				store_result(entry, ec, addresses, cur_time);
+		}
+
+		if (error_code != nullptr)
+			*error_code = ec;
+
+		return endpoint;
+	}
+
+	bool address_resolver::find_cached(const std::string& host, uint16_t port, asio::ip::udp::endpoint& endpoint, asio::error_code& error_code) const {
+		const asio::ip::address address = wrap_ip(host, &error_code);
+
+		if (!error_code) {
+			endpoint = asio::ip::udp::endpoint(address, port);
+			return true;
+		}
+
+		std::lock_guard<std::mutex> scoped_lock(m_mutex);
+
+		const auto iter = m_cache.find(host);
+
+		if (iter == m_cache.end() || !is_fresh(iter->second, std::chrono::high_resolution_clock::now()))
+			return false;
+
+		endpoint = make_endpoint(iter->second, port);
+		error_code = iter->second.error_code;
+		return true;
+	}
+
+
+	size_t address_resolver::poll() {
+		if (!m_have_results.load(std::memory_order_acquire))
+			return 0;
+
+		typedef std::pair<resolve_callback, asio::ip::udp::endpoint> completion;
+
+		std::vector< std::pair<completion, asio::error_code> > completions;
+
+		{
+			std::lock_guard<std::mutex> scoped_lock(m_mutex);
+
+			// both buffers keep their storage across polls
+			m_poll_results.swap(m_results);
+			m_have_results.store(false, std::memory_order_relaxed);
+
+			const time_point cur_time = std::chrono::high_resolution_clock::now();
+
+			for (lookup_result& result: m_poll_results) {
+				// pending entries are never evicted or cleared
+				cache_entry& entry = m_cache[result.host];
+
+				store_result(entry, result.error_code, result.addresses, cur_time);
+
+				for (auto& callback: entry.callbacks) {
+					completions.emplace_back(completion(std::move(callback.second), make_endpoint(entry, callback.first)), entry.error_code);
+				}
+
+				entry.callbacks.clear();
+			}
+
+			m_poll_results.clear();
+		}
+
+		// outside the lock, callbacks may resolve again
+		for (auto& c: completions) {
+			(c.first.first)(c.second, c.first.second);
+		}
+
+		return completions.size();
+	}
+
+	void address_resolver::clear() {
+		std::lock_guard<std::mutex> scoped_lock(m_mutex);
+
+		for (auto iter = m_cache.begin(); iter != m_cache.end(); ) {
+			// pending lookups still owe their callbacks
+			if (iter->second.pending) {
+				++iter;
+			} else {
+				iter = m_cache.erase(iter);
+			}
+		}
+	}
+
+
+	void address_resolver::set_lookup_func(lookup_func func) {
+		std::lock_guard<std::mutex> scoped_lock(m_mutex);
+		m_lookup_func = std::move(func);
+	}
+
+	void address_resolver::set_cache_time(std::chrono::seconds positive_time, std::chrono::seconds negative_time) {
+		std::lock_guard<std::mutex> scoped_lock(m_mutex);
+		m_positive_time = positive_time;
+		m_negative_time = negative_time;
+	}
+
+	size_t address_resolver::get_cache_size() const {
+		std::lock_guard<std::mutex> scoped_lock(m_mutex);
+		return m_cache.size();
+	}
+
+	size_t address_resolver::get_pending_count() const {
+		std::lock_guard<std::mutex> scoped_lock(m_mutex);
+		return (std::count_if(m_cache.begin(), m_cache.end(), [](const std::pair<const std::string, cache_entry>& p) { return p.second.pending; }));
+	}
+
+
+	void address_resolver::run_worker() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		while (true) {
+			m_worker_cond.wait(lock, [this]() { return (m_stop_worker || !m_lookup_queue.empty()); });
+
+			if (m_stop_worker)
+				break;
+
+			lookup_result result;
+			result.host = std::move(m_lookup_queue.front());
+			m_lookup_queue.pop_front();
+
+			const lookup_func func = m_lookup_func;
+
+			lock.unlock();
+			result.error_code = run_lookup(func, result.host, result.addresses);
+			lock.lock();
+
+			m_results.push_back(std::move(result));
+			m_have_results.store(true, std::memory_order_release);
+		}
+	}
+
+	asio::error_code address_resolver::run_lookup(const lookup_func& func, const std::string& host, std::vector<asio::ip::address>& addresses) {
+		const asio::error_code error_code = func(host, addresses);
+
+		// a lookup function that succeeds without addresses counts as failed
+		if (!error_code && addresses.empty())
+			return asio::error::host_not_found;
+
+		return error_code;
+	}
+
+	void address_resolver::store_result(cache_entry& entry, const asio::error_code& error_code, std::vector<asio::ip::address>& addresses, time_point cur_time) {
+		entry.addresses.swap(addresses);
+		entry.error_code = error_code;
+		entry.expiry_time = cur_time + (error_code? m_negative_time: m_positive_time);
+		entry.pending = false;
+	}
+
+	void address_resolver::evict_entries(time_point cur_time) {
+		if (m_cache.size() < config::resolver_cache_entries)
+			return;
+
+		auto oldest = m_cache.end();
+
+		for (auto iter = m_cache.begin(); iter != m_cache.end(); ) {
+			if (iter->second.pending) {
+				++iter;
+				continue;
+			}
+
+			if (iter->second.expiry_time <= cur_time) {
+				iter = m_cache.erase(iter);
+				continue;
+			}
+
+			if (oldest == m_cache.end() || iter->second.expiry_time < oldest->second.expiry_time)
+				oldest = iter;
+
+			++iter;
+		}
+
+		if (m_cache.size() >= config::resolver_cache_entries && oldest != m_cache.end())
+			m_cache.erase(oldest);
+	}
+
+	asio::ip::udp::endpoint address_resolver::make_endpoint(const cache_entry& entry, uint16_t port) {
+		if (entry.error_code)
+			return asio::ip::udp::endpoint();
+
+		return asio::ip::udp::endpoint(entry.addresses[0], port);
+	}
+}
+
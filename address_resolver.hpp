@@ -0,0 +1,113 @@
+#ifndef ARELION_ADDRESS_RESOLVER_HDR
+#define ARELION_ADDRESS_RESOLVER_HDR
+
+#include <asio/ip/udp.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace arelion {
+	// hostname lookups off the calling thread, with a cache of their results;
+	// lookups run one at a time on a worker thread started on first use, and
+	// their callbacks are run by poll() on whichever thread calls it (the
+	// network thread, through udp_listener::update and udp_connection::update)
+	class address_resolver {
+	public:
+		typedef std::chrono::high_resolution_clock::time_point time_point;
+
+		// fills <addresses> with those of <host> in preference order, on the worker thread
+		typedef std::function<asio::error_code(const std::string& host, std::vector<asio::ip::address>& addresses)> lookup_func;
+		typedef std::function<void(const asio::error_code& error_code, const asio::ip::udp::endpoint& endpoint)> resolve_callback;
+
+		address_resolver();
+		~address_resolver();
+
+		// getaddrinfo through asio, blocks until the system resolver answers
+		static asio::error_code system_lookup(const std::string& host, std::vector<asio::ip::address>& addresses);
+
+		// literal addresses and cached hosts complete before this returns, others
+		// once their lookup is done and poll() is called; concurrent requests for
+		// the same host share one lookup
+		void resolve(const std::string& host, uint16_t port, resolve_callback callback);
+		// looks <host> up on the calling thread unless it is literal or cached, for
+		// callers that can afford to block
+		asio::ip::udp::endpoint resolve_now(const std::string& host, uint16_t port, asio::error_code* error_code);
+		// false if <host> is neither literal nor cached (and unexpired)
+		bool find_cached(const std::string& host, uint16_t port, asio::ip::udp::endpoint& endpoint, asio::error_code& error_code) const;
+
+		// runs the callbacks of finished lookups, returns their number
+		size_t poll();
+		void clear();
+
+		// replaces the system resolver, e.g. with a table of test hosts; lookups
+		// already running finish with the old one
+		void set_lookup_func(lookup_func func);
+		// how long successful (and failed) lookups are cached, 0 disables caching
+		void set_cache_time(std::chrono::seconds positive_time, std::chrono::seconds negative_time);
+
+		size_t get_cache_size() const;
+		size_t get_pending_count() const;
+
+	private:
+		struct cache_entry {
+			std::vector<asio::ip::address> addresses;
+			std::vector< std::pair<uint16_t, resolve_callback> > callbacks;
+
+			asio::error_code error_code;
+			time_point expiry_time;
+
+			bool pending = false;
+		};
+
+		struct lookup_result {
+			std::string host;
+			std::vector<asio::ip::address> addresses;
+			asio::error_code error_code;
+		};
+
+		void run_worker();
+
+		static asio::error_code run_lookup(const lookup_func& func, const std::string& host, std::vector<asio::ip::address>& addresses);
+		// caller holds m_mutex
+		void store_result(cache_entry& entry, const asio::error_code& error_code, std::vector<asio::ip::address>& addresses, time_point cur_time);
+		void evict_entries(time_point cur_time);
+
+		static bool is_fresh(const cache_entry& entry, time_point cur_time) { return (!entry.pending && cur_time < entry.expiry_time); }
+		static asio::ip::udp::endpoint make_endpoint(const cache_entry& entry, uint16_t port);
+
+	private:
+		mutable std::mutex m_mutex;
+		std::condition_variable m_worker_cond;
+		std::thread m_worker;
+
+		lookup_func m_lookup_func;
+
+		std::map<std::string, cache_entry> m_cache;
+
+		// hosts waiting for the worker, and its finished lookups waiting for poll()
+		std::deque<std::string> m_lookup_queue;
+		std::vector<lookup_result> m_results;
+		std::vector<lookup_result> m_poll_results;
+
+		std::chrono::seconds m_positive_time;
+		std::chrono::seconds m_negative_time;
+
+		// set with m_results, lets poll() skip locking when there is nothing to do
+		std::atomic<bool> m_have_results{false};
+		bool m_stop_worker = false;
+	};
+
+
+	extern address_resolver netresolver;
+}
+
+#endif
+
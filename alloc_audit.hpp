@@ -0,0 +1,35 @@
+#ifndef ARELION_ALLOC_AUDIT_HDR
+#define ARELION_ALLOC_AUDIT_HDR
+
+namespace arelion {
+	// names the component doing the work on this thread, so an allocator hook (see
+	// tools/alloc_audit) can attribute every allocation; scopes nest, innermost wins
+	namespace alloc_audit {
+		inline const char*& cur_scope() {
+			static thread_local const char* name = nullptr;
+			return name;
+		}
+
+		struct scope {
+		public:
+			scope(const char* name): m_prv_name(cur_scope()) { cur_scope() = name; }
+			~scope() { cur_scope() = m_prv_name; }
+
+			scope(const scope&) = delete;
+			scope& operator = (const scope&) = delete;
+
+		private:
+			const char* m_prv_name;
+		};
+	}
+}
+
+// compiled out unless building for an allocation audit
+#ifdef ALLOC_AUDIT
+#define ALLOC_AUDIT_SCOPE(name) arelion::alloc_audit::scope alloc_audit_scope_(name)
+#else
+#define ALLOC_AUDIT_SCOPE(name)
+#endif
+
+#endif
+
@@ -5,6 +5,7 @@
 #include <string>
 #include <memory>
 
+#include "connection_metrics.hpp"
 #include "raw_packet.hpp"
 
 namespace arelion {
@@ -13,41 +14,58 @@ namespace arelion {
 
 	class base_connection {
 	public:
+		enum {
+			DELIVERY_RELIABLE_ORDERED     = 0,
+			DELIVERY_RELIABLE_UNORDERED   = 1,
+			// older packets arriving after newer ones are dropped
+			DELIVERY_UNRELIABLE_SEQUENCED = 2,
+			DELIVERY_UNRELIABLE           = 3,
+		};
+
+		static constexpr uint8_t MAX_STREAMS = 16;
+
 		base_connection();
 		virtual ~base_connection() {}
 
-		// send packet to remote instance
-		virtual void send_data(std::shared_ptr<const raw_packet> data) = 0;
+		// send packet to remote instance; ordering is only guaranteed among
+		// packets sent in-order on the same stream (out of MAX_STREAMS)
+		virtual void send_data(std::shared_ptr<const raw_packet> data, const uint8_t delivery = DELIVERY_RELIABLE_ORDERED, const uint8_t stream = 0) = 0;
 
-		virtual std::shared_ptr<const raw_packet> peek(uint32_t index) const = 0;
-		virtual std::shared_ptr<const raw_packet> get_data() = 0;
+		virtual std::shared_ptr<const raw_packet> peek(uint32_t index, const uint8_t stream = 0) const = 0;
+		virtual std::shared_ptr<const raw_packet> get_data(const uint8_t stream = 0) = 0;
 
 		// check for unacked packets, timeout, etc
 		virtual void update() {}
 		// delete a packet from the buffer
-		virtual void delete_buffer_packet_at(uint32_t index) = 0;
+		virtual void delete_buffer_packet_at(uint32_t index, const uint8_t stream = 0) = 0;
 
 		// flush the underlying buffer (if any) to the network
 		virtual void flush(const bool forced = false) = 0;
+		// packets sent between these calls are held back and leave together (may nest)
+		virtual void begin_batch() {}
+		virtual void end_batch() {}
 		virtual void reconnect_to(base_connection& conn) = 0;
 
-		virtual bool has_incoming_data() const = 0;
+		virtual bool has_incoming_data(const uint8_t stream = 0) const = 0;
 		virtual bool check_timeout(int32_t seconds = 0, bool initial = false) const = 0;
 		virtual bool can_reconnect() const = 0;
 		virtual bool needs_reconnect() = 0;
 
-		virtual uint32_t get_packet_queue_size() const { return 0; }
+		virtual uint32_t get_packet_queue_size(const uint8_t /*stream*/ = 0) const { return 0; }
 
 		virtual void unmute() = 0;
 		virtual void close(bool flush = false) = 0;
 		virtual void set_loss_factor(int32_t factor) = 0;
 
+		// formats get_metrics() for humans
 		virtual std::string get_statistics() const = 0;
 		virtual std::string get_full_address() const = 0;
 
+		// consistent per counter, may be called from any thread
+		connection_metrics get_metrics() const { return m_metrics; }
+
 	protected:
-		uint32_t m_data_sent = 0;
-		uint32_t m_data_recv = 0;
+		connection_metrics m_metrics;
 	};
 }
 
@@ -10,11 +10,49 @@ namespace config {
 
 	static constexpr int32_t max_transmission_unit = 1400;
 	static constexpr int32_t link_outgoing_bandwidth = 64 * 1024;
+	// bytes the pacer lets out back-to-back after an idle period
+	static constexpr int32_t link_outgoing_burst = 4 * max_transmission_unit;
 	static constexpr int32_t reconnect_time_secs = 15;
 	static constexpr int32_t network_timeout_secs = 30;
 	static constexpr int32_t initial_network_timeout_secs = 120;
 	static constexpr int32_t network_loss_factor = MIN_LOSS_FACTOR;
-	static constexpr int32_t udp_chunks_per_sec = 30;
+	// challenges sent to a new address of the other end before it is given up on
+	static constexpr uint32_t path_probe_attempts = 5;
+	static constexpr int32_t path_probe_interval_ms = 200;
+	// connection cookies are valid in the period they were issued in and the next
+	static constexpr int32_t connection_cookie_secs = 10;
+	// datagrams per second (and burst) udp_listener takes from an address without a connection
+	static constexpr int32_t source_rate_limit = 100;
+	static constexpr int32_t source_rate_burst = 200;
+	// how long address_resolver keeps successful and failed hostname lookups
+	static constexpr int32_t resolver_cache_secs = 300;
+	static constexpr int32_t resolver_negative_cache_secs = 10;
+	// hosts cached before the ones closest to expiry are evicted
+	static constexpr uint32_t resolver_cache_entries = 256;
+	// longest an update spends receiving datagrams (and, for udp_listener, updating connections)
+	static constexpr int32_t udp_update_budget_ms = 10;
+	// longest a udp_listener leaves an idle connection without an update, e.g. to release it
+	static constexpr int32_t udp_idle_update_ms = 1000;
+	// longest a reliable packet waits to be coalesced with others before its datagram leaves
+	static constexpr int32_t udp_latency_budget_ms = 10;
+
+	// recent datagrams kept in each connection's trace ring (0 to disable)
+	static constexpr uint32_t packet_trace_events = 1024;
+	// keep per-stage message latency histograms on every udp_connection
+	static constexpr bool message_latency_stats = false;
+	// count messages and bytes per message id on every udp_connection
+	static constexpr bool message_traffic_stats = false;
+
+	// freed blocks each thread keeps per size class of the memory pool
+	static constexpr uint32_t mem_pool_cache_bytes = 4 * 1024 * 1024;
+
+	// LZ-compress the reliable stream when both ends agree
+	static constexpr bool stream_compression = true;
+
+	// time after which multicast chunks a member has not acked are repaired over unicast
+	static constexpr int32_t multicast_repair_ms = 250;
+	// reliable multicast chunks kept for repairs; members lagging further are dropped
+	static constexpr uint32_t multicast_history_chunks = 8192;
 };
 
 #endif
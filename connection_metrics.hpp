@@ -0,0 +1,121 @@
+#ifndef ARELION_CONNECTION_METRICS_HDR
+#define ARELION_CONNECTION_METRICS_HDR
+
+#include <atomic>
+#include <cstdint>
+
+namespace arelion {
+	// 64-bit value with a single writer (the network thread) and any number of
+	// readers; the writer never needs a locked read-modify-write since nobody
+	// else stores to it, and copies are relaxed loads so a struct of these can
+	// be snapshot from a monitoring thread without locking
+	struct metric_value {
+	public:
+		metric_value() = default;
+		metric_value(const metric_value& v): m_value(v.get()) {}
+
+		metric_value& operator = (const metric_value& v) { set(v.get()); return *this; }
+
+		void add(uint64_t n) { set(get() + n); }
+		void sub(uint64_t n) { set(get() - n); }
+		void set(uint64_t n) { m_value.store(n, std::memory_order_relaxed); }
+
+		uint64_t get() const { return (m_value.load(std::memory_order_relaxed)); }
+
+	private:
+		std::atomic<uint64_t> m_value{0};
+	};
+
+
+	// CPU time spent in each phase of the datagram path, in profiler ticks and
+	// excluding nested phases; only collected in PHASE_PROFILER builds, see
+	// phase_profiler.hpp for converting ticks to time
+	struct phase_metrics {
+	public:
+		enum {
+			// listener or connection socket receive loop
+			PHASE_RECV       = 0,
+			PHASE_PARSE      = 1,
+			// acks and naks of an incoming datagram
+			PHASE_ACK        = 2,
+			PHASE_REASSEMBLY = 3,
+			// chunking of outgoing data
+			PHASE_FRAGMENT   = 4,
+			// choosing what goes into the next datagrams
+			PHASE_SCHEDULE   = 5,
+			// serialization and the send syscall
+			PHASE_SEND       = 6,
+			NUM_PHASES       = 7,
+		};
+
+		static const char* get_phase_name(uint32_t phase) {
+			static const char* names[NUM_PHASES] = {"recv", "parse", "ack", "reassembly", "fragment", "schedule", "send"};
+			return names[phase];
+		}
+
+	public:
+		metric_value calls[NUM_PHASES];
+		metric_value ticks[NUM_PHASES];
+	};
+
+
+	struct connection_metrics {
+	public:
+		// counters, only ever increase
+		metric_value data_sent;
+		metric_value data_recv;
+
+		metric_value sent_packets;
+		metric_value recv_packets;
+
+		metric_value sent_overhead;
+		metric_value recv_overhead;
+
+		metric_value resent_chunks;
+		metric_value dropped_chunks;
+
+		metric_value stream_raw_bytes;
+		metric_value stream_enc_bytes;
+
+		// gauges, refreshed by the network thread after each flush
+		// bytes passed to send_data but not yet turned into chunks
+		metric_value outgoing_queue_bytes;
+		// bytes in chunks created but not yet sent
+		metric_value pending_chunk_bytes;
+		// reliable chunks sent but not yet acked by the other end
+		metric_value unacked_chunks;
+		// chunks received out of order and waiting for the gaps to be filled
+		metric_value waiting_chunks;
+		// bytes held in waiting chunks and partially reassembled packets
+		metric_value reassembly_bytes;
+
+		phase_metrics phases;
+	};
+
+
+	struct listener_metrics {
+	public:
+		metric_value recv_datagrams;
+		metric_value recv_bytes;
+
+		// too short, or from an address without a connection
+		metric_value dropped_datagrams;
+		// over the rate limit of an address without a connection, never parsed
+		metric_value limited_datagrams;
+
+		metric_value accepted_connections;
+		metric_value active_connections;
+		// moved to a new address of the other end, see udp_connection::validate_address
+		metric_value migrated_connections;
+		// new clients asked to echo a cookie before being accepted
+		metric_value sent_cookies;
+		// updates that ran out of budget before every ready connection was serviced
+		metric_value deferred_updates;
+
+		// receive loop and parsing of datagrams on the shared socket
+		phase_metrics phases;
+	};
+}
+
+#endif
+
@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "delta_codec.hpp"
+#include "protocol_def.hpp"
+
+namespace arelion {
+	uint8_t* delta_codec::get_instance(uint8_t id, uint32_t length) {
+		if (m_cache_offsets[id] < 0) {
+			m_cache_offsets[id] = m_cache.size();
+			m_cache.resize(m_cache.size() + length, 0);
+			// first instance is coded against all-zeroes (save for the id)
+			m_cache[m_cache_offsets[id]] = id;
+		}
+
+		return &m_cache[m_cache_offsets[id]];
+	}
+
+
+
+	uint32_t delta_encoder::encode_record(const uint8_t* pkt, uint32_t pkt_length, std::vector<uint8_t>& out) {
+		assert(pkt_length > 0 && int32_t(pkt_length) == proto_def.packet_length(pkt, pkt_length));
+
+		const uint32_t pos = out.size();
+		const uint32_t max_delta_size = record_hdr_size() + (pkt_length - 1);
+
+		uint8_t* prev = get_instance(pkt[0], pkt_length);
+
+		out.resize(pos + record_hdr_size() + pkt_length * 2);
+		out[pos + 0] = pkt[0];
+		out[pos + 1] = RECORD_TAG_DELTA;
+
+		uint32_t out_pos = pos + record_hdr_size();
+
+		for (uint32_t i = 1; i < pkt_length && (out_pos - pos) < max_delta_size; ) {
+			uint32_t num_zeros = 0;
+			uint32_t num_lits = 0;
+
+			while ((i + num_zeros) < pkt_length && num_zeros < 255 && pkt[i + num_zeros] == prev[i + num_zeros]) {
+				num_zeros += 1;
+			}
+
+			i += num_zeros;
+
+			// a single unchanged byte is cheaper as literal than as a new pair
+			while ((i + num_lits) < pkt_length && num_lits < 255) {
+				if (pkt[i + num_lits] == prev[i + num_lits] && ((i + num_lits + 1) >= pkt_length || pkt[i + num_lits + 1] == prev[i + num_lits + 1]))
+					break;
+
+				num_lits += 1;
+			}
+
+			out[out_pos++] = num_zeros;
+			out[out_pos++] = num_lits;
+
+			for (uint32_t j = 0; j < num_lits; ++j) {
+				out[out_pos++] = pkt[i + j] ^ prev[i + j];
+			}
+
+			i += num_lits;
+		}
+
+		if ((out_pos - pos) >= max_delta_size) {
+			// delta does not pay off, send the full packet
+			out.resize(pos);
+			frame_full_record(pkt, pkt_length, out);
+
+			out_pos = pos + max_delta_size;
+		}
+
+		out.resize(out_pos);
+		std::memcpy(prev, pkt, pkt_length);
+		return (out_pos - pos);
+	}
+
+	uint32_t delta_encoder::frame_full_record(const uint8_t* pkt, uint32_t pkt_length, std::vector<uint8_t>& out) {
+		assert(pkt_length > 0);
+
+		const uint32_t pos = out.size();
+
+		out.resize(pos + record_hdr_size() + pkt_length - 1);
+		out[pos + 0] = pkt[0];
+		out[pos + 1] = RECORD_TAG_FULL;
+
+		std::memcpy(&out[pos + record_hdr_size()], pkt + 1, pkt_length - 1);
+		return (out.size() - pos);
+	}
+
+
+
+	int32_t delta_decoder::decode_record(const uint8_t* buf, uint32_t buf_length, std::vector<uint8_t>& pkt) {
+		const int32_t pkt_length = proto_def.packet_length(buf, buf_length);
+
+		if (pkt_length <= 0)
+			return pkt_length;
+		if (buf_length < record_hdr_size())
+			return 0;
+
+		uint8_t* prev = get_instance(buf[0], pkt_length);
+		uint32_t buf_pos = record_hdr_size();
+
+		pkt.resize(pkt_length);
+
+		switch (buf[1]) {
+			case RECORD_TAG_FULL: {
+				if (buf_length < (record_hdr_size() + pkt_length - 1))
+					return 0;
+
+				pkt[0] = buf[0];
+				std::memcpy(&pkt[1], buf + buf_pos, pkt_length - 1);
+
+				buf_pos += (pkt_length - 1);
+			} break;
+
+			case RECORD_TAG_DELTA: {
+				std::memcpy(&pkt[0], prev, pkt_length);
+
+				for (int32_t i = 1; i < pkt_length; ) {
+					if ((buf_pos + 2) > buf_length)
+						return 0;
+
+					const uint8_t num_zeros = buf[buf_pos++];
+					const uint8_t num_lits = buf[buf_pos++];
+
+					if ((i += num_zeros) + num_lits > pkt_length)
+						return -1;
+					if ((buf_pos + num_lits) > buf_length)
+						return 0;
+
+					for (uint32_t j = 0; j < num_lits; ++j) {
+						pkt[i++] ^= buf[buf_pos++];
+					}
+				}
+			} break;
+
+			default: {
+				return -1;
+			} break;
+		}
+
+		std::memcpy(prev, &pkt[0], pkt_length);
+		return buf_pos;
+	}
+}
+
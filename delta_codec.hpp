@@ -0,0 +1,63 @@
+#ifndef ARELION_DELTA_CODEC_HDR
+#define ARELION_DELTA_CODEC_HDR
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace arelion {
+	// per-id delta coding of fixed-length packets against the previous instance
+	// of the same id, for ids registered as delta-coded in protocol_def
+	//
+	// record layout: <uint8 id><uint8 tag><body>, where the body is either the
+	// packet minus its id (RECORD_TAG_FULL) or the XOR against the previous
+	// instance as a sequence of <uint8 zero_run><uint8 num_lits><lits> pairs
+	// (RECORD_TAG_DELTA); both ends update their instance cache per record
+	struct delta_codec {
+	public:
+		enum {
+			RECORD_TAG_FULL  = 0,
+			RECORD_TAG_DELTA = 1,
+		};
+
+		static constexpr uint32_t record_hdr_size() { return (sizeof(uint8_t) + sizeof(uint8_t)); }
+		static constexpr uint32_t max_record_size(uint32_t pkt_length) { return (pkt_length + sizeof(uint8_t)); }
+
+		delta_codec() { std::fill(m_cache_offsets, m_cache_offsets + 256, -1); }
+
+	protected:
+		uint8_t* get_instance(uint8_t id, uint32_t length);
+
+	protected:
+		// last instance of each id, packed back to back
+		std::vector<uint8_t> m_cache;
+
+		int32_t m_cache_offsets[256];
+	};
+
+
+	class delta_encoder: public delta_codec {
+	public:
+		// appends the record for packet <pkt> to <out>, returns its size
+		uint32_t encode_record(const uint8_t* pkt, uint32_t pkt_length, std::vector<uint8_t>& out);
+
+		// appends a full record for <pkt> to <out> without touching any cache, for
+		// records shared between connections; every encoder that sends it must also
+		// be given the packet through add_full_record to stay in sync with its decoder
+		static uint32_t frame_full_record(const uint8_t* pkt, uint32_t pkt_length, std::vector<uint8_t>& out);
+		void add_full_record(const uint8_t* pkt, uint32_t pkt_length) { std::copy(pkt, pkt + pkt_length, get_instance(pkt[0], pkt_length)); }
+	};
+
+
+	class delta_decoder: public delta_codec {
+	public:
+		// rebuilds the packet in <pkt> from the record at <buf>
+		// <  0: invalid record
+		// == 0: record incomplete, buffer too short
+		// >  0: size of the consumed record
+		int32_t decode_record(const uint8_t* buf, uint32_t buf_length, std::vector<uint8_t>& pkt);
+	};
+}
+
+#endif
+
@@ -0,0 +1,209 @@
+#ifndef ARELION_ENDPOINT_TABLE_HDR
+#define ARELION_ENDPOINT_TABLE_HDR
+
+#include <asio/ip/udp.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+
+namespace arelion {
+	// (address, port) of a UDP endpoint as plain integers; IPv4 addresses are
+	// stored v4-mapped, which cannot clash since a socket is either v4 or v6
+	struct endpoint_key {
+	public:
+		static endpoint_key pack(const asio::ip::udp::endpoint& endpoint) {
+			endpoint_key key;
+
+			const asio::ip::address& address = endpoint.address();
+
+			if (address.is_v4()) {
+				const asio::ip::address_v4::bytes_type bytes = address.to_v4().to_bytes();
+				uint8_t mapped[16] = {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff, bytes[0], bytes[1], bytes[2], bytes[3]};
+
+				std::memcpy(key.addr, mapped, sizeof(key.addr));
+			} else {
+				const asio::ip::address_v6 address_v6 = address.to_v6();
+				const asio::ip::address_v6::bytes_type bytes = address_v6.to_bytes();
+
+				std::memcpy(key.addr, bytes.data(), sizeof(key.addr));
+				key.scope = address_v6.scope_id();
+			}
+
+			key.port = endpoint.port();
+			return key;
+		}
+
+		bool operator == (const endpoint_key& k) const { return (addr[0] == k.addr[0] && addr[1] == k.addr[1] && scope == k.scope && port == k.port); }
+		bool operator != (const endpoint_key& k) const { return !(*this == k); }
+
+		uint32_t hash() const { return (uint32_t(hash64())); }
+		uint64_t hash64() const {
+			uint64_t h = (addr[0] * 0x9e3779b97f4a7c15ull) ^ addr[1] ^ ((uint64_t(port) << 32) | scope);
+
+			h ^= (h >> 33);
+			h *= 0xff51afd7ed558ccdull;
+			h ^= (h >> 33);
+			h *= 0xc4ceb9fe1a85ec53ull;
+			h ^= (h >> 33);
+
+			return h;
+		}
+
+	public:
+		uint64_t addr[2] = {0, 0};
+		uint32_t scope = 0;
+		uint16_t port = 0;
+	};
+
+
+	// open-addressing (linear probing) table from endpoints to values; values
+	// live densely in insertion order (until erased) so they can be iterated by
+	// index, buckets only hold their hash and index; erasing moves the last
+	// value into the hole, so indices are only stable until the next erase
+	template<typename T> class endpoint_table {
+	public:
+		size_t size() const { return m_entries.size(); }
+		bool empty() const { return m_entries.empty(); }
+
+		const endpoint_key& key_at(size_t n) const { return m_entries[n].first; }
+		const T& value_at(size_t n) const { return m_entries[n].second; }
+		T& value_at(size_t n) { return m_entries[n].second; }
+
+		T* find(const asio::ip::udp::endpoint& endpoint) { return (find(endpoint_key::pack(endpoint))); }
+		T* find(const endpoint_key& key) {
+			const uint32_t index = find_bucket(key);
+
+			if (index == EMPTY_BUCKET)
+				return nullptr;
+
+			return &m_entries[m_buckets[index].index].second;
+		}
+
+		// replaces the value of an existing key and returns it, T() if the key is new
+		T insert(const asio::ip::udp::endpoint& endpoint, T value) {
+			const endpoint_key key = endpoint_key::pack(endpoint);
+			const uint32_t index = find_bucket(key);
+
+			if (index != EMPTY_BUCKET) {
+				std::swap(m_entries[m_buckets[index].index].second, value);
+				return value;
+			}
+
+			if ((m_entries.size() + 1) * 2 > m_buckets.size())
+				rehash(std::max(m_buckets.size() * 2, size_t(16)));
+
+			m_entries.emplace_back(key, std::move(value));
+			insert_bucket(key.hash(), m_entries.size() - 1);
+			return T();
+		}
+
+		bool erase(const asio::ip::udp::endpoint& endpoint) {
+			const uint32_t index = find_bucket(endpoint_key::pack(endpoint));
+
+			if (index == EMPTY_BUCKET)
+				return false;
+
+			erase_at(m_buckets[index].index);
+			return true;
+		}
+
+		void erase_at(size_t n) {
+			erase_bucket(find_bucket_of(n));
+
+			if (n != (m_entries.size() - 1)) {
+				m_buckets[find_bucket_of(m_entries.size() - 1)].index = n;
+				m_entries[n] = std::move(m_entries.back());
+			}
+
+			m_entries.pop_back();
+		}
+
+		void clear() {
+			m_entries.clear();
+			m_buckets.assign(m_buckets.size(), bucket());
+		}
+
+	private:
+		enum: uint32_t {
+			EMPTY_BUCKET = ~0u,
+		};
+
+		struct bucket {
+			uint32_t hash = 0;
+			uint32_t index = EMPTY_BUCKET;
+		};
+
+		uint32_t get_mask() const { return (m_buckets.size() - 1); }
+
+		uint32_t find_bucket(const endpoint_key& key) const {
+			if (m_buckets.empty())
+				return EMPTY_BUCKET;
+
+			const uint32_t hash = key.hash();
+
+			for (uint32_t n = hash & get_mask(); m_buckets[n].index != EMPTY_BUCKET; n = (n + 1) & get_mask()) {
+				if (m_buckets[n].hash == hash && m_entries[m_buckets[n].index].first == key)
+					return n;
+			}
+
+			return EMPTY_BUCKET;
+		}
+
+		uint32_t find_bucket_of(size_t entry) const {
+			uint32_t n = m_entries[entry].first.hash() & get_mask();
+
+			while (m_buckets[n].index != entry) {
+				n = (n + 1) & get_mask();
+			}
+
+			return n;
+		}
+
+		void insert_bucket(uint32_t hash, size_t entry) {
+			uint32_t n = hash & get_mask();
+
+			while (m_buckets[n].index != EMPTY_BUCKET) {
+				n = (n + 1) & get_mask();
+			}
+
+			m_buckets[n].hash = hash;
+			m_buckets[n].index = entry;
+		}
+
+		// backward-shift deletion, so lookups never have to skip tombstones
+		void erase_bucket(uint32_t hole) {
+			for (uint32_t n = (hole + 1) & get_mask(); m_buckets[n].index != EMPTY_BUCKET; n = (n + 1) & get_mask()) {
+				const uint32_t home = m_buckets[n].hash & get_mask();
+
+				// an entry can fill the hole unless its home lies between the two
+				if (((n - home) & get_mask()) < ((n - hole) & get_mask()))
+					continue;
+
+				m_buckets[hole] = m_buckets[n];
+				hole = n;
+			}
+
+			m_buckets[hole] = bucket();
+		}
+
+		void rehash(size_t num_buckets) {
+			m_buckets.assign(num_buckets, bucket());
+
+			for (size_t n = 0; n < m_entries.size(); ++n) {
+				insert_bucket(m_entries[n].first.hash(), n);
+			}
+		}
+
+	private:
+		std::vector< std::pair<endpoint_key, T> > m_entries;
+		// power-of-two sized, at most half full
+		std::vector<bucket> m_buckets;
+	};
+}
+
+#endif
+
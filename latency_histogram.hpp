@@ -0,0 +1,113 @@
+#ifndef ARELION_LATENCY_HISTOGRAM_HDR
+#define ARELION_LATENCY_HISTOGRAM_HDR
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+#include "connection_metrics.hpp"
+
+namespace arelion {
+	// log-linear (HDR-style) histogram of durations in microseconds; every power
+	// of two is split into 2^SUB_BUCKET_BITS buckets, so any recorded value is
+	// reported within ~6% of its true size from 1us up to over an hour
+	//
+	// like connection_metrics it has a single writer and may be copied (read)
+	// from any thread at any time
+	struct latency_histogram {
+	public:
+		static constexpr uint32_t SUB_BUCKET_BITS = 4;
+		static constexpr uint32_t SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+		static constexpr uint32_t MAX_VALUE_BITS = 32;
+		static constexpr uint32_t NUM_BUCKETS = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+		void record(std::chrono::nanoseconds duration) {
+			const uint64_t usecs = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+			const uint64_t value = std::min(usecs, (uint64_t(1) << MAX_VALUE_BITS) - 1);
+
+			m_buckets[bucket_index(value)].add(1);
+			m_count.add(1);
+			m_total.add(value);
+			m_max.set(std::max(m_max.get(), value));
+		}
+
+		// smallest value (in microseconds) that at least <fraction> of all recorded values do not exceed
+		uint64_t get_percentile(float fraction) const {
+			const uint64_t count = get_count();
+			const uint64_t limit = std::max(uint64_t(count * fraction + 0.5f), uint64_t(1));
+
+			uint64_t sum = 0;
+
+			for (uint32_t i = 0; i < NUM_BUCKETS && count > 0; ++i) {
+				if ((sum += m_buckets[i].get()) >= limit)
+					return std::min(bucket_upper_bound(i), get_max());
+			}
+
+			return (get_max());
+		}
+
+		uint64_t get_count() const { return (m_count.get()); }
+		uint64_t get_mean() const { return (m_total.get() / std::max(get_count(), uint64_t(1))); }
+		uint64_t get_max() const { return (m_max.get()); }
+
+	private:
+		static uint32_t bucket_index(uint64_t value) {
+			if (value < SUB_BUCKET_COUNT)
+				return value;
+
+			uint32_t msb = 0;
+
+			while ((value >> (msb + 1)) != 0)
+				msb += 1;
+
+			const uint32_t shift = msb - SUB_BUCKET_BITS;
+			return (((shift + 1) << SUB_BUCKET_BITS) + ((value >> shift) & (SUB_BUCKET_COUNT - 1)));
+		}
+
+		static uint64_t bucket_upper_bound(uint32_t index) {
+			if (index < SUB_BUCKET_COUNT)
+				return index;
+
+			const uint32_t shift = (index >> SUB_BUCKET_BITS) - 1;
+			const uint64_t base = uint64_t(SUB_BUCKET_COUNT + (index & (SUB_BUCKET_COUNT - 1))) << shift;
+
+			return (base + (uint64_t(1) << shift) - 1);
+		}
+
+	private:
+		metric_value m_buckets[NUM_BUCKETS];
+
+		metric_value m_count;
+		metric_value m_total;
+		metric_value m_max;
+	};
+
+
+	// time spent by outgoing and incoming data in each stage of a udp_connection
+	struct message_latency_stats {
+	public:
+		enum {
+			// reliable in-order packet from send_data until it is chunked (latency budget, pacing backlog)
+			STAGE_QUEUED     = 0,
+			// chunk from its creation until it first leaves in a datagram
+			STAGE_PACED      = 1,
+			// chunk from its first transmission until acked, if it never had to be resent
+			STAGE_DELIVERED  = 2,
+			// as above, for chunks that were resent at least once
+			STAGE_RESENT     = 3,
+			// received in-order chunk until all chunks before it arrived
+			STAGE_REASSEMBLY = 4,
+			NUM_STAGES       = 5,
+		};
+
+		static const char* get_stage_name(uint32_t stage) {
+			constexpr const char* names[NUM_STAGES] = {"queued", "paced", "delivered", "resent", "reassembly"};
+			return names[stage];
+		}
+
+		latency_histogram stages[NUM_STAGES];
+	};
+}
+
+#endif
+
@@ -1,4 +1,5 @@
 #include <cassert>
+#include <cinttypes>
 
 #include "local_connection.hpp"
 #include "protocol_def.hpp"
@@ -6,15 +7,18 @@
 namespace arelion {
 	uint32_t local_connection::num_instances = 0;
 
-	std::deque< std::shared_ptr<const raw_packet> > local_connection::pkt_queues[MAX_INSTANCES];
+	std::deque< std::shared_ptr<const raw_packet> > local_connection::pkt_queues[MAX_INSTANCES][MAX_STREAMS];
 	std::mutex local_connection::mutexes[MAX_INSTANCES];
 
 
 	local_connection::local_connection() {
 		assert(num_instances < MAX_INSTANCES);
 
+		m_instance_num = num_instances++;
+
 		// clear data that might have been left over
-		pkt_queues[m_instance_num = num_instances++].clear();
+		for (auto& pkt_queue: pkt_queues[m_instance_num])
+			pkt_queue.clear();
 	}
 
 
@@ -23,35 +27,37 @@ namespace arelion {
 			return;
 
 		std::lock_guard<std::mutex> scoped_lock(mutexes[m_instance_num]);
-		pkt_queues[m_instance_num].clear();
+
+		for (auto& pkt_queue: pkt_queues[m_instance_num])
+			pkt_queue.clear();
 	}
 
-	void local_connection::send_data(std::shared_ptr<const raw_packet> packet) {
+	void local_connection::send_data(std::shared_ptr<const raw_packet> packet, const uint8_t /*delivery*/, const uint8_t stream) {
 		assert(proto_def.is_valid_packet(packet->data, packet->length));
 
-		m_data_sent += packet->length;
+		m_metrics.data_sent.add(packet->length);
 
 		// when sending from A to B we must lock B's queue
 		std::lock_guard<std::mutex> scoped_lock(mutexes[remote_instance_idx()]);
-		pkt_queues[remote_instance_idx()].push_back(packet);
+		pkt_queues[remote_instance_idx()][stream].push_back(packet);
 	}
 
-	std::shared_ptr<const raw_packet> local_connection::get_data() {
+	std::shared_ptr<const raw_packet> local_connection::get_data(const uint8_t stream) {
 		std::lock_guard<std::mutex> scoped_lock(mutexes[m_instance_num]);
-		std::deque< std::shared_ptr<const raw_packet> >& pkt_queue = pkt_queues[m_instance_num];
+		std::deque< std::shared_ptr<const raw_packet> >& pkt_queue = pkt_queues[m_instance_num][stream];
 
 		if (pkt_queue.empty())
 			return {};
 
 		std::shared_ptr<const raw_packet> pkt = pkt_queue.front();
 		pkt_queue.pop_front();
-		m_data_recv += pkt->length;
+		m_metrics.data_recv.add(pkt->length);
 		return pkt;
 	}
 
-	std::shared_ptr<const raw_packet> local_connection::peek(uint32_t index) const {
+	std::shared_ptr<const raw_packet> local_connection::peek(uint32_t index, const uint8_t stream) const {
 		std::lock_guard<std::mutex> scoped_lock(mutexes[m_instance_num]);
-		std::deque< std::shared_ptr<const raw_packet> >& pkt_queue = pkt_queues[m_instance_num];
+		std::deque< std::shared_ptr<const raw_packet> >& pkt_queue = pkt_queues[m_instance_num][stream];
 
 		if (index >= pkt_queue.size())
 			return {};
@@ -59,9 +65,9 @@ namespace arelion {
 		return pkt_queue[index];
 	}
 
-	void local_connection::delete_buffer_packet_at(uint32_t index) {
+	void local_connection::delete_buffer_packet_at(uint32_t index, const uint8_t stream) {
 		std::lock_guard<std::mutex> scoped_lock(mutexes[m_instance_num]);
-		std::deque< std::shared_ptr<const raw_packet> >& pkt_queue = pkt_queues[m_instance_num];
+		std::deque< std::shared_ptr<const raw_packet> >& pkt_queue = pkt_queues[m_instance_num][stream];
 
 		if (index >= pkt_queue.size())
 			return;
@@ -75,21 +81,21 @@ namespace arelion {
 		char* ptr = &buf[0];
 
 		ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "[local_connection::%s]\n", __func__);
-		ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "\t%u bytes sent  \n", m_data_sent);
-		ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "\t%u bytes recv'd\n", m_data_recv);
+		ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "\t%" PRIu64 " bytes sent  \n", m_metrics.data_sent.get());
+		ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "\t%" PRIu64 " bytes recv'd\n", m_metrics.data_recv.get());
 
 		return buf;
 	}
 
 
-	bool local_connection::has_incoming_data() const {
+	bool local_connection::has_incoming_data(const uint8_t stream) const {
 		std::lock_guard<std::mutex> scoped_lock(mutexes[m_instance_num]);
-		return (!pkt_queues[m_instance_num].empty());
+		return (!pkt_queues[m_instance_num][stream].empty());
 	}
 
-	uint32_t local_connection::get_packet_queue_size() const {
+	uint32_t local_connection::get_packet_queue_size(const uint8_t stream) const {
 		std::lock_guard<std::mutex> scoped_lock(mutexes[m_instance_num]);
-		return (!pkt_queues[m_instance_num].size());
+		return (pkt_queues[m_instance_num][stream].size());
 	}
 }
 
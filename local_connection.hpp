@@ -15,16 +15,17 @@ namespace arelion {
 		~local_connection() { num_instances -= 1; }
 
 
-		void send_data(std::shared_ptr<const raw_packet> packet) override;
+		// every delivery class is satisfied by the in-order queue
+		void send_data(std::shared_ptr<const raw_packet> packet, const uint8_t delivery = DELIVERY_RELIABLE_ORDERED, const uint8_t stream = 0) override;
 
-		std::shared_ptr<const raw_packet> peek(uint32_t index) const override;
-		std::shared_ptr<const raw_packet> get_data() override;
+		std::shared_ptr<const raw_packet> peek(uint32_t index, const uint8_t stream = 0) const override;
+		std::shared_ptr<const raw_packet> get_data(const uint8_t stream = 0) override;
 
-		void delete_buffer_packet_at(uint32_t index) override;
+		void delete_buffer_packet_at(uint32_t index, const uint8_t stream = 0) override;
 		void reconnect_to(base_connection& /*conn*/) override {}
 		void flush(const bool /*forced*/) override {}
 
-		bool has_incoming_data() const override;
+		bool has_incoming_data(const uint8_t stream = 0) const override;
 		bool check_timeout(int32_t /*seconds*/, bool /*initial*/) const override { return false; }
 		bool can_reconnect() const override { return false; }
 		bool needs_reconnect() override { return false; }
@@ -33,7 +34,7 @@ namespace arelion {
 		void close(bool flush) override;
 		void set_loss_factor(int32_t /*factor*/) override {}
 
-		uint32_t get_packet_queue_size() const override;
+		uint32_t get_packet_queue_size(const uint8_t stream = 0) const override;
 
 		std::string get_statistics() const override;
 		std::string get_full_address() const override { return "Localhost"; }
@@ -41,7 +42,7 @@ namespace arelion {
 	private:
 		static constexpr uint32_t MAX_INSTANCES = 2;
 
-		static std::deque< std::shared_ptr<const raw_packet> > pkt_queues[MAX_INSTANCES];
+		static std::deque< std::shared_ptr<const raw_packet> > pkt_queues[MAX_INSTANCES][MAX_STREAMS];
 		static std::mutex mutexes[MAX_INSTANCES];
 
 		uint32_t remote_instance_idx() const { return ((m_instance_num + 1) % MAX_INSTANCES); }
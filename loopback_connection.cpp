@@ -1,30 +1,30 @@
 #include "loopback_connection.hpp"
 
 namespace arelion {
-	void loopback_connection::send_data(std::shared_ptr<const raw_packet> data) {
-		m_pkt_queue.push_back(data);
+	void loopback_connection::send_data(std::shared_ptr<const raw_packet> data, const uint8_t /*delivery*/, const uint8_t stream) {
+		m_pkt_queues[stream].push_back(data);
 	}
 
-	std::shared_ptr<const raw_packet> loopback_connection::peek(uint32_t index) const {
-		if (index >= m_pkt_queue.size())
+	std::shared_ptr<const raw_packet> loopback_connection::peek(uint32_t index, const uint8_t stream) const {
+		if (index >= m_pkt_queues[stream].size())
 			return {};
 
-		return m_pkt_queue[index];
+		return m_pkt_queues[stream][index];
 	}
 
-	void loopback_connection::delete_buffer_packet_at(uint32_t index) {
-		if (index >= m_pkt_queue.size())
+	void loopback_connection::delete_buffer_packet_at(uint32_t index, const uint8_t stream) {
+		if (index >= m_pkt_queues[stream].size())
 			return;
 
-		m_pkt_queue.erase(m_pkt_queue.begin() + index);
+		m_pkt_queues[stream].erase(m_pkt_queues[stream].begin() + index);
 	}
 
-	std::shared_ptr<const raw_packet> loopback_connection::get_data() {
-		if (m_pkt_queue.empty())
+	std::shared_ptr<const raw_packet> loopback_connection::get_data(const uint8_t stream) {
+		if (m_pkt_queues[stream].empty())
 			return {};
 
-		std::shared_ptr<const raw_packet> pkt = m_pkt_queue.front();
-		m_pkt_queue.pop_front();
+		std::shared_ptr<const raw_packet> pkt = m_pkt_queues[stream].front();
+		m_pkt_queues[stream].pop_front();
 		return pkt;
 	}
 }
@@ -9,20 +9,23 @@ namespace arelion {
 	// dummy queue-like connection, bounces everything back to the sender
 	class loopback_connection: public base_connection {
 	public:
-		void send_data(std::shared_ptr<const raw_packet> data) override;
+		// every delivery class is satisfied by the in-order queue
+		void send_data(std::shared_ptr<const raw_packet> data, const uint8_t delivery = DELIVERY_RELIABLE_ORDERED, const uint8_t stream = 0) override;
 
-		std::shared_ptr<const raw_packet> peek(uint32_t index) const override;
-		std::shared_ptr<const raw_packet> get_data() override;
+		std::shared_ptr<const raw_packet> peek(uint32_t index, const uint8_t stream = 0) const override;
+		std::shared_ptr<const raw_packet> get_data(const uint8_t stream = 0) override;
 
-		void delete_buffer_packet_at(uint32_t index) override;
+		void delete_buffer_packet_at(uint32_t index, const uint8_t stream = 0) override;
 		void flush(const bool /*forced*/) override {}
 		void reconnect_to(base_connection& /*conn*/) override {}
 
-		bool has_incoming_data() const override { return (!m_pkt_queue.empty()); }
+		bool has_incoming_data(const uint8_t stream = 0) const override { return (!m_pkt_queues[stream].empty()); }
 		bool check_timeout(int32_t /*seconds*/, bool /*initial*/) const override { return false; }
 		bool can_reconnect() const override { return false; }
 		bool needs_reconnect() override { return false; }
 
+		uint32_t get_packet_queue_size(const uint8_t stream = 0) const override { return (m_pkt_queues[stream].size()); }
+
 		void unmute() override {}
 		void close(bool /*flush*/) override {}
 		void set_loss_factor(int32_t /*factor*/) override {}
@@ -31,7 +34,7 @@ namespace arelion {
 		std::string get_full_address() const override { return "Loopback"; }
 
 	private:
-		std::deque< std::shared_ptr<const raw_packet> > m_pkt_queue;
+		std::deque< std::shared_ptr<const raw_packet> > m_pkt_queues[MAX_STREAMS];
 	};
 }
 
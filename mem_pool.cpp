@@ -0,0 +1,102 @@
+#include <new>
+
+#include "mem_pool.hpp"
+#include "config.hpp"
+
+namespace arelion {
+	namespace mem_pool {
+		// two classes per power of two (16, 24, 32, 48, ...), so odd sizes like a
+		// chunk payload plus its control block waste at most a third
+		static constexpr uint32_t NUM_CLASSES = 19;
+
+		struct free_block {
+			free_block* next;
+		};
+
+		// plain thread-locals, still usable while the thread is being torn down
+		static thread_local free_block* free_lists[NUM_CLASSES] = {};
+		static thread_local uint32_t free_counts[NUM_CLASSES] = {};
+		static thread_local bool released = false;
+
+		// returns the cached blocks to the heap when the thread exits
+		struct thread_cache {
+			~thread_cache() {
+				for (uint32_t n = 0; n < NUM_CLASSES; ++n) {
+					while (free_lists[n] != nullptr) {
+						free_block* block = free_lists[n];
+						free_lists[n] = block->next;
+						::operator delete(block);
+					}
+
+					free_counts[n] = 0;
+				}
+
+				released = true;
+			}
+		};
+
+		static thread_cache& get_thread_cache() {
+			static thread_local thread_cache cache;
+			return cache;
+		}
+
+		static uint32_t get_size_class(size_t size) {
+			if (size <= MIN_BLOCK_SIZE)
+				return 0;
+
+			// 2^msb < size <= 2^(msb + 1)
+			const uint32_t msb = 63 - __builtin_clzll(size - 1);
+
+			if (size <= (size_t(3) << (msb - 1)))
+				return ((msb - 4) * 2 + 1);
+
+			return ((msb - 3) * 2);
+		}
+
+		static size_t get_block_size(uint32_t size_class) {
+			return (((size_class & 1) != 0)? (size_t(24) << (size_class / 2)): (MIN_BLOCK_SIZE << (size_class / 2)));
+		}
+
+		static_assert(((MIN_BLOCK_SIZE << ((NUM_CLASSES - 1) / 2))) == MAX_BLOCK_SIZE, "size classes do not cover the pool");
+
+
+		void* allocate(size_t size) {
+			if (size > MAX_BLOCK_SIZE)
+				return (::operator new(size));
+
+			const uint32_t size_class = get_size_class(size);
+
+			if (free_lists[size_class] == nullptr)
+				return (::operator new(get_block_size(size_class)));
+
+			free_block* block = free_lists[size_class];
+
+			free_lists[size_class] = block->next;
+			free_counts[size_class] -= 1;
+			return block;
+		}
+
+		void deallocate(void* ptr, size_t size) {
+			if (size > MAX_BLOCK_SIZE) {
+				::operator delete(ptr);
+				return;
+			}
+
+			const uint32_t size_class = get_size_class(size);
+
+			if (released || (free_counts[size_class] * get_block_size(size_class)) >= config::mem_pool_cache_bytes) {
+				::operator delete(ptr);
+				return;
+			}
+
+			get_thread_cache();
+
+			free_block* block = static_cast<free_block*>(ptr);
+
+			block->next = free_lists[size_class];
+			free_lists[size_class] = block;
+			free_counts[size_class] += 1;
+		}
+	}
+}
+
@@ -0,0 +1,59 @@
+#ifndef ARELION_MEM_POOL_HDR
+#define ARELION_MEM_POOL_HDR
+
+#include <cstddef>
+#include <cstdint>
+
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <set>
+#include <utility>
+
+namespace arelion {
+	// per-thread free lists of blocks in two size classes per power of two; freed
+	// blocks are kept for reuse rather than returned to the heap, so a connection
+	// stops allocating once its queues have reached their working size (larger
+	// blocks bypass the pool)
+	namespace mem_pool {
+		static constexpr size_t MIN_BLOCK_SIZE = 16;
+		static constexpr size_t MAX_BLOCK_SIZE = 8192;
+
+		void* allocate(size_t size);
+		void deallocate(void* ptr, size_t size);
+	}
+
+
+	template<typename T> struct pool_allocator {
+	public:
+		typedef T value_type;
+
+		pool_allocator() = default;
+		template<typename U> pool_allocator(const pool_allocator<U>&) {}
+
+		T* allocate(size_t n) {
+			static_assert(alignof(T) <= alignof(std::max_align_t), "over-aligned types are not supported");
+			return static_cast<T*>(mem_pool::allocate(n * sizeof(T)));
+		}
+		void deallocate(T* ptr, size_t n) {
+			mem_pool::deallocate(ptr, n * sizeof(T));
+		}
+
+		template<typename U> bool operator == (const pool_allocator<U>&) const { return true; }
+		template<typename U> bool operator != (const pool_allocator<U>&) const { return false; }
+	};
+
+	template<typename T> using pool_deque = std::deque<T, pool_allocator<T> >;
+	template<typename T> using pool_list = std::list<T, pool_allocator<T> >;
+	template<typename K> using pool_set = std::set<K, std::less<K>, pool_allocator<K> >;
+	template<typename K, typename V> using pool_map = std::map<K, V, std::less<K>, pool_allocator< std::pair<const K, V> > >;
+
+	// object and control block come from the pool as one block
+	template<typename T, typename... A> std::shared_ptr<T> make_pooled(A&&... args) {
+		return (std::allocate_shared<T>(pool_allocator<T>(), std::forward<A>(args)...));
+	}
+}
+
+#endif
+
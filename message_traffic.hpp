@@ -0,0 +1,47 @@
+#ifndef ARELION_MESSAGE_TRAFFIC_HDR
+#define ARELION_MESSAGE_TRAFFIC_HDR
+
+#include <cstdint>
+
+#include "connection_metrics.hpp"
+
+namespace arelion {
+	// messages and bytes per message id in both directions of a udp_connection;
+	// bytes are counted as they enter (or leave) the stream, i.e. after delta
+	// coding but before compression and without chunk or datagram headers
+	//
+	// resends are charged by chunk: every chunk (with its headers) goes to the
+	// id of the largest message in it, or in its block for ordered chunks
+	struct message_traffic_stats {
+	public:
+		struct id_counters {
+		public:
+			uint64_t get_total_bytes() const { return (sent_bytes.get() + recv_bytes.get() + resent_bytes.get()); }
+
+		public:
+			metric_value sent_msgs;
+			metric_value sent_bytes;
+			metric_value recv_msgs;
+			metric_value recv_bytes;
+			metric_value resent_bytes;
+		};
+
+		void record_sent(uint8_t id, uint32_t bytes) {
+			ids[id].sent_msgs.add(1);
+			ids[id].sent_bytes.add(bytes);
+		}
+		void record_recv(uint8_t id, uint32_t bytes) {
+			ids[id].recv_msgs.add(1);
+			ids[id].recv_bytes.add(bytes);
+		}
+		void record_resent(uint8_t id, uint32_t bytes) {
+			ids[id].resent_bytes.add(bytes);
+		}
+
+	public:
+		id_counters ids[256];
+	};
+}
+
+#endif
+
@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+#include "net_waiter.hpp"
+
+namespace arelion {
+	net_waiter::net_waiter() {
+		#ifdef __linux__
+		m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		m_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+		if (m_epoll_fd >= 0 && m_event_fd >= 0) {
+			epoll_event event;
+
+			std::memset(&event, 0, sizeof(event));
+			event.events = EPOLLIN;
+			event.data.fd = m_event_fd;
+
+			if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_event_fd, &event) == 0)
+				return;
+		}
+
+		fprintf(stderr, "[net_waiter::%s] epoll unavailable (%s), waits will poll", __func__, std::strerror(errno));
+
+		if (m_epoll_fd >= 0)
+			close(m_epoll_fd);
+		if (m_event_fd >= 0)
+			close(m_event_fd);
+
+		m_epoll_fd = -1;
+		m_event_fd = -1;
+		#endif
+	}
+
+	net_waiter::~net_waiter() {
+		#ifdef __linux__
+		if (m_epoll_fd >= 0)
+			close(m_epoll_fd);
+		if (m_event_fd >= 0)
+			close(m_event_fd);
+		#endif
+	}
+
+
+	void net_waiter::add_socket(asio::ip::udp::socket& socket) {
+		#ifdef __linux__
+		if (m_epoll_fd < 0)
+			return;
+
+		epoll_event event;
+
+		std::memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN;
+		event.data.fd = socket.native_handle();
+
+		if (epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, event.data.fd, &event) != 0 && errno != EEXIST)
+			fprintf(stderr, "[net_waiter::%s] failed to watch socket: %s", __func__, std::strerror(errno));
+		#endif
+	}
+
+
+	bool net_waiter::wait_until(time_point deadline) {
+		const time_point cur_time = std::chrono::high_resolution_clock::now();
+
+		#ifdef __linux__
+		if (m_epoll_fd >= 0) {
+			// rounded up, waking before the deadline would only make the caller wait
+			// again; past deadlines (min() included) are not subtracted from, they
+			// would overflow
+			int64_t wait_ms = -1;
+
+			if (deadline <= cur_time) {
+				wait_ms = 0;
+			} else if (deadline != time_point::max()) {
+				wait_ms = (std::chrono::nanoseconds(deadline - cur_time).count() + 999999) / 1000000;
+			}
+
+			epoll_event events[4];
+
+			const int num_events = epoll_wait(m_epoll_fd, events, 4, int(std::min(wait_ms, int64_t(INT32_MAX))));
+
+			if (num_events < 0 && errno != EINTR)
+				fprintf(stderr, "[net_waiter::%s] epoll_wait failed: %s", __func__, std::strerror(errno));
+
+			m_armed.store(false);
+
+			for (int n = 0; n < num_events; ++n) {
+				uint64_t count = 0;
+
+				if (events[n].data.fd == m_event_fd && read(m_event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+					fprintf(stderr, "[net_waiter::%s] failed to reset eventfd: %s", __func__, std::strerror(errno));
+			}
+
+			return (num_events > 0);
+		}
+		#endif
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+
+		// sockets can not be watched here, the caller has to look at them soon
+		const time_point poll_time = cur_time + std::chrono::milliseconds(1);
+		const bool notified = m_cond.wait_until(lock, std::min(deadline, poll_time), [this]() { return m_notified; });
+
+		m_armed.store(false);
+		m_notified = false;
+		return notified;
+	}
+
+	void net_waiter::notify() {
+		#ifdef __linux__
+		if (m_event_fd >= 0) {
+			const uint64_t count = 1;
+
+			if (write(m_event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+				fprintf(stderr, "[net_waiter::%s] failed to signal eventfd: %s", __func__, std::strerror(errno));
+
+			return;
+		}
+		#endif
+
+		{
+			std::lock_guard<std::mutex> scoped_lock(m_mutex);
+			m_notified = true;
+		}
+
+		m_cond.notify_one();
+	}
+}
+
@@ -0,0 +1,57 @@
+#ifndef ARELION_NET_WAITER_HDR
+#define ARELION_NET_WAITER_HDR
+
+#include <asio/ip/udp.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+namespace arelion {
+	// blocks the network thread until one of its sockets becomes readable, a
+	// deadline passes or another thread calls notify(); epoll and an eventfd on
+	// Linux, elsewhere (or if those can not be created) a condition variable
+	// that also gives up after a millisecond so sockets are still polled
+	class net_waiter {
+	public:
+		typedef std::chrono::high_resolution_clock::time_point time_point;
+
+		net_waiter();
+		~net_waiter();
+
+		net_waiter(const net_waiter&) = delete;
+		net_waiter& operator = (const net_waiter&) = delete;
+
+		// sockets are forgotten once closed; adding one twice is harmless
+		void add_socket(asio::ip::udp::socket& socket);
+
+		// true if woken by a socket or notify() before <deadline>, which may
+		// already have passed
+		bool wait_until(time_point deadline);
+		// may be called from any thread, a wakeup is kept until the next wait
+		void notify();
+
+		// announces a wait_until, call before looking for work to do; until it
+		// returns notify_waiting() wakes it, otherwise that costs no syscall
+		void arm() { m_armed.store(true); }
+		void notify_waiting() {
+			if (m_armed.load())
+				notify();
+		}
+
+	private:
+		std::mutex m_mutex;
+		std::condition_variable m_cond;
+
+		int m_epoll_fd = -1;
+		int m_event_fd = -1;
+
+		std::atomic<bool> m_armed{false};
+
+		bool m_notified = false;
+	};
+}
+
+#endif
+
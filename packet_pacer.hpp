@@ -0,0 +1,69 @@
+#ifndef ARELION_PACKET_PACER_HDR
+#define ARELION_PACKET_PACER_HDR
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+namespace arelion {
+	// token-bucket pacer: tokens (bytes) accumulate at <rate> per second up to
+	// <burst>, and a datagram may leave whenever the bucket is not in debt; the
+	// datagram's size is charged afterwards, which spreads departures evenly
+	struct packet_pacer {
+	public:
+		typedef std::chrono::high_resolution_clock::time_point time_point;
+		typedef std::chrono::nanoseconds time_range;
+
+		void init(time_point t, int32_t rate, int32_t burst) {
+			m_last_refill_time = t;
+			m_tokens = burst;
+
+			set_rate(rate, burst);
+		}
+
+		// <rate> <= 0 disables pacing
+		void set_rate(int32_t rate, int32_t burst) {
+			m_rate = rate;
+			m_burst = std::max(burst, 1);
+			m_tokens = std::min(m_tokens, float(m_burst));
+		}
+
+		void refill(time_point t) {
+			if (t <= m_last_refill_time)
+				return;
+
+			const std::chrono::duration<float> dt = t - m_last_refill_time;
+
+			m_tokens = std::min(m_tokens + dt.count() * m_rate, float(m_burst));
+			m_last_refill_time = t;
+		}
+
+		void consume(uint32_t bytes) { m_tokens -= bytes; }
+
+		// true if a datagram may leave now, after <queued> bytes that are already waiting
+		bool can_send(uint32_t queued = 0) const { return (m_rate <= 0 || (m_tokens - queued) > 0.0f); }
+
+		// earliest time at which can_send(<queued>) will hold, as of the last refill
+		time_point get_departure_time(uint32_t queued = 0) const {
+			if (can_send(queued))
+				return m_last_refill_time;
+
+			const std::chrono::duration<float> wait_time((queued - m_tokens) / m_rate);
+			return (m_last_refill_time + std::chrono::duration_cast<time_range>(wait_time) + time_range(1));
+		}
+
+		int32_t get_rate() const { return m_rate; }
+		int32_t get_burst() const { return m_burst; }
+
+	private:
+		time_point m_last_refill_time;
+
+		int32_t m_rate = 0;
+		int32_t m_burst = 1;
+
+		float m_tokens = 0.0f;
+	};
+}
+
+#endif
+
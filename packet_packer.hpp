@@ -89,6 +89,10 @@ namespace arelion {
 			std::copy(v.begin(), v.end(), std::back_inserter(m_data));
 		}
 
+		void pack(const uint8_t* p, uint32_t len) {
+			m_data.insert(m_data.end(), p, p + len);
+		}
+
 	private:
 		std::vector<uint8_t>& m_data;
 	};
@@ -0,0 +1,75 @@
+#include <cstdio>
+#include <cstring>
+
+#include "packet_trace.hpp"
+
+namespace arelion {
+	packet_trace::packet_trace(uint32_t num_events) {
+		uint32_t size = 1;
+
+		while (size < num_events)
+			size <<= 1;
+
+		m_slots = std::vector<slot>(size);
+	}
+
+
+	void packet_trace::get_events(std::vector<packet_trace_event>& events) const {
+		const uint64_t head = m_head.load(std::memory_order_acquire);
+		const uint64_t tail = (head > m_slots.size())? (head - m_slots.size()): 0;
+
+		events.clear();
+		events.reserve(head - tail);
+
+		for (uint64_t seq = tail; seq < head; ++seq) {
+			const slot& s = m_slots[seq & (m_slots.size() - 1)];
+
+			if (s.seq.load(std::memory_order_acquire) != (seq + 1))
+				continue;
+
+			const packet_trace_event event = s.event;
+
+			// skip the event if the writer has lapped us while copying it
+			std::atomic_thread_fence(std::memory_order_acquire);
+
+			if (s.seq.load(std::memory_order_relaxed) != (seq + 1))
+				continue;
+
+			events.push_back(event);
+		}
+	}
+
+	bool packet_trace::dump(const std::string& file_name, const std::string& label) const {
+		std::vector<packet_trace_event> events;
+		get_events(events);
+
+		FILE* file = fopen(file_name.c_str(), "wb");
+
+		if (file == nullptr) {
+			fprintf(stderr, "[packet_trace::%s] failed to open \"%s\"", __func__, file_name.c_str());
+			return false;
+		}
+
+		file_header header;
+		std::memset(&header, 0, sizeof(header));
+
+		header.magic = FILE_MAGIC;
+		header.version = FILE_VERSION;
+		header.event_size = sizeof(packet_trace_event);
+		header.num_events = events.size();
+
+		std::strncpy(header.label, label.c_str(), sizeof(header.label) - 1);
+
+		bool ret = true;
+
+		ret &= (fwrite(&header, sizeof(header), 1, file) == 1);
+		ret &= (events.empty() || fwrite(&events[0], sizeof(packet_trace_event), events.size(), file) == events.size());
+		ret &= (fclose(file) == 0);
+
+		if (!ret)
+			fprintf(stderr, "[packet_trace::%s] failed to write \"%s\"", __func__, file_name.c_str());
+
+		return ret;
+	}
+}
+
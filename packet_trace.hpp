@@ -0,0 +1,99 @@
+#ifndef ARELION_PACKET_TRACE_HDR
+#define ARELION_PACKET_TRACE_HDR
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace arelion {
+	// one traced datagram or pacing decision, written to dumps verbatim
+	struct packet_trace_event {
+	public:
+		enum {
+			TYPE_SEND     = 0,
+			TYPE_RECV     = 1,
+			// received datagram failed its checksum
+			TYPE_RECV_BAD = 2,
+			// pacer held back pending chunks, <value> is the wait in microseconds
+			TYPE_PACED    = 3,
+		};
+
+		// high_resolution_clock time in nanoseconds
+		int64_t time = 0;
+
+		int32_t last_continuous = 0;
+		// lowest and highest reliable chunk number carried, -1 if none
+		int32_t first_chunk = -1;
+		int32_t last_chunk = -1;
+
+		uint32_t value = 0;
+		uint16_t size = 0;
+
+		uint8_t type = 0;
+		int8_t nak_type = 0;
+		uint8_t flags = 0;
+
+		// for sends: first transmissions and resends of reliable chunks; for
+		// receives: reliable chunks accepted and duplicates discarded
+		uint8_t new_chunks = 0;
+		uint8_t old_chunks = 0;
+		uint8_t unreliable_chunks = 0;
+	};
+
+
+	// fixed-size ring of the most recent trace events of a connection; the network
+	// thread is the only writer, and any thread may take a copy through get_events
+	// or dump without stopping it (slots overwritten mid-copy are left out)
+	class packet_trace {
+	public:
+		static constexpr uint32_t FILE_MAGIC = 0x43525441; // "ATRC"
+		static constexpr uint32_t FILE_VERSION = 1;
+
+		// layout of the dump file, followed by <num_events> packet_trace_event's
+		struct file_header {
+			uint32_t magic;
+			uint32_t version;
+			uint32_t event_size;
+			uint32_t num_events;
+
+			char label[64];
+		};
+
+	public:
+		// <num_events> is rounded up to a power of two
+		packet_trace(uint32_t num_events);
+
+		void record(const packet_trace_event& event) {
+			const uint64_t head = m_head.load(std::memory_order_relaxed);
+			slot& s = m_slots[head & (m_slots.size() - 1)];
+
+			// invalidate the slot while it is being overwritten
+			s.seq.store(0, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+
+			s.event = event;
+
+			s.seq.store(head + 1, std::memory_order_release);
+			m_head.store(head + 1, std::memory_order_release);
+		}
+
+		// copies the retained events, oldest first
+		void get_events(std::vector<packet_trace_event>& events) const;
+		// writes the retained events to <file_name>, tagged with <label>
+		bool dump(const std::string& file_name, const std::string& label) const;
+
+	private:
+		struct slot {
+			std::atomic<uint64_t> seq{0};
+			packet_trace_event event;
+		};
+
+		std::vector<slot> m_slots;
+		std::atomic<uint64_t> m_head{0};
+	};
+}
+
+#endif
+
@@ -73,6 +73,11 @@ namespace arelion {
 			m_pos += unpack_len;
 		}
 
+		void unpack(uint8_t* p, uint8_t unpack_len) {
+			std::memcpy(p, m_data + m_pos, unpack_len);
+			m_pos += unpack_len;
+		}
+
 		uint32_t bytes_remaining() const {
 			return (m_len - std::min(m_pos, m_len));
 		}
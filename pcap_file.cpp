@@ -0,0 +1,319 @@
+#include <chrono>
+#include <cstring>
+
+#include "pcap_file.hpp"
+
+namespace arelion {
+	static constexpr uint32_t PCAP_MAGIC_USECS = 0xA1B2C3D4;
+	static constexpr uint32_t PCAP_MAGIC_NSECS = 0xA1B23C4D;
+
+	static constexpr uint32_t LINKTYPE_ETHERNET = 1;
+	static constexpr uint32_t LINKTYPE_RAW = 101;
+	static constexpr uint32_t LINKTYPE_IPV4 = 228;
+	static constexpr uint32_t LINKTYPE_IPV6 = 229;
+
+	static constexpr uint32_t FILE_HDR_SIZE = 24;
+	static constexpr uint32_t RECORD_HDR_SIZE = 16;
+	static constexpr uint32_t MAX_RECORD_SIZE = 256 * 1024;
+
+	static constexpr uint8_t IP_PROTO_UDP = 17;
+
+	static uint16_t read_be16(const uint8_t* p) { return ((p[0] << 8) | p[1]); }
+	static void write_be16(uint8_t* p, uint16_t v) { p[0] = v >> 8; p[1] = v & 0xFF; }
+
+	static uint32_t read_u32(const uint8_t* p, bool swapped) {
+		uint32_t v;
+		std::memcpy(&v, p, sizeof(v));
+		return (swapped? __builtin_bswap32(v): v);
+	}
+
+	// ones' complement sum as used by IP and UDP checksums, not yet folded
+	static uint32_t sum_be16(const uint8_t* p, uint32_t size) {
+		uint32_t sum = 0;
+
+		for (uint32_t i = 0; (i + 1) < size; i += 2)
+			sum += read_be16(p + i);
+
+		if ((size & 1) != 0)
+			sum += (p[size - 1] << 8);
+
+		return sum;
+	}
+
+	static uint16_t fold_checksum(uint32_t sum) {
+		while ((sum >> 16) != 0)
+			sum = (sum & 0xFFFF) + (sum >> 16);
+
+		return ~sum;
+	}
+
+
+
+	bool pcap_writer::open(const std::string& file_name) {
+		close();
+
+		if ((m_file = fopen(file_name.c_str(), "wb")) == nullptr) {
+			fprintf(stderr, "[pcap_writer::%s] failed to open \"%s\"", __func__, file_name.c_str());
+			return false;
+		}
+
+		// version 2.4, UTC, 64KB snapshot length
+		const uint32_t header[6] = {PCAP_MAGIC_USECS, 2 | (4 << 16), 0, 0, 65535, LINKTYPE_RAW};
+
+		if (fwrite(header, sizeof(header), 1, m_file) == 1)
+			return true;
+
+		fprintf(stderr, "[pcap_writer::%s] failed to write \"%s\"", __func__, file_name.c_str());
+		close();
+		return false;
+	}
+
+	void pcap_writer::close() {
+		if (m_file == nullptr)
+			return;
+
+		fclose(m_file);
+		m_file = nullptr;
+	}
+
+	void pcap_writer::write(const asio::ip::udp::endpoint& src, const asio::ip::udp::endpoint& dst, const uint8_t* data, uint32_t size) {
+		if (m_file == nullptr)
+			return;
+
+		// mixed families happen on dual-stack sockets, both are written as IPv6 then
+		const bool ip_v6 = (src.address().is_v6() || dst.address().is_v6());
+
+		const uint32_t ip_hdr_size = ip_v6? 40: 20;
+		const uint32_t udp_size = 8 + size;
+
+		m_buffer.clear();
+		m_buffer.resize(ip_hdr_size + udp_size, 0);
+
+		uint8_t* ip = &m_buffer[0];
+		uint8_t* udp = ip + ip_hdr_size;
+
+		uint32_t udp_sum = IP_PROTO_UDP + udp_size;
+
+		if (ip_v6) {
+			const auto get_bytes = [](const asio::ip::address& a) {
+				return (a.is_v6()? a.to_v6(): asio::ip::address_v6::v4_mapped(a.to_v4())).to_bytes();
+			};
+
+			const asio::ip::address_v6::bytes_type src_bytes = get_bytes(src.address());
+			const asio::ip::address_v6::bytes_type dst_bytes = get_bytes(dst.address());
+
+			ip[0] = 0x60;
+			ip[6] = IP_PROTO_UDP;
+			ip[7] = 64;
+
+			write_be16(ip + 4, udp_size);
+
+			std::memcpy(ip +  8, src_bytes.data(), src_bytes.size());
+			std::memcpy(ip + 24, dst_bytes.data(), dst_bytes.size());
+
+			udp_sum += sum_be16(ip + 8, 32);
+		} else {
+			const asio::ip::address_v4::bytes_type src_bytes = src.address().to_v4().to_bytes();
+			const asio::ip::address_v4::bytes_type dst_bytes = dst.address().to_v4().to_bytes();
+
+			ip[0] = 0x45;
+			// don't fragment
+			ip[6] = 0x40;
+			ip[8] = 64;
+			ip[9] = IP_PROTO_UDP;
+
+			write_be16(ip + 2, ip_hdr_size + udp_size);
+
+			std::memcpy(ip + 12, src_bytes.data(), src_bytes.size());
+			std::memcpy(ip + 16, dst_bytes.data(), dst_bytes.size());
+
+			write_be16(ip + 10, fold_checksum(sum_be16(ip, ip_hdr_size)));
+
+			udp_sum += sum_be16(ip + 12, 8);
+		}
+
+		write_be16(udp + 0, src.port());
+		write_be16(udp + 2, dst.port());
+		write_be16(udp + 4, udp_size);
+
+		std::memcpy(udp + 8, data, size);
+
+		// zero means "no checksum", an actual zero is sent as all ones
+		const uint16_t udp_checksum = fold_checksum(udp_sum + sum_be16(udp, udp_size));
+		write_be16(udp + 6, (udp_checksum == 0)? 0xFFFF: udp_checksum);
+
+		const std::chrono::microseconds time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch());
+		const uint32_t header[4] = {
+			uint32_t(time.count() / 1000000),
+			uint32_t(time.count() % 1000000),
+			uint32_t(m_buffer.size()),
+			uint32_t(m_buffer.size()),
+		};
+
+		if (fwrite(header, sizeof(header), 1, m_file) == 1 && fwrite(&m_buffer[0], m_buffer.size(), 1, m_file) == 1)
+			return;
+
+		fprintf(stderr, "[pcap_writer::%s] write failed, capture stopped", __func__);
+		close();
+	}
+
+
+
+	bool pcap_reader::open(const std::string& file_name) {
+		close();
+
+		if ((m_file = fopen(file_name.c_str(), "rb")) == nullptr) {
+			fprintf(stderr, "[pcap_reader::%s] failed to open \"%s\"", __func__, file_name.c_str());
+			return false;
+		}
+
+		uint8_t header[FILE_HDR_SIZE];
+
+		if (fread(header, sizeof(header), 1, m_file) == 1) {
+			const uint32_t magic = read_u32(header, false);
+
+			m_swapped = (magic == __builtin_bswap32(PCAP_MAGIC_USECS) || magic == __builtin_bswap32(PCAP_MAGIC_NSECS));
+			m_nanosecs = (magic == PCAP_MAGIC_NSECS || magic == __builtin_bswap32(PCAP_MAGIC_NSECS));
+			m_link_type = read_u32(header + 20, m_swapped) & 0xFFFF;
+
+			if (!m_swapped && magic != PCAP_MAGIC_USECS && magic != PCAP_MAGIC_NSECS) {
+				fprintf(stderr, "[pcap_reader::%s] \"%s\" is not a pcap file", __func__, file_name.c_str());
+			} else if (m_link_type != LINKTYPE_ETHERNET && m_link_type != LINKTYPE_RAW && m_link_type != LINKTYPE_IPV4 && m_link_type != LINKTYPE_IPV6) {
+				fprintf(stderr, "[pcap_reader::%s] unsupported link type %u in \"%s\"", __func__, m_link_type, file_name.c_str());
+			} else {
+				return true;
+			}
+		}
+
+		close();
+		return false;
+	}
+
+	void pcap_reader::close() {
+		if (m_file == nullptr)
+			return;
+
+		fclose(m_file);
+		m_file = nullptr;
+	}
+
+	bool pcap_reader::read(pcap_datagram& datagram) {
+		uint8_t header[RECORD_HDR_SIZE];
+
+		while (m_file != nullptr && fread(header, sizeof(header), 1, m_file) == 1) {
+			const uint32_t secs = read_u32(header + 0, m_swapped);
+			const uint32_t frac = read_u32(header + 4, m_swapped);
+			const uint32_t size = read_u32(header + 8, m_swapped);
+
+			if (size > MAX_RECORD_SIZE)
+				break;
+
+			m_buffer.resize(size);
+
+			if (size > 0 && fread(&m_buffer[0], size, 1, m_file) != 1)
+				break;
+
+			datagram.time = secs * 1000000ll + (m_nanosecs? (frac / 1000): frac);
+
+			const uint8_t* data = m_buffer.data();
+
+			switch (m_link_type) {
+				case LINKTYPE_ETHERNET: {
+					uint32_t offset = 12;
+
+					// skip VLAN tags
+					while ((offset + 2) <= size && read_be16(data + offset) == 0x8100)
+						offset += 4;
+
+					if ((offset + 2) > size)
+						continue;
+
+					const uint16_t ether_type = read_be16(data + offset);
+
+					if (ether_type != 0x0800 && ether_type != 0x86DD)
+						continue;
+
+					if (parse_ip(data + offset + 2, size - offset - 2, datagram))
+						return true;
+				} break;
+
+				default: {
+					if (parse_ip(data, size, datagram))
+						return true;
+				} break;
+			}
+		}
+
+		return false;
+	}
+
+	bool pcap_reader::parse_ip(const uint8_t* data, uint32_t size, pcap_datagram& datagram) const {
+		if (size < 1)
+			return false;
+
+		uint32_t ip_hdr_size = 0;
+		uint32_t ip_size = 0;
+
+		switch (data[0] >> 4) {
+			case 4: {
+				ip_hdr_size = (data[0] & 15) * 4;
+
+				if (size < 20 || ip_hdr_size < 20 || data[9] != IP_PROTO_UDP)
+					return false;
+
+				// fragments other than a complete datagram are ignored
+				if ((read_be16(data + 6) & 0x3FFF) != 0)
+					return false;
+
+				asio::ip::address_v4::bytes_type src_bytes;
+				asio::ip::address_v4::bytes_type dst_bytes;
+
+				std::memcpy(src_bytes.data(), data + 12, src_bytes.size());
+				std::memcpy(dst_bytes.data(), data + 16, dst_bytes.size());
+
+				datagram.src.address(asio::ip::address_v4(src_bytes));
+				datagram.dst.address(asio::ip::address_v4(dst_bytes));
+
+				ip_size = read_be16(data + 2);
+			} break;
+
+			case 6: {
+				ip_hdr_size = 40;
+
+				// extension headers are not supported
+				if (size < 40 || data[6] != IP_PROTO_UDP)
+					return false;
+
+				asio::ip::address_v6::bytes_type src_bytes;
+				asio::ip::address_v6::bytes_type dst_bytes;
+
+				std::memcpy(src_bytes.data(), data +  8, src_bytes.size());
+				std::memcpy(dst_bytes.data(), data + 24, dst_bytes.size());
+
+				datagram.src.address(asio::ip::address_v6(src_bytes));
+				datagram.dst.address(asio::ip::address_v6(dst_bytes));
+
+				ip_size = ip_hdr_size + read_be16(data + 4);
+			} break;
+
+			default: {
+				return false;
+			} break;
+		}
+
+		if (ip_size > size || (ip_hdr_size + 8) > ip_size)
+			return false;
+
+		const uint8_t* udp = data + ip_hdr_size;
+		const uint32_t udp_size = read_be16(udp + 4);
+
+		if (udp_size < 8 || (ip_hdr_size + udp_size) > ip_size)
+			return false;
+
+		datagram.src.port(read_be16(udp + 0));
+		datagram.dst.port(read_be16(udp + 2));
+		datagram.data.assign(udp + 8, udp + udp_size);
+		return true;
+	}
+}
+
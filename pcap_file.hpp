@@ -0,0 +1,81 @@
+#ifndef ARELION_PCAP_FILE_HDR
+#define ARELION_PCAP_FILE_HDR
+
+#include <asio/ip/udp.hpp>
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace arelion {
+	// one UDP datagram read back from a capture
+	struct pcap_datagram {
+	public:
+		// wall-clock time in microseconds since the epoch
+		int64_t time = 0;
+
+		asio::ip::udp::endpoint src;
+		asio::ip::udp::endpoint dst;
+
+		std::vector<uint8_t> data;
+	};
+
+
+	// writes datagrams to a standard pcap file (raw IP link type) with synthesized
+	// IPv4/IPv6 and UDP headers, so captures also open in the usual tools
+	class pcap_writer {
+	public:
+		pcap_writer() = default;
+		pcap_writer(const pcap_writer&) = delete;
+		~pcap_writer() { close(); }
+
+		pcap_writer& operator = (const pcap_writer&) = delete;
+
+		bool open(const std::string& file_name);
+		void close();
+
+		void write(const asio::ip::udp::endpoint& src, const asio::ip::udp::endpoint& dst, const uint8_t* data, uint32_t size);
+
+		bool is_open() const { return (m_file != nullptr); }
+
+	private:
+		FILE* m_file = nullptr;
+
+		std::vector<uint8_t> m_buffer;
+	};
+
+
+	// reads the UDP datagrams from a pcap file with raw IP or ethernet link type,
+	// skipping everything else (other protocols, fragments, truncated records)
+	class pcap_reader {
+	public:
+		pcap_reader() = default;
+		pcap_reader(const pcap_reader&) = delete;
+		~pcap_reader() { close(); }
+
+		pcap_reader& operator = (const pcap_reader&) = delete;
+
+		bool open(const std::string& file_name);
+		void close();
+
+		// false at the end of the file or if it is corrupted
+		bool read(pcap_datagram& datagram);
+
+	private:
+		bool parse_ip(const uint8_t* data, uint32_t size, pcap_datagram& datagram) const;
+
+	private:
+		FILE* m_file = nullptr;
+
+		std::vector<uint8_t> m_buffer;
+
+		uint32_t m_link_type = 0;
+
+		bool m_swapped = false;
+		bool m_nanosecs = false;
+	};
+}
+
+#endif
+
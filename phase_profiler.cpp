@@ -0,0 +1,29 @@
+#include <thread>
+
+#include "phase_profiler.hpp"
+
+namespace arelion {
+	namespace phase_profiler {
+		static double calibrate_ticks_per_sec() {
+			#if defined(__x86_64__) || defined(__i386__)
+			const std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+			const uint64_t start_ticks = get_ticks();
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+			const std::chrono::duration<double> secs = std::chrono::steady_clock::now() - start_time;
+			const uint64_t ticks = get_ticks() - start_ticks;
+
+			return (ticks / secs.count());
+			#else
+			return 1e9;
+			#endif
+		}
+
+		double get_ticks_per_sec() {
+			static const double ticks_per_sec = calibrate_ticks_per_sec();
+			return ticks_per_sec;
+		}
+	}
+}
+
@@ -0,0 +1,88 @@
+#ifndef ARELION_PHASE_PROFILER_HDR
+#define ARELION_PHASE_PROFILER_HDR
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "connection_metrics.hpp"
+
+namespace arelion {
+	namespace phase_profiler {
+		// time stamp counter where available, nanoseconds otherwise
+		inline uint64_t get_ticks() {
+			#if defined(__x86_64__) || defined(__i386__)
+			return __rdtsc();
+			#else
+			return (std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+			#endif
+		}
+
+		// ticks spent by finished phases nested in the running one, on this thread
+		inline uint64_t& nested_ticks() {
+			static thread_local uint64_t ticks = 0;
+			return ticks;
+		}
+
+		// measured once on first use, which blocks for a few milliseconds
+		double get_ticks_per_sec();
+
+		inline double ticks_to_secs(uint64_t ticks) { return (ticks / get_ticks_per_sec()); }
+	}
+
+
+	// charges the ticks between construction and stop() (or destruction) to one
+	// phase, minus whatever nested timers charged to theirs in the meantime
+	struct phase_timer {
+	public:
+		phase_timer(phase_metrics& metrics, uint32_t phase)
+			: m_metrics(&metrics)
+			, m_phase(phase)
+			, m_start_ticks(phase_profiler::get_ticks())
+			, m_outer_nested_ticks(phase_profiler::nested_ticks())
+		{
+			phase_profiler::nested_ticks() = 0;
+		}
+		~phase_timer() { stop(); }
+
+		phase_timer(const phase_timer&) = delete;
+		phase_timer& operator = (const phase_timer&) = delete;
+
+		void stop() {
+			if (m_metrics == nullptr)
+				return;
+
+			const uint64_t ticks = phase_profiler::get_ticks() - m_start_ticks;
+
+			m_metrics->calls[m_phase].add(1);
+			m_metrics->ticks[m_phase].add(ticks - std::min(ticks, phase_profiler::nested_ticks()));
+			m_metrics = nullptr;
+
+			phase_profiler::nested_ticks() = m_outer_nested_ticks + ticks;
+		}
+
+	private:
+		phase_metrics* m_metrics;
+
+		uint32_t m_phase;
+
+		uint64_t m_start_ticks;
+		uint64_t m_outer_nested_ticks;
+	};
+}
+
+// compiled out unless building with the profiler
+#ifdef PHASE_PROFILER
+#define PHASE_TIMER(name, metrics, phase) arelion::phase_timer name(metrics, phase)
+#define PHASE_TIMER_STOP(name) name.stop()
+#else
+#define PHASE_TIMER(name, metrics, phase)
+#define PHASE_TIMER_STOP(name)
+#endif
+
+#endif
+
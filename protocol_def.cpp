@@ -12,8 +12,33 @@ namespace arelion {
 		std::memset(msg, 0, sizeof(msg_type) * 256);
 	}
 
-	void protocol_def::add_type(const uint8_t id, const int32_t msg_length) {
+	void protocol_def::add_type(const uint8_t id, const int32_t msg_length, const char* name) {
 		msg[id].length = msg_length;
+		msg[id].delta = false;
+
+		if (name != nullptr)
+			set_type_name(id, name);
+	}
+
+	void protocol_def::add_delta_type(const uint8_t id, const int32_t msg_length, const char* name) {
+		if (msg_length <= 0)
+			throw std::runtime_error("[protocol_def] delta-coded types must have a fixed length");
+
+		msg[id].length = msg_length;
+		msg[id].delta = true;
+
+		if (name != nullptr)
+			set_type_name(id, name);
+	}
+
+	void protocol_def::set_type_name(const uint8_t id, const char* name) {
+		std::memset(msg[id].name, 0, sizeof(msg[id].name));
+
+		if (name == nullptr)
+			return;
+
+		// silently truncated, names are only for humans
+		std::strncpy(msg[id].name, name, sizeof(msg[id].name) - 1);
 	}
 
 	int32_t protocol_def::packet_length(const uint8_t* const buf, const uint32_t buf_length) const {
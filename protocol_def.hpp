@@ -7,7 +7,12 @@ namespace arelion {
 	class protocol_def {
 	public:
 		void clear();
-		void add_type(const uint8_t id, const int32_t msg_length);
+		// <name> is optional and only used for reporting (see message_traffic_stats)
+		void add_type(const uint8_t id, const int32_t msg_length, const char* name = nullptr);
+		// as add_type, but packets with this id are sent as deltas against the
+		// previous packet of the same id (fixed-length types only)
+		void add_delta_type(const uint8_t id, const int32_t msg_length, const char* name = nullptr);
+		void set_type_name(const uint8_t id, const char* name);
 
 		// <  -1: invalid id
 		// == -1: invalid length
@@ -17,10 +22,17 @@ namespace arelion {
 
 		bool is_valid_length(const int32_t pkt_length, const uint32_t buf_length) const;
 		bool is_valid_packet(const uint8_t* const buf, const uint32_t buf_length) const;
+		bool is_delta_type(const uint8_t id) const { return msg[id].delta; }
+
+		// empty if the type was never named
+		const char* get_type_name(const uint8_t id) const { return msg[id].name; }
 
 	private:
 		struct msg_type {
 			int32_t length = 0;
+			bool delta = false;
+
+			char name[32] = {0};
 		};
 
 		msg_type msg[256];
@@ -7,6 +7,8 @@
 
 #include <utility>
 
+#include "mem_pool.hpp"
+
 namespace arelion {
 	class raw_packet {
 	public:
@@ -15,14 +17,14 @@ namespace arelion {
 
 		raw_packet(const uint8_t* const raw_data, const uint32_t raw_length): length(raw_length) {
 			assert(length > 0);
-			data = new uint8_t[length];
+			data = static_cast<uint8_t*>(mem_pool::allocate(length));
 			std::memcpy(data, raw_data, length);
 		}
 		raw_packet(const uint32_t raw_length): length(raw_length) {
 			if (length == 0)
 				return;
 
-			data = new uint8_t[length];
+			data = static_cast<uint8_t*>(mem_pool::allocate(length));
 		}
 
 		raw_packet(raw_packet&& p) { *this = std::move(p); }
@@ -44,12 +46,13 @@ namespace arelion {
 			if (length == 0)
 				return;
 
-			delete[] data;
+			mem_pool::deallocate(data, length);
 			data = nullptr;
 
 			length = 0;
 		}
 
+		// allocated from mem_pool, only ever released through delete_data
 		uint8_t* data = nullptr;
 		uint32_t length = 0;
 	};
@@ -1,4 +1,5 @@
 #include "socket_helper.hpp"
+#include "address_resolver.hpp"
 
 namespace arelion {
 	asio::io_service netservice;
@@ -15,36 +16,12 @@ namespace arelion {
 
 
 	asio::ip::udp::endpoint resolve_addr(const std::string& host, int32_t port, asio::error_code* error_code) {
-		char buf[16];
-		std::memset(buf, 0, sizeof(buf));
-		std::snprintf(buf, sizeof(buf), "%d", port);
-		return (resolve_addr(host, buf, error_code));
+		assert(error_code != nullptr);
+		return (netresolver.resolve_now(host, port, error_code));
 	}
 
 	asio::ip::udp::endpoint resolve_addr(const std::string& host, const std::string& port, asio::error_code* error_code) {
-		assert(error_code != nullptr);
-
-		asio::ip::address tempAddr = wrap_ip(host, error_code);
-		asio::error_code& ec = *error_code;
-
-		if (!ec)
-			return asio::ip::udp::endpoint(tempAddr, std::atoi(port.c_str()));
-
-		// wrap_resolve() might clear the error
-		asio::error_code ecc = ec;
-		asio::io_service io_service;
-		asio::ip::udp::resolver resolver(io_service);
-		asio::ip::udp::resolver::query query(host, port);
-		asio::ip::udp::resolver::iterator iter = wrap_resolve(resolver, query, error_code);
-		asio::ip::udp::resolver::iterator end;
-
-		if (!ec && iter != end)
-			return *iter;
-
-		if (!ec)
-			ec = ecc;
-
-		return asio::ip::udp::endpoint(tempAddr, 0);
+		return (resolve_addr(host, std::atoi(port.c_str()), error_code));
 	}
 
 
@@ -10,6 +10,8 @@ namespace arelion {
 
 	bool check_error_code(asio::error_code& error_code);
 
+	// blocks unless <host> is a literal address or cached by netresolver, see
+	// address_resolver::resolve for the asynchronous version
 	asio::ip::udp::endpoint resolve_addr(const std::string& host, int32_t port, asio::error_code* error_code);
 	asio::ip::udp::endpoint resolve_addr(const std::string& host, const std::string& port, asio::error_code* error_code);
 
@@ -0,0 +1,94 @@
+#ifndef ARELION_SOURCE_LIMITER_HDR
+#define ARELION_SOURCE_LIMITER_HDR
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "endpoint_table.hpp"
+
+namespace arelion {
+	// per-source token buckets (datagrams) in a count-min sketch: a source
+	// address maps to one cell in each row, may send while the fullest of its
+	// cells holds a token, and is charged in all of them; every cell has been
+	// charged at least as often as the source, so memory is fixed no matter
+	// how many addresses send, and collisions can only make a source look
+	// busier than it is if they hit it in every row, never let one exceed its
+	// rate
+	struct source_limiter {
+	public:
+		typedef std::chrono::high_resolution_clock::time_point time_point;
+
+		enum {
+			NUM_ROWS = 2,
+			NUM_CELLS = 4096,
+		};
+
+		// <rate> <= 0 disables limiting
+		void set_rate(int32_t rate, int32_t burst) {
+			m_rate = rate;
+			m_burst = std::max(burst, 1);
+
+			m_cells.clear();
+			m_cells.resize(NUM_ROWS * NUM_CELLS, {float(m_burst), 0});
+		}
+
+		// true if a datagram from <address> may pass at <t>, charging it if so
+		bool consume(const asio::ip::udp::endpoint& address, time_point t) {
+			if (m_rate <= 0)
+				return true;
+
+			// every port of an address shares its buckets
+			endpoint_key key = endpoint_key::pack(address);
+			key.port = 0;
+
+			const uint64_t hash = key.hash64();
+			const uint32_t time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(t.time_since_epoch()).count();
+
+			cell* cells[NUM_ROWS] = {
+				&m_cells[0 * NUM_CELLS + ((hash >>  0) & (NUM_CELLS - 1))],
+				&m_cells[1 * NUM_CELLS + ((hash >> 32) & (NUM_CELLS - 1))],
+			};
+
+			float tokens = -float(m_burst);
+
+			for (cell* c: cells) {
+				// unsigned difference, survives the millisecond count wrapping
+				c->tokens = std::min(c->tokens + (time_ms - c->refill_time) * 0.001f * m_rate, float(m_burst));
+				c->refill_time = time_ms;
+
+				// the least charged cell is the closest estimate
+				tokens = std::max(tokens, c->tokens);
+			}
+
+			if (tokens < 1.0f)
+				return false;
+
+			// shared cells may go into debt for their other sources, bounded so
+			// one burst of refill always brings them back
+			for (cell* c: cells) {
+				c->tokens = std::max(c->tokens - 1.0f, -float(m_burst));
+			}
+
+			return true;
+		}
+
+		int32_t get_rate() const { return m_rate; }
+		int32_t get_burst() const { return m_burst; }
+
+	private:
+		struct cell {
+			float tokens;
+			uint32_t refill_time;
+		};
+
+		std::vector<cell> m_cells;
+
+		int32_t m_rate = 0;
+		int32_t m_burst = 1;
+	};
+}
+
+#endif
+
@@ -0,0 +1,316 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "stream_codec.hpp"
+
+namespace arelion {
+	static constexpr uint32_t HASH_TABLE_BITS = 12;
+	static constexpr uint32_t MAX_SKIP_BACKOFF = 32;
+
+	static uint32_t read_u32(const uint8_t* p) { uint32_t v; std::memcpy(&v, p, sizeof(v)); return v; }
+	static uint16_t read_u16(const uint8_t* p) { uint16_t v; std::memcpy(&v, p, sizeof(v)); return v; }
+
+	static void write_u16(uint8_t* p, uint16_t v) { std::memcpy(p, &v, sizeof(v)); }
+
+	static uint32_t hash_u32(uint32_t v) { return ((v * 2654435761u) >> (32 - HASH_TABLE_BITS)); }
+
+
+	uint32_t stream_codec::slide_history(uint32_t size) {
+		// any steady stream fills the window eventually, so reserve it all at once
+		if (m_history.capacity() < history_size())
+			m_history.reserve(history_size());
+
+		if ((m_history.size() + size) <= history_size())
+			return 0;
+
+		const uint32_t shift = m_history.size() - std::min(uint32_t(m_history.size()), window_size());
+
+		m_history.erase(m_history.begin(), m_history.begin() + shift);
+		return shift;
+	}
+
+
+
+	uint32_t stream_encoder::encode_block(const uint8_t* data, uint32_t size, bool compress, std::vector<uint8_t>& out) {
+		const uint32_t beg = push_history(data, size);
+		const uint32_t end = beg + size;
+		const uint32_t pos = out.size();
+
+		if ((compress &= (m_skip_blocks == 0))) {
+			out.resize(pos + block_hdr_size(BLOCK_MODE_LZ) + size);
+
+			// only worth it if the LZ block, with its larger header, is strictly smaller than the raw one
+			const uint32_t raw_block_size = block_hdr_size(BLOCK_MODE_RAW) + size;
+			const uint32_t max_enc_size = (raw_block_size > block_hdr_size(BLOCK_MODE_LZ))? (raw_block_size - block_hdr_size(BLOCK_MODE_LZ) - 1): 0;
+			const uint32_t enc_size = (max_enc_size > 0)? compress_block(beg, end, &out[pos + block_hdr_size(BLOCK_MODE_LZ)], max_enc_size): 0;
+
+			if (enc_size > 0 && (block_hdr_size(BLOCK_MODE_LZ) + enc_size) < raw_block_size) {
+				out[pos] = BLOCK_MODE_LZ;
+
+				write_u16(&out[pos + 1], size);
+				write_u16(&out[pos + 3], enc_size);
+
+				out.resize(pos + block_hdr_size(BLOCK_MODE_LZ) + enc_size);
+
+				m_skip_backoff = 0;
+				return (out.size() - pos);
+			}
+
+			// incompressible, stop trying for a while
+			m_skip_backoff = std::min(std::max(m_skip_backoff * 2, 1u), MAX_SKIP_BACKOFF);
+			m_skip_blocks = m_skip_backoff;
+		} else {
+			m_skip_blocks -= (m_skip_blocks > 0);
+		}
+
+		out.resize(pos);
+		return (frame_raw_block(data, size, out));
+	}
+
+	uint32_t stream_encoder::frame_raw_block(const uint8_t* data, uint32_t size, std::vector<uint8_t>& out) {
+		assert(size > 0 && size <= max_block_size());
+
+		const uint32_t pos = out.size();
+
+		out.resize(pos + block_hdr_size(BLOCK_MODE_RAW) + size);
+		out[pos] = BLOCK_MODE_RAW;
+
+		write_u16(&out[pos + 1], size);
+		std::memcpy(&out[pos + block_hdr_size(BLOCK_MODE_RAW)], data, size);
+		return (out.size() - pos);
+	}
+
+	uint32_t stream_encoder::push_history(const uint8_t* data, uint32_t size) {
+		assert(size > 0 && size <= max_block_size());
+
+		if (m_hash_table.empty())
+			m_hash_table.resize(1 << HASH_TABLE_BITS, -1);
+
+		const int32_t shift = slide_history(size);
+
+		// rebase hashed positions, forgetting those that slid out of the window
+		for (int32_t i = 0; shift > 0 && i < int32_t(m_hash_table.size()); ++i) {
+			m_hash_table[i] = std::max(m_hash_table[i] - shift, -1);
+		}
+
+		const uint32_t beg = m_history.size();
+
+		m_history.insert(m_history.end(), data, data + size);
+		return beg;
+	}
+
+	uint32_t stream_encoder::compress_block(uint32_t beg, uint32_t end, uint8_t* out, uint32_t max_out_size) {
+		const uint8_t* hist = &m_history[0];
+
+		uint8_t* out_pos = out;
+		uint8_t* out_end = out + max_out_size;
+
+		// emits <lit_size> literals starting at <lit_beg>, followed by a match unless <match_size> is 0
+		const auto emit_sequence = [&](uint32_t lit_beg, uint32_t lit_size, uint32_t match_dist, uint32_t match_size) {
+			const uint32_t ext_match_size = (match_size > 0)? (match_size - min_match_size()): 0;
+			const uint32_t max_seq_size = 1 + (lit_size / 255 + 1) + lit_size + 2 + (ext_match_size / 255 + 1);
+
+			if (out_pos + max_seq_size > out_end)
+				return false;
+
+			*(out_pos++) = (std::min(lit_size, 15u) << 4) | std::min(ext_match_size, 15u);
+
+			if (lit_size >= 15) {
+				for (uint32_t n = lit_size - 15; ; n -= 255) {
+					*(out_pos++) = std::min(n, 255u);
+
+					if (n < 255)
+						break;
+				}
+			}
+
+			std::memcpy(out_pos, hist + lit_beg, lit_size);
+			out_pos += lit_size;
+
+			if (match_size == 0)
+				return true;
+
+			write_u16(out_pos, match_dist);
+			out_pos += 2;
+
+			if (ext_match_size >= 15) {
+				for (uint32_t n = ext_match_size - 15; ; n -= 255) {
+					*(out_pos++) = std::min(n, 255u);
+
+					if (n < 255)
+						break;
+				}
+			}
+
+			return true;
+		};
+
+		uint32_t anchor = beg;
+
+		for (uint32_t cur = beg; (cur + min_match_size()) <= end; ) {
+			const uint32_t seq = read_u32(hist + cur);
+			const uint32_t idx = hash_u32(seq);
+			const int32_t cand = m_hash_table[idx];
+
+			m_hash_table[idx] = cur;
+
+			if (cand < 0 || (cur - cand) > 0xFFFF || read_u32(hist + cand) != seq) {
+				cur += 1;
+				continue;
+			}
+
+			uint32_t match_size = min_match_size();
+
+			while ((cur + match_size) < end && hist[cand + match_size] == hist[cur + match_size]) {
+				match_size += 1;
+			}
+
+			if (!emit_sequence(anchor, cur - anchor, cur - cand, match_size))
+				return 0;
+
+			// keep the table warm for the next repetition of this match
+			if ((cur + match_size + min_match_size()) <= end)
+				m_hash_table[hash_u32(read_u32(hist + cur + match_size - 2))] = cur + match_size - 2;
+
+			anchor = (cur += match_size);
+		}
+
+		if (!emit_sequence(anchor, end - anchor, 0, 0))
+			return 0;
+
+		return (out_pos - out);
+	}
+
+
+
+	void stream_decoder::feed(const uint8_t* data, uint32_t size) {
+		m_input.insert(m_input.end(), data, data + size);
+	}
+
+	bool stream_decoder::decode(std::vector<uint8_t>& out) {
+		uint32_t pos = 0;
+
+		while ((m_input.size() - pos) >= block_hdr_size(BLOCK_MODE_RAW)) {
+			const uint8_t* hdr = &m_input[pos];
+
+			const uint8_t mode = hdr[0];
+			const uint32_t hdr_size = block_hdr_size(mode);
+
+			if ((m_input.size() - pos) < hdr_size)
+				break;
+
+			const uint32_t raw_size = read_u16(hdr + 1);
+			const uint32_t enc_size = (mode == BLOCK_MODE_LZ)? read_u16(hdr + 3): raw_size;
+
+			if ((m_input.size() - pos) < (hdr_size + enc_size))
+				break;
+
+			slide_history(raw_size);
+
+			const uint32_t beg = m_history.size();
+			const size_t out_size = out.size();
+
+			switch (mode) {
+				case BLOCK_MODE_RAW: {
+					m_history.insert(m_history.end(), hdr + hdr_size, hdr + hdr_size + raw_size);
+				} break;
+				case BLOCK_MODE_LZ: {
+					if (decompress_block(hdr + hdr_size, enc_size, raw_size))
+						break;
+
+					// keep the history in step with the encoder, contents are lost anyway
+					m_history.resize(beg + raw_size, 0);
+					out.resize(out_size);
+
+					// hand back what came before it, the caller has to resync
+					m_input.erase(m_input.begin(), m_input.begin() + pos + hdr_size + enc_size);
+					return false;
+				} break;
+				default: {
+					// framing is lost, nothing after this point can be trusted
+					m_input.clear();
+					return false;
+				} break;
+			}
+
+			out.insert(out.end(), m_history.begin() + beg, m_history.end());
+			pos += (hdr_size + enc_size);
+		}
+
+		m_input.erase(m_input.begin(), m_input.begin() + pos);
+		return true;
+	}
+
+	bool stream_decoder::decompress_block(const uint8_t* src, uint32_t src_size, uint32_t raw_size) {
+		const uint8_t* src_end = src + src_size;
+
+		const uint32_t beg = m_history.size();
+		const uint32_t end = beg + raw_size;
+
+		m_history.resize(end);
+
+		uint8_t* hist = &m_history[0];
+		uint32_t cur = beg;
+
+		const auto read_ext_size = [&](uint32_t& size) {
+			if (size < 15)
+				return true;
+
+			for (uint8_t n = 255; n == 255; size += n) {
+				if (src >= src_end)
+					return false;
+
+				n = *(src++);
+			}
+
+			return true;
+		};
+
+		while (src < src_end) {
+			const uint8_t token = *(src++);
+
+			uint32_t lit_size = token >> 4;
+			uint32_t match_size = token & 15;
+
+			if (!read_ext_size(lit_size))
+				return false;
+			if (lit_size > uint32_t(src_end - src) || lit_size > (end - cur))
+				return false;
+
+			std::memcpy(hist + cur, src, lit_size);
+
+			src += lit_size;
+			cur += lit_size;
+
+			// last sequence carries only literals
+			if (cur == end)
+				return (src == src_end);
+
+			if ((src_end - src) < 2)
+				return false;
+
+			const uint32_t match_dist = read_u16(src);
+
+			src += 2;
+
+			if (!read_ext_size(match_size))
+				return false;
+
+			match_size += min_match_size();
+
+			if (match_dist == 0 || match_dist > cur || match_size > (end - cur))
+				return false;
+
+			// byte-wise, matches may overlap the bytes they produce
+			for (uint32_t i = 0; i < match_size; ++i) {
+				hist[cur + i] = hist[cur + i - match_dist];
+			}
+
+			cur += match_size;
+		}
+
+		return (cur == end);
+	}
+}
+
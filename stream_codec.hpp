@@ -0,0 +1,87 @@
+#ifndef ARELION_STREAM_CODEC_HDR
+#define ARELION_STREAM_CODEC_HDR
+
+#include <cstdint>
+#include <vector>
+
+namespace arelion {
+	// block-framed LZ77 codec for the reliable in-order byte stream of a connection
+	//
+	// every block is pushed through a sliding history window on both ends whether it
+	// was compressed or not, so matches can reference data from earlier messages and
+	// the encoder may fall back to raw blocks at any time without losing sync
+	//
+	// block layout: <uint8 mode><uint16 raw_size>[<uint16 enc_size>]<payload>
+	struct stream_codec {
+	public:
+		enum {
+			BLOCK_MODE_RAW = 0,
+			BLOCK_MODE_LZ  = 1,
+		};
+
+		static constexpr uint32_t window_size() { return (1 << 15); }
+		static constexpr uint32_t history_size() { return (window_size() + max_block_size()); }
+
+		static constexpr uint32_t max_block_size() { return 0xFFFF; }
+		static constexpr uint32_t min_match_size() { return 4; }
+
+		static constexpr uint32_t block_hdr_size(uint8_t mode) { return (sizeof(uint8_t) + sizeof(uint16_t) * (1 + (mode == BLOCK_MODE_LZ))); }
+
+	protected:
+		// keeps the last window_size() bytes if <size> more would not fit, returns the shift
+		uint32_t slide_history(uint32_t size);
+
+	protected:
+		std::vector<uint8_t> m_history;
+	};
+
+
+	class stream_encoder: public stream_codec {
+	public:
+		// appends a framed block containing <data> to <out>; the block is
+		// compressed if <compress> is true and the LZ block, header included,
+		// is smaller than the raw one
+		// returns the number of bytes appended
+		uint32_t encode_block(const uint8_t* data, uint32_t size, bool compress, std::vector<uint8_t>& out);
+
+		// appends a raw block of <data> to <out> without touching any history, for
+		// blocks shared between connections; every encoder that sends it must also
+		// be given the data through add_raw_block to stay in sync with its decoder
+		static uint32_t frame_raw_block(const uint8_t* data, uint32_t size, std::vector<uint8_t>& out);
+		void add_raw_block(const uint8_t* data, uint32_t size) { push_history(data, size); }
+
+	private:
+		// appends <data> to the history, returns the position it starts at
+		uint32_t push_history(const uint8_t* data, uint32_t size);
+		uint32_t compress_block(uint32_t beg, uint32_t end, uint8_t* out, uint32_t max_out_size);
+
+	private:
+		// history positions of the last 4-byte sequences seen, per hash bucket
+		std::vector<int32_t> m_hash_table;
+
+		// raw blocks to send before trying compression again
+		uint32_t m_skip_blocks = 0;
+		uint32_t m_skip_backoff = 0;
+	};
+
+
+	class stream_decoder: public stream_codec {
+	public:
+		void feed(const uint8_t* data, uint32_t size);
+
+		// decodes all complete blocks received so far and appends their raw
+		// bytes to <out>; stops at a corrupted block and returns false, having
+		// appended the blocks before it but nothing of the corrupted one
+		bool decode(std::vector<uint8_t>& out);
+
+	private:
+		bool decompress_block(const uint8_t* src, uint32_t src_size, uint32_t raw_size);
+
+	private:
+		// framed bytes not yet decoded
+		std::vector<uint8_t> m_input;
+	};
+}
+
+#endif
+
@@ -0,0 +1,267 @@
+#ifndef ARELION_TIMER_WHEEL_HDR
+#define ARELION_TIMER_WHEEL_HDR
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+namespace arelion {
+	// intrusive timer, embedded in its <owner>; unlinks itself when destroyed,
+	// so owners can go away without telling their wheel; lists are either
+	// null-terminated (wheel slots) or circular around a sentinel (ready list)
+	template<typename T> struct timer_node {
+	public:
+		explicit timer_node(T* owner_): owner(owner_) {}
+		~timer_node() { unlink(); }
+
+		timer_node(const timer_node&) = delete;
+		timer_node& operator = (const timer_node&) = delete;
+
+		bool is_linked() const { return (pprev != nullptr); }
+
+		void unlink() {
+			if (pprev == nullptr)
+				return;
+
+			if ((*pprev = next) != nullptr)
+				next->pprev = pprev;
+
+			next = nullptr;
+			pprev = nullptr;
+		}
+
+		void link(timer_node*& head) {
+			if ((next = head) != nullptr)
+				next->pprev = &next;
+
+			head = this;
+			pprev = &head;
+		}
+
+		// appends to the circular list around <sentinel>
+		void link_back(timer_node& sentinel) {
+			next = &sentinel;
+			pprev = sentinel.pprev;
+
+			*sentinel.pprev = this;
+			sentinel.pprev = &next;
+		}
+
+	public:
+		T* owner = nullptr;
+
+		timer_node* next = nullptr;
+		// the previous node's <next>, or the list head
+		timer_node** pprev = nullptr;
+
+		uint64_t expiry_tick = 0;
+	};
+
+
+	// hierarchical timing wheel (cascading, as in classic BSD and Linux kernels):
+	// NUM_LEVELS wheels of NUM_SLOTS slots, a slot of level n spanning
+	// NUM_SLOTS^n ticks; timers further out than the lowest level wait in a
+	// coarser one and are redistributed when the finer wheel wraps, so adding,
+	// moving and cancelling a timer is O(1) and advancing costs one step per
+	// tick plus the timers that actually expire
+	//
+	// expired timers are not run by the wheel but move to the back of a ready
+	// list, which the owner drains at its own pace; whatever it leaves stays
+	// in front of timers that expire later
+	template<typename T> class timer_wheel {
+	public:
+		typedef std::chrono::high_resolution_clock::time_point time_point;
+		typedef std::chrono::nanoseconds time_range;
+		typedef timer_node<T> node;
+
+		enum: uint32_t {
+			SLOT_BITS  = 6,
+			NUM_SLOTS  = 1 << SLOT_BITS,
+			SLOT_MASK  = NUM_SLOTS - 1,
+			NUM_LEVELS = 4,
+		};
+
+		explicit timer_wheel(time_range tick_time = std::chrono::milliseconds(1))
+			: m_start_time(std::chrono::high_resolution_clock::now())
+			, m_tick_time(tick_time)
+		{
+			std::fill(&m_slots[0][0], &m_slots[0][0] + NUM_LEVELS * NUM_SLOTS, nullptr);
+
+			m_ready.next = &m_ready;
+			m_ready.pprev = &m_ready.next;
+		}
+
+		~timer_wheel() { clear(); }
+
+		timer_wheel(const timer_wheel&) = delete;
+		timer_wheel& operator = (const timer_wheel&) = delete;
+
+		// (re)schedules <n> to expire at the first tick at or after <time>, but
+		// not before the next advance; max() only cancels it
+		void schedule(node& n, time_point time) {
+			n.unlink();
+
+			if (time == time_point::max())
+				return;
+
+			n.expiry_tick = to_tick(time, m_tick_time.count() - 1);
+			link(n);
+		}
+
+		// makes <n> ready right away; keeps its place if it already is
+		void schedule_now(node& n) {
+			if (is_ready(n))
+				return;
+
+			n.unlink();
+			n.expiry_tick = READY_TICK;
+			n.link_back(m_ready);
+		}
+
+		void cancel(node& n) { n.unlink(); }
+
+		bool is_ready(const node& n) const { return (n.is_linked() && n.expiry_tick == READY_TICK); }
+		bool has_ready() const { return (m_ready.next != &m_ready); }
+
+		// unlinks the longest-ready timer, nullptr if none
+		T* pop_ready() {
+			if (!has_ready())
+				return nullptr;
+
+			node* n = m_ready.next;
+
+			n->unlink();
+			return n->owner;
+		}
+
+		// moves every timer expired by <time> to the ready list
+		void advance(time_point time) {
+			for (const uint64_t tick = to_tick(time, 0); m_cur_tick <= tick; ++m_cur_tick) {
+				const uint32_t index = m_cur_tick & SLOT_MASK;
+
+				// the finer wheels wrapped around, pull the next slot down from above
+				for (uint32_t level = 1; level < NUM_LEVELS && ((m_cur_tick >> (SLOT_BITS * (level - 1))) & SLOT_MASK) == 0; ++level) {
+					cascade(level, (m_cur_tick >> (SLOT_BITS * level)) & SLOT_MASK);
+				}
+
+				while (m_slots[0][index] != nullptr) {
+					node* n = m_slots[0][index];
+
+					n->unlink();
+					n->expiry_tick = READY_TICK;
+					n->link_back(m_ready);
+				}
+			}
+		}
+
+		// earliest time an advance could make a timer ready, min() if one already
+		// is and max() if none is scheduled; timers in the coarser wheels count
+		// from when their slot cascades, which is never later than they expire
+		time_point get_next_expiry_time() const {
+			if (has_ready())
+				return time_point::min();
+
+			uint64_t next_tick = READY_TICK;
+
+			for (uint32_t offset = 0; offset < NUM_SLOTS; ++offset) {
+				if (m_slots[0][(m_cur_tick + offset) & SLOT_MASK] == nullptr)
+					continue;
+
+				next_tick = m_cur_tick + offset;
+				break;
+			}
+
+			for (uint32_t level = 1; level < NUM_LEVELS; ++level) {
+				const uint32_t shift = SLOT_BITS * level;
+				// first block of this level's slot size that starts at or after m_cur_tick
+				const uint64_t first_block = (m_cur_tick + (uint64_t(1) << shift) - 1) >> shift;
+
+				for (uint32_t index = 0; index < NUM_SLOTS; ++index) {
+					if (m_slots[level][index] == nullptr)
+						continue;
+
+					next_tick = std::min(next_tick, (first_block + ((index - first_block) & SLOT_MASK)) << shift);
+				}
+			}
+
+			if (next_tick == READY_TICK)
+				return time_point::max();
+
+			return (m_start_time + m_tick_time * next_tick);
+		}
+
+		// unlinks every timer
+		void clear() {
+			for (uint32_t level = 0; level < NUM_LEVELS; ++level) {
+				for (uint32_t index = 0; index < NUM_SLOTS; ++index) {
+					while (m_slots[level][index] != nullptr) {
+						m_slots[level][index]->unlink();
+					}
+				}
+			}
+
+			while (has_ready()) {
+				pop_ready();
+			}
+		}
+
+	private:
+		static constexpr uint64_t READY_TICK = ~uint64_t(0);
+
+		uint64_t to_tick(time_point time, int64_t round) const {
+			if (time <= m_start_time)
+				return 0;
+
+			return ((time - m_start_time).count() + round) / m_tick_time.count();
+		}
+
+		void link(node& n) {
+			// already due, expires on the next advance
+			n.expiry_tick = std::max(n.expiry_tick, m_cur_tick);
+
+			// beyond the coarsest wheel, parked in its furthest slot until cascaded
+			const uint64_t max_delta = (uint64_t(1) << (SLOT_BITS * NUM_LEVELS)) - 1;
+			const uint64_t slot_tick = m_cur_tick + std::min(n.expiry_tick - m_cur_tick, max_delta);
+			const uint64_t delta = slot_tick - m_cur_tick;
+
+			uint32_t level = 0;
+
+			while (level < (NUM_LEVELS - 1) && delta >= (uint64_t(1) << (SLOT_BITS * (level + 1)))) {
+				level += 1;
+			}
+
+			n.link(m_slots[level][(slot_tick >> (SLOT_BITS * level)) & SLOT_MASK]);
+		}
+
+		void cascade(uint32_t level, uint32_t index) {
+			node* list = m_slots[level][index];
+
+			// detached first, nodes re-linked into this slot are not visited again
+			if (list != nullptr)
+				list->pprev = &list;
+
+			m_slots[level][index] = nullptr;
+
+			while (list != nullptr) {
+				node* n = list;
+
+				n->unlink();
+				link(*n);
+			}
+		}
+
+	private:
+		node* m_slots[NUM_LEVELS][NUM_SLOTS];
+		// sentinel of the circular ready list
+		node m_ready{nullptr};
+
+		time_point m_start_time;
+		time_range m_tick_time;
+
+		// next tick to expire
+		uint64_t m_cur_tick = 0;
+	};
+}
+
+#endif
+
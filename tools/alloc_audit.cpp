@@ -0,0 +1,321 @@
+// allocation audit: checks that a warmed-up connection pair exchanges messages
+// without touching the heap
+//
+// usage: alloc_audit [-w <ticks>] [-n <ticks>] [-p <port>] [-l]
+//   -w  warm-up ticks before counting starts (default 1000)
+//   -n  ticks to count allocations over (default 2000)
+//   -p  listener port (default 8453)
+//   -l  also track per-stage message latencies on both ends
+//
+// a client connection and a listener on loopback exchange a mix of small and
+// fragmented ordered messages, delta-coded ones, reliable unordered and
+// unreliable sequenced messages on several streams, one batch per 1ms tick;
+// the listener side also sends part of its traffic through a broadcast group.
+// the global allocator is replaced to count every allocation while measuring;
+// the library must be built with -DALLOC_AUDIT so each allocation can be
+// attributed to the component that made it (everything else shows up as
+// "unscoped"). exits with 1 if any allocation happened while measuring
+
+#include <asio.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <thread>
+
+#include "alloc_audit.hpp"
+#include "mem_pool.hpp"
+#include "protocol_def.hpp"
+#include "raw_packet.hpp"
+#include "udp_broadcast.hpp"
+#include "udp_connection.hpp"
+#include "udp_listener.hpp"
+
+using namespace arelion;
+
+namespace {
+	constexpr uint32_t MAX_SCOPES = 64;
+
+	struct scope_count {
+		const char* name;
+
+		uint64_t allocs;
+		uint64_t bytes;
+	};
+
+	// filled from inside operator new, so nothing here may allocate
+	scope_count g_scope_counts[MAX_SCOPES];
+	uint32_t g_num_scopes = 0;
+
+	bool g_counting = false;
+
+
+	void count_alloc(size_t size) {
+		if (!g_counting)
+			return;
+
+		const char* name = alloc_audit::cur_scope();
+
+		if (name == nullptr)
+			name = "unscoped";
+
+		uint32_t n = 0;
+
+		while (n < g_num_scopes && std::strcmp(g_scope_counts[n].name, name) != 0)
+			n += 1;
+
+		if (n == MAX_SCOPES)
+			n -= 1;
+		if (n == g_num_scopes)
+			g_scope_counts[g_num_scopes++] = {name, 0, 0};
+
+		g_scope_counts[n].allocs += 1;
+		g_scope_counts[n].bytes += size;
+	}
+
+	void* counted_alloc(size_t size) {
+		count_alloc(size);
+		return (std::malloc(std::max(size, size_t(1))));
+	}
+}
+
+
+void* operator new(size_t size) {
+	void* ptr = counted_alloc(size);
+
+	if (ptr == nullptr)
+		throw std::bad_alloc();
+
+	return ptr;
+}
+
+void* operator new[](size_t size) {
+	void* ptr = counted_alloc(size);
+
+	if (ptr == nullptr)
+		throw std::bad_alloc();
+
+	return ptr;
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return (counted_alloc(size)); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return (counted_alloc(size)); }
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { std::free(ptr); }
+
+
+namespace {
+	enum {
+		MSG_SMALL = 1,
+		MSG_LARGE = 2,
+		MSG_EVENT = 3,
+		MSG_STATE = 4,
+	};
+
+	struct audit_config {
+		uint32_t warmup_ticks = 1000;
+		uint32_t measure_ticks = 2000;
+
+		uint16_t port = 8453;
+
+		bool latency_stats = false;
+	};
+
+	struct traffic_counts {
+		uint64_t sent = 0;
+		uint64_t recvd = 0;
+	};
+
+
+	std::shared_ptr<const raw_packet> make_message(uint8_t id, uint32_t length, uint32_t tick) {
+		const std::shared_ptr<raw_packet> pkt = make_pooled<raw_packet>(length);
+
+		std::memset(pkt->data, tick & 0xFF, pkt->length);
+		pkt->data[0] = id;
+
+		if (id == MSG_LARGE)
+			std::memcpy(pkt->data + 1, &length, sizeof(uint16_t));
+
+		return pkt;
+	}
+
+	// one tick worth of traffic from either end
+	void send_messages(udp_connection& conn, uint32_t tick, traffic_counts& counts, udp_broadcast_group* group = nullptr) {
+		ALLOC_AUDIT_SCOPE("audit_driver");
+
+		conn.begin_batch();
+
+		for (uint32_t n = 0; n < 4; ++n) {
+			conn.send_data(make_message(MSG_SMALL, 16, tick));
+		}
+
+		conn.send_data(make_message(MSG_LARGE, 300 + (tick % 7) * 100, tick), base_connection::DELIVERY_RELIABLE_ORDERED, 1);
+		conn.send_data(make_message(MSG_STATE, 48, tick), base_connection::DELIVERY_RELIABLE_ORDERED, 2);
+		conn.send_data(make_message(MSG_EVENT, 32, tick), base_connection::DELIVERY_RELIABLE_UNORDERED);
+		conn.send_data(make_message(MSG_SMALL, 16, tick), base_connection::DELIVERY_UNRELIABLE_SEQUENCED, 3);
+
+		conn.end_batch();
+
+		counts.sent += 8;
+
+		if (group == nullptr)
+			return;
+
+		group->begin_batch();
+		group->send_data(make_message(MSG_LARGE, 200 + (tick % 5) * 100, tick), base_connection::DELIVERY_RELIABLE_ORDERED, 1);
+		group->send_data(make_message(MSG_STATE, 48, tick), base_connection::DELIVERY_RELIABLE_ORDERED, 2);
+		group->send_data(make_message(MSG_EVENT, 32, tick), base_connection::DELIVERY_RELIABLE_UNORDERED);
+		group->end_batch();
+
+		counts.sent += 3;
+	}
+
+	void recv_messages(udp_connection& conn, traffic_counts& counts) {
+		ALLOC_AUDIT_SCOPE("audit_driver");
+
+		for (uint8_t stream = 0; stream < 4; ++stream) {
+			while (conn.get_data(stream) != nullptr)
+				counts.recvd += 1;
+		}
+	}
+
+	bool parse_args(int argc, char** argv, audit_config& config) {
+		for (int i = 1; i < argc; ++i) {
+			if (std::strcmp(argv[i], "-l") == 0) {
+				config.latency_stats = true;
+				continue;
+			}
+
+			if ((i + 1) >= argc)
+				return false;
+
+			if (std::strcmp(argv[i], "-w") == 0) {
+				config.warmup_ticks = atoi(argv[++i]);
+				continue;
+			}
+			if (std::strcmp(argv[i], "-n") == 0) {
+				config.measure_ticks = std::max(atoi(argv[++i]), 1);
+				continue;
+			}
+			if (std::strcmp(argv[i], "-p") == 0) {
+				config.port = atoi(argv[++i]);
+				continue;
+			}
+
+			return false;
+		}
+
+		return true;
+	}
+}
+
+int main(int argc, char** argv) {
+	audit_config config;
+
+	if (!parse_args(argc, argv, config)) {
+		fprintf(stderr, "usage: %s [-w <ticks>] [-n <ticks>] [-p <port>] [-l]\n", argv[0]);
+		return 1;
+	}
+
+	proto_def.add_type(MSG_SMALL, 16);
+	proto_def.add_type(MSG_LARGE, -2);
+	proto_def.add_type(MSG_EVENT, 32);
+	proto_def.add_delta_type(MSG_STATE, 48);
+
+	udp_listener listener(config.port, "127.0.0.1");
+	udp_connection client(0, config.port, "127.0.0.1");
+	std::shared_ptr<udp_connection> server;
+	udp_broadcast_group group;
+
+	traffic_counts client_counts;
+	traffic_counts server_counts;
+
+	if (config.latency_stats)
+		client.enable_latency_stats();
+
+	// the pacer would otherwise let the queues grow without bound
+	client.set_outgoing_rate(0, 0);
+	client.unmute();
+
+	const uint32_t num_ticks = config.warmup_ticks + config.measure_ticks;
+
+	uint64_t sent_before = 0;
+	uint64_t recvd_before = 0;
+
+	for (uint32_t tick = 0; tick < num_ticks; ++tick) {
+		if (tick == config.warmup_ticks) {
+			if (server == nullptr) {
+				fprintf(stderr, "[%s] no connection after %u warm-up ticks\n", __func__, tick);
+				return 1;
+			}
+
+			sent_before = client_counts.sent + server_counts.sent;
+			recvd_before = client_counts.recvd + server_counts.recvd;
+
+			g_counting = true;
+		}
+
+		send_messages(client, tick, client_counts);
+
+		if (server != nullptr)
+			send_messages(*server, tick, server_counts, &group);
+
+		client.update();
+		listener.update();
+
+		if (server == nullptr && listener.has_incoming_connections()) {
+			server = listener.accept_connection();
+
+			if (config.latency_stats)
+				server->enable_latency_stats();
+
+			server->set_outgoing_rate(0, 0);
+			server->unmute();
+
+			group.add_connection(server);
+		}
+
+		recv_messages(client, client_counts);
+
+		if (server != nullptr)
+			recv_messages(*server, server_counts);
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	g_counting = false;
+
+	const uint64_t msgs_sent = client_counts.sent + server_counts.sent - sent_before;
+	const uint64_t msgs_recvd = client_counts.recvd + server_counts.recvd - recvd_before;
+
+	uint64_t num_allocs = 0;
+	uint64_t num_bytes = 0;
+
+	for (uint32_t n = 0; n < g_num_scopes; ++n) {
+		num_allocs += g_scope_counts[n].allocs;
+		num_bytes += g_scope_counts[n].bytes;
+	}
+
+	printf("%u ticks, %" PRIu64 " messages sent and %" PRIu64 " received: %" PRIu64 " allocations (%" PRIu64 " bytes)\n", config.measure_ticks, msgs_sent, msgs_recvd, num_allocs, num_bytes);
+
+	if (num_allocs == 0)
+		return 0;
+
+	printf("%-16s %10s %12s %12s\n", "component", "allocs", "bytes", "allocs/msg");
+
+	for (uint32_t n = 0; n < g_num_scopes; ++n) {
+		const scope_count& count = g_scope_counts[n];
+		printf("%-16s %10" PRIu64 " %12" PRIu64 " %12.4f\n", count.name, count.allocs, count.bytes, count.allocs * 1.0 / std::max(msgs_sent, uint64_t(1)));
+	}
+
+	return 1;
+}
+
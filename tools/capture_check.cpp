@@ -0,0 +1,248 @@
+// capture check: a listener's capture reads back as the datagrams it saw, and
+// replaying it reassembles the same messages both ends received
+//
+// usage: capture_check [-p <port>] [-o <capture>]
+//   -p  listener port (default 8503)
+//   -o  capture file to write (default capture_check.pcap, removed if the
+//       check passes)
+//
+// a client and a listener on loopback exchange ordered messages on one
+// stream, compressible blobs of varying size on another and delta-coded
+// records, while the listener captures its socket. read back, every
+// datagram has to be one of the two flows and carry a valid header and
+// checksum, and there have to be as many datagrams to the listener as it
+// counted receiving. each flow is then fed into its own udp_connection as
+// pcap_replay -r does, which has to reassemble exactly the messages the
+// real receiving end got, in the same order. exits with 1 otherwise
+
+#include <asio.hpp>
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "pcap_file.hpp"
+#include "protocol_def.hpp"
+#include "raw_packet.hpp"
+#include "udp_connection.hpp"
+#include "udp_listener.hpp"
+#include "udp_packet.hpp"
+#include "util.hpp"
+
+using namespace arelion;
+
+namespace {
+	constexpr uint8_t MSG_SEQ = 1;
+	constexpr uint8_t MSG_BLOB = 2;
+	constexpr uint8_t MSG_STATE = 3;
+
+	constexpr uint8_t BLOB_STREAM = 1;
+
+	constexpr uint32_t NUM_TICKS = 1500;
+	constexpr uint32_t SEND_TICKS = NUM_TICKS - 500;
+
+	typedef std::vector< std::vector<uint8_t> > message_log;
+	typedef std::pair<asio::ip::udp::endpoint, asio::ip::udp::endpoint> flow_key;
+
+	// a mix of the three types, different for each <tick> and end
+	void send_messages(udp_connection& conn, uint32_t tick, uint8_t salt) {
+		const std::shared_ptr<raw_packet> seq_msg(new raw_packet(8));
+
+		std::memset(seq_msg->data, salt, 8);
+		seq_msg->data[0] = MSG_SEQ;
+		std::memcpy(seq_msg->data + 1, &tick, sizeof(tick));
+		conn.send_data(seq_msg);
+
+		if ((tick % 3) == 0) {
+			const std::shared_ptr<raw_packet> state_msg(new raw_packet(48));
+
+			std::memset(state_msg->data, 0, 48);
+			state_msg->data[0] = MSG_STATE;
+			state_msg->data[1] = salt;
+			std::memcpy(state_msg->data + 8, &tick, sizeof(tick));
+			conn.send_data(state_msg);
+		}
+
+		if ((tick % 10) == 0) {
+			const uint16_t length = 3 + (tick * 37) % 1500;
+			const std::shared_ptr<raw_packet> blob_msg(new raw_packet(length));
+
+			for (uint32_t n = 3; n < length; ++n) {
+				blob_msg->data[n] = "capture "[n % 8] ^ salt;
+			}
+
+			blob_msg->data[0] = MSG_BLOB;
+			std::memcpy(blob_msg->data + 1, &length, sizeof(length));
+			conn.send_data(blob_msg, base_connection::DELIVERY_RELIABLE_ORDERED, BLOB_STREAM);
+		}
+	}
+
+	void recv_messages(udp_connection& conn, message_log& log) {
+		for (uint8_t stream = 0; stream < base_connection::MAX_STREAMS; ++stream) {
+			for (std::shared_ptr<const raw_packet> msg = conn.get_data(stream); msg != nullptr; msg = conn.get_data(stream)) {
+				log.emplace_back(msg->data, msg->data + msg->length);
+				log.back().push_back(stream);
+			}
+		}
+	}
+
+	bool parse_args(int argc, char** argv, uint16_t& port, std::string& file_name) {
+		for (int i = 1; i < argc; ++i) {
+			if ((i + 1) >= argc)
+				return false;
+
+			if (std::strcmp(argv[i], "-p") == 0) {
+				port = atoi(argv[++i]);
+				continue;
+			}
+			if (std::strcmp(argv[i], "-o") == 0) {
+				file_name = argv[++i];
+				continue;
+			}
+
+			return false;
+		}
+
+		return true;
+	}
+}
+
+int main(int argc, char** argv) {
+	uint16_t port = 8503;
+	std::string file_name = "capture_check.pcap";
+
+	if (!parse_args(argc, argv, port, file_name)) {
+		fprintf(stderr, "usage: %s [-p <port>] [-o <capture>]\n", argv[0]);
+		return 1;
+	}
+
+	proto_def.add_type(MSG_SEQ, 8);
+	proto_def.add_type(MSG_BLOB, -2);
+	proto_def.add_delta_type(MSG_STATE, 48);
+
+	const asio::ip::udp::endpoint server_address(asio::ip::address::from_string("127.0.0.1"), port);
+
+	udp_listener listener(port, "127.0.0.1");
+
+	if (!listener.start_capture(file_name)) {
+		fprintf(stderr, "[%s] failed to capture to \"%s\"\n", __func__, file_name.c_str());
+		return 1;
+	}
+
+	udp_connection client(0, port, "127.0.0.1");
+	std::shared_ptr<udp_connection> server;
+
+	// what each end received, in order
+	message_log client_log;
+	message_log server_log;
+
+	client.unmute();
+
+	for (uint32_t tick = 0; tick < NUM_TICKS; ++tick) {
+		if (tick < SEND_TICKS) {
+			send_messages(client, tick, 0x11);
+
+			if (server != nullptr)
+				send_messages(*server, tick, 0x22);
+		}
+
+		client.update();
+		listener.update();
+
+		if (server == nullptr && listener.has_incoming_connections()) {
+			server = listener.accept_connection();
+			server->unmute();
+		}
+
+		recv_messages(client, client_log);
+
+		if (server != nullptr)
+			recv_messages(*server, server_log);
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	listener.stop_capture();
+
+	if (server == nullptr) {
+		fprintf(stderr, "[%s] no connection after %u ticks\n", __func__, NUM_TICKS);
+		return 1;
+	}
+
+	pcap_reader reader;
+	pcap_datagram datagram;
+
+	if (!reader.open(file_name))
+		return 1;
+
+	std::map< flow_key, std::shared_ptr<udp_connection> > flows;
+	std::map<flow_key, message_log> replay_logs;
+
+	util::crc32_t crc;
+
+	uint32_t num_datagrams = 0;
+	uint32_t num_to_server = 0;
+	uint32_t num_invalid = 0;
+
+	while (reader.read(datagram)) {
+		num_datagrams += 1;
+		num_to_server += (datagram.dst == server_address);
+
+		if (datagram.src != server_address && datagram.dst != server_address) {
+			num_invalid += 1;
+			continue;
+		}
+
+		if (!udp_packet::has_valid_header(datagram.data.data(), datagram.data.size())) {
+			num_invalid += 1;
+			continue;
+		}
+
+		udp_packet pkt(&datagram.data[0], datagram.data.size());
+
+		if (pkt.calc_checksum(crc) != pkt.checksum) {
+			num_invalid += 1;
+			continue;
+		}
+
+		const flow_key key(datagram.src, datagram.dst);
+		std::shared_ptr<udp_connection>& conn = flows[key];
+
+		// receiving end only, never unmuted so nothing is sent
+		if (conn == nullptr)
+			conn.reset(new udp_connection(std::shared_ptr<asio::ip::udp::socket>(), datagram.src));
+
+		conn->process_raw_packet(pkt);
+		recv_messages(*conn, replay_logs[key]);
+	}
+
+	const listener_metrics& metrics = listener.get_metrics();
+	const uint64_t num_recvd = metrics.recv_datagrams.get();
+
+	uint32_t num_matching = 0;
+
+	for (const auto& pair: replay_logs) {
+		const message_log& real_log = (pair.first.second == server_address)? server_log: client_log;
+		num_matching += (pair.second == real_log);
+
+		printf("flow %s: %zu messages replayed, %zu received live, %s\n", (pair.first.second == server_address)? "to listener": "to client", pair.second.size(), real_log.size(), (pair.second == real_log)? "identical": "different");
+	}
+
+	printf("%u datagrams captured (%u to the listener, which counted %" PRIu64 "), %u invalid, %zu flows\n", num_datagrams, num_to_server, num_recvd, num_invalid, flows.size());
+
+	if (num_invalid != 0 || num_to_server != num_recvd || flows.size() != 2 || num_matching != 2)
+		return 1;
+	if (server_log.empty() || client_log.empty())
+		return 1;
+
+	std::remove(file_name.c_str());
+	return 0;
+}
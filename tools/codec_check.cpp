@@ -0,0 +1,263 @@
+// codec check: stream blocks and delta records round-trip, and corrupted ones
+// are rejected without desyncing the decoder
+//
+// usage: codec_check [-n <blocks>] [-s <seed>]
+//   -n  blocks or records to encode per pass (default 2000)
+//   -s  random seed (default 1)
+//
+// an encoder frames blocks of mixed repetitive and random bytes, compressing
+// whenever it pays; every LZ block has to come out strictly smaller than the
+// raw one would have been, and a decoder fed the framed bytes in random
+// pieces has to give back exactly what went in. then one LZ block in the
+// middle of a run is corrupted: decoding has to stop there with everything
+// before it and nothing of it, and resume with the raw blocks after it.
+//
+// packets of two delta-coded ids, each a slightly changed copy of the last
+// one, go through a delta encoder; every record has to decode to the packet
+// it came from. before each record the decoder is also given a damaged copy
+// (truncated, with an unknown tag or a zero run past the end), which it has
+// to reject without touching the instance the next record is coded against.
+// exits with 1 otherwise
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "delta_codec.hpp"
+#include "protocol_def.hpp"
+#include "stream_codec.hpp"
+
+using namespace arelion;
+
+namespace {
+	constexpr uint8_t MSG_DELTA_SMALL = 1;
+	constexpr uint8_t MSG_DELTA_LARGE = 2;
+
+	// repetitive text most of the time, random bytes otherwise
+	void make_block(std::mt19937& rng, std::vector<uint8_t>& block) {
+		static const char* const words[] = {"unit ", "move ", "attack ", "build ", "guard ", "patrol ", "stop "};
+
+		const uint32_t size = 1 + rng() % 1400;
+
+		block.clear();
+
+		if ((rng() % 4) == 0) {
+			while (block.size() < size) {
+				block.push_back(rng());
+			}
+		} else {
+			while (block.size() < size) {
+				const char* word = words[rng() % (sizeof(words) / sizeof(words[0]))];
+				block.insert(block.end(), word, word + std::strlen(word));
+			}
+		}
+
+		block.resize(size);
+	}
+
+	bool check_round_trip(uint32_t num_blocks, uint32_t seed) {
+		std::mt19937 rng(seed);
+
+		stream_encoder enc;
+		stream_decoder dec;
+
+		std::vector<uint8_t> block;
+		std::vector<uint8_t> sent;
+		std::vector<uint8_t> framed;
+		std::vector<uint8_t> recvd;
+
+		uint32_t num_lz = 0;
+		uint32_t num_larger = 0;
+
+		for (uint32_t n = 0; n < num_blocks; ++n) {
+			make_block(rng, block);
+
+			const uint32_t pos = framed.size();
+			const uint32_t size = enc.encode_block(block.data(), block.size(), true, framed);
+
+			num_lz += (framed[pos] == stream_codec::BLOCK_MODE_LZ);
+			num_larger += (framed[pos] == stream_codec::BLOCK_MODE_LZ && size >= (stream_codec::block_hdr_size(stream_codec::BLOCK_MODE_RAW) + block.size()));
+
+			sent.insert(sent.end(), block.begin(), block.end());
+		}
+
+		bool intact = true;
+
+		for (uint32_t pos = 0; pos < framed.size(); ) {
+			const uint32_t size = std::min(uint32_t(framed.size()) - pos, 1 + uint32_t(rng() % 2000));
+
+			dec.feed(&framed[pos], size);
+			intact &= dec.decode(recvd);
+			pos += size;
+		}
+
+		const bool equal = (recvd == sent);
+
+		printf("round trip: %u blocks (%u compressed, %u of those not smaller than raw), %zu bytes in %zu framed, %s\n", num_blocks, num_lz, num_larger, sent.size(), framed.size(), (intact && equal)? "decoded intact": "decoded differently");
+		return (intact && equal && num_larger == 0 && num_lz > 0);
+	}
+
+	bool check_corruption(uint32_t num_blocks, uint32_t seed) {
+		std::mt19937 rng(seed);
+
+		stream_encoder enc;
+		stream_decoder dec;
+
+		std::vector<uint8_t> block;
+		std::vector<uint8_t> framed;
+
+		// raw bytes before the corrupted block, and after it
+		std::vector<uint8_t> head;
+		std::vector<uint8_t> tail;
+
+		uint32_t lz_pos = 0;
+		uint32_t lz_size = 0;
+
+		for (uint32_t n = 0; n < num_blocks; ++n) {
+			make_block(rng, block);
+
+			// past the middle, only raw blocks until the end
+			const bool compress = (n < (num_blocks / 2) || lz_size == 0);
+			const uint32_t pos = framed.size();
+			const uint32_t size = enc.encode_block(block.data(), block.size(), compress, framed);
+
+			if (lz_size != 0) {
+				tail.insert(tail.end(), block.begin(), block.end());
+				continue;
+			}
+
+			if (n >= (num_blocks / 2) && framed[pos] == stream_codec::BLOCK_MODE_LZ) {
+				lz_pos = pos;
+				lz_size = size;
+				continue;
+			}
+
+			head.insert(head.end(), block.begin(), block.end());
+		}
+
+		if (lz_size == 0 || tail.empty()) {
+			fprintf(stderr, "[%s] no compressed block to corrupt\n", __func__);
+			return false;
+		}
+
+		// literal runs that never end, the payload runs out first
+		const uint32_t hdr_size = stream_codec::block_hdr_size(stream_codec::BLOCK_MODE_LZ);
+		std::fill(framed.begin() + lz_pos + hdr_size, framed.begin() + lz_pos + lz_size, 0xFF);
+
+		std::vector<uint8_t> recvd;
+
+		dec.feed(framed.data(), framed.size());
+
+		const bool stopped = !dec.decode(recvd);
+		const bool head_only = (recvd == head);
+
+		recvd.clear();
+
+		const bool resumed = dec.decode(recvd) && (recvd == tail);
+
+		printf("corrupted block: decoding %s, %s before it, %s after it\n", stopped? "stopped": "went on", head_only? "got exactly the blocks": "did not get the blocks", resumed? "resumed with the blocks": "did not resume");
+		return (stopped && head_only && resumed);
+	}
+
+	bool check_delta_records(uint32_t num_records, uint32_t seed) {
+		std::mt19937 rng(seed);
+
+		delta_encoder enc;
+		delta_decoder dec;
+
+		std::vector<uint8_t> prev[2] = {std::vector<uint8_t>(24, 0), std::vector<uint8_t>(200, 0)};
+		std::vector<uint8_t> record;
+		std::vector<uint8_t> damaged;
+		std::vector<uint8_t> pkt;
+
+		uint32_t num_full = 0;
+		uint32_t num_wrong = 0;
+		uint32_t num_accepted = 0;
+
+		for (uint32_t n = 0; n < num_records; ++n) {
+			std::vector<uint8_t>& cur = prev[rng() % 2];
+
+			cur[0] = (cur.size() == 24)? MSG_DELTA_SMALL: MSG_DELTA_LARGE;
+
+			// a few fields change each time, now and then all of them do
+			for (uint32_t i = 0, k = ((rng() % 16) == 0)? cur.size(): (rng() % 4); i < k; ++i) {
+				cur[1 + rng() % (cur.size() - 1)] = rng();
+			}
+
+			record.clear();
+			enc.encode_record(cur.data(), cur.size(), record);
+			num_full += (record[1] == delta_codec::RECORD_TAG_FULL);
+
+			damaged = record;
+
+			switch (rng() % 3) {
+				case 0: {
+					damaged.resize(1 + rng() % (damaged.size() - 1));
+				} break;
+				case 1: {
+					damaged[1] = 2 + rng() % 254;
+				} break;
+				case 2: {
+					damaged.resize(delta_codec::record_hdr_size());
+					damaged[1] = delta_codec::RECORD_TAG_DELTA;
+					damaged.push_back(cur.size() - 1);
+					damaged.push_back(2);
+					damaged.push_back(0xFF);
+					damaged.push_back(0xFF);
+				} break;
+			}
+
+			num_accepted += (dec.decode_record(damaged.data(), damaged.size(), pkt) > 0);
+			num_wrong += (dec.decode_record(record.data(), record.size(), pkt) != int32_t(record.size()) || pkt != cur);
+		}
+
+		printf("delta records: %u coded (%u full), %u decoded wrong, %u damaged ones accepted\n", num_records, num_full, num_wrong, num_accepted);
+		return (num_wrong == 0 && num_accepted == 0);
+	}
+
+	bool parse_args(int argc, char** argv, uint32_t& num_blocks, uint32_t& seed) {
+		for (int i = 1; i < argc; ++i) {
+			if ((i + 1) >= argc)
+				return false;
+
+			if (std::strcmp(argv[i], "-n") == 0) {
+				num_blocks = atoi(argv[++i]);
+				continue;
+			}
+			if (std::strcmp(argv[i], "-s") == 0) {
+				seed = atoi(argv[++i]);
+				continue;
+			}
+
+			return false;
+		}
+
+		return (num_blocks >= 2);
+	}
+}
+
+int main(int argc, char** argv) {
+	uint32_t num_blocks = 2000;
+	uint32_t seed = 1;
+
+	if (!parse_args(argc, argv, num_blocks, seed)) {
+		fprintf(stderr, "usage: %s [-n <blocks>] [-s <seed>]\n", argv[0]);
+		return 1;
+	}
+
+	if (!check_round_trip(num_blocks, seed))
+		return 1;
+	if (!check_corruption(num_blocks, seed + 1))
+		return 1;
+
+	proto_def.add_delta_type(MSG_DELTA_SMALL, 24);
+	proto_def.add_delta_type(MSG_DELTA_LARGE, 200);
+
+	if (!check_delta_records(num_blocks, seed + 2))
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,222 @@
+// handshake check: a client gets through the cookie handshake despite losing
+// its challenges and its first echo
+//
+// usage: handshake_check [-p <port>] [-c <challenges>] [-e <echoes>]
+//   -p  listener port (default 8483, the relay takes the next one)
+//   -c  cookie challenges to drop on the way to the client (default 2)
+//   -e  datagrams echoing the cookie to drop on the way to the listener
+//       (default 1)
+//
+// a client reaches the listener through a relay on loopback and sends a
+// message every tick from the start, so several chunks are queued (and
+// resent on timeout) before any challenge gets through. the relay drops the
+// first few challenges and the first datagrams echoing the cookie, and every
+// seventh datagram either way until the connection is accepted. the listener
+// must accept exactly one connection and every message the client sent must
+// arrive in order. exits with 1 otherwise
+
+#include <asio.hpp>
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+#include "protocol_def.hpp"
+#include "raw_packet.hpp"
+#include "socket_helper.hpp"
+#include "udp_connection.hpp"
+#include "udp_listener.hpp"
+#include "udp_packet.hpp"
+
+using namespace arelion;
+
+namespace {
+	constexpr uint8_t MSG_SEQ = 1;
+
+	constexpr uint32_t NUM_TICKS = 3000;
+	constexpr uint32_t SEND_TICKS = NUM_TICKS - 1000;
+	constexpr uint32_t LOSS_INTERVAL = 7;
+
+	// forwards between the client and the listener, dropping handshake datagrams
+	struct lossy_relay {
+	public:
+		lossy_relay(uint16_t port, const asio::ip::udp::endpoint& server_, uint32_t challenges, uint32_t echoes)
+			: socket(netservice, asio::ip::udp::endpoint(asio::ip::address::from_string("127.0.0.1"), port))
+			, server(server_)
+			, challenges_to_drop(challenges)
+			, echoes_to_drop(echoes)
+		{
+		}
+
+		void pump(bool lossy) {
+			asio::ip::udp::endpoint from;
+			asio::error_code error_code;
+
+			while (socket.available() > 0) {
+				const size_t size = socket.receive_from(asio::buffer(buffer), from, 0, error_code);
+
+				if (!udp_packet::has_valid_header(buffer, size))
+					continue;
+
+				const udp_packet pkt(buffer, size);
+				const bool upstream = (from != server);
+
+				if (upstream)
+					client = from;
+
+				if (!upstream && (pkt.flags & udp_packet::PKT_FLAG_COOKIE_CHALLENGE) != 0) {
+					challenges_seen += 1;
+
+					if (challenges_to_drop > 0) {
+						challenges_to_drop -= 1;
+						continue;
+					}
+				}
+
+				if (upstream && (pkt.flags & udp_packet::PKT_FLAG_COOKIE_ECHO) != 0) {
+					echoes_seen += 1;
+
+					if (echoes_to_drop > 0) {
+						echoes_to_drop -= 1;
+						continue;
+					}
+				}
+
+				if (lossy && ((num_relayed++) % LOSS_INTERVAL) == (LOSS_INTERVAL - 1))
+					continue;
+
+				socket.send_to(asio::buffer(buffer, size), upstream? server: client, 0, error_code);
+			}
+		}
+
+	public:
+		asio::ip::udp::socket socket;
+
+		asio::ip::udp::endpoint server;
+		asio::ip::udp::endpoint client;
+
+		uint32_t challenges_to_drop = 0;
+		uint32_t echoes_to_drop = 0;
+
+		uint32_t challenges_seen = 0;
+		uint32_t echoes_seen = 0;
+		uint32_t num_relayed = 0;
+
+		uint8_t buffer[8192];
+	};
+
+	std::shared_ptr<raw_packet> make_message(uint32_t seq) {
+		const std::shared_ptr<raw_packet> msg(new raw_packet(8));
+
+		std::memset(msg->data, 0, 8);
+		msg->data[0] = MSG_SEQ;
+		std::memcpy(msg->data + 1, &seq, sizeof(seq));
+		return msg;
+	}
+
+	bool parse_args(int argc, char** argv, uint16_t& port, uint32_t& challenges, uint32_t& echoes) {
+		for (int i = 1; i < argc; ++i) {
+			if ((i + 1) >= argc)
+				return false;
+
+			if (std::strcmp(argv[i], "-p") == 0) {
+				port = atoi(argv[++i]);
+				continue;
+			}
+			if (std::strcmp(argv[i], "-c") == 0) {
+				challenges = atoi(argv[++i]);
+				continue;
+			}
+			if (std::strcmp(argv[i], "-e") == 0) {
+				echoes = atoi(argv[++i]);
+				continue;
+			}
+
+			return false;
+		}
+
+		return true;
+	}
+}
+
+int main(int argc, char** argv) {
+	uint16_t port = 8483;
+	uint32_t challenges = 2;
+	uint32_t echoes = 1;
+
+	if (!parse_args(argc, argv, port, challenges, echoes)) {
+		fprintf(stderr, "usage: %s [-p <port>] [-c <challenges>] [-e <echoes>]\n", argv[0]);
+		return 1;
+	}
+
+	proto_def.add_type(MSG_SEQ, 8);
+
+	udp_listener listener(port, "127.0.0.1");
+	lossy_relay relay(port + 1, asio::ip::udp::endpoint(asio::ip::address::from_string("127.0.0.1"), port), challenges, echoes);
+
+	udp_connection client(0, port + 1, "127.0.0.1");
+	std::shared_ptr<udp_connection> server;
+
+	uint32_t msgs_sent = 0;
+	uint32_t msgs_recvd = 0;
+	uint32_t msgs_unordered = 0;
+	uint32_t accept_tick = 0;
+
+	client.unmute();
+
+	for (uint32_t tick = 0; tick < NUM_TICKS; ++tick) {
+		if (tick < SEND_TICKS)
+			client.send_data(make_message(msgs_sent++));
+
+		// a connection that never sends takes acks-only datagrams for reconnects
+		if (server != nullptr)
+			server->send_data(make_message(tick));
+
+		client.update();
+		relay.pump(server == nullptr);
+		listener.update();
+
+		if (server == nullptr && listener.has_incoming_connections()) {
+			server = listener.accept_connection();
+			server->unmute();
+
+			accept_tick = tick;
+		}
+
+		while (client.get_data() != nullptr) {
+		}
+
+		while (server != nullptr && server->has_incoming_data()) {
+			const std::shared_ptr<const raw_packet> msg = server->get_data();
+
+			uint32_t seq = 0;
+			std::memcpy(&seq, msg->data + 1, sizeof(seq));
+
+			msgs_unordered += (seq != msgs_recvd);
+			msgs_recvd = seq + 1;
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	if (server == nullptr) {
+		fprintf(stderr, "[%s] no connection after %u ticks (%u challenges and %u echoes seen by the relay)\n", __func__, NUM_TICKS, relay.challenges_seen, relay.echoes_seen);
+		return 1;
+	}
+
+	const listener_metrics& metrics = listener.get_metrics();
+	const uint64_t num_accepted = metrics.accepted_connections.get();
+
+	printf("accepted at tick %u after %u challenges and %u echoes (%u and %u dropped), %" PRIu64 " connections, %u messages sent and %u received (%u out of order)\n", accept_tick, relay.challenges_seen, relay.echoes_seen, std::min(challenges, relay.challenges_seen), std::min(echoes, relay.echoes_seen), num_accepted, msgs_sent, msgs_recvd, msgs_unordered);
+
+	if (num_accepted != 1 || msgs_recvd != msgs_sent || msgs_unordered != 0)
+		return 1;
+	if (relay.challenges_seen <= challenges || relay.echoes_seen <= echoes)
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,397 @@
+// load generator: ramps up simulated clients against one udp_listener and
+// reports what the server side costs at each step
+//
+// usage: loadgen [options]
+//   -c <n,n,...>  client counts to ramp through (default 100,500,1000,2000)
+//   -s <secs>     duration of each step (default 10)
+//   -w <procs>    client processes, each driving its share of the clients (default 1)
+//   -f <frac>     fraction of clients that are players, the rest spectate (default 0.2)
+//   -r <hz>       player message rate (default 30)
+//   -z <bytes>    player message size (default 24)
+//   -R <hz>       server frame rate, each frame is sent to every client (default 30)
+//   -Z <bytes>    server frame size (default 128)
+//   -p <port>     server port (default 8452)
+//   -b            send server frames through a udp_broadcast_group instead of
+//                 to each connection, so their chunks are built only once
+//
+// the server runs in this process and the clients in forked ones, so the
+// CPU time and memory reported per step belong to the server alone; both
+// sides timestamp messages with the same monotonic clock, which gives the
+// one-way delivery latency of player messages
+//
+// every client needs its own socket since new connections are told apart
+// by address; clients of a process share one thread and are polled in
+// turn, so raise the file descriptor limit for large counts
+
+#include <asio.hpp>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "latency_histogram.hpp"
+#include "protocol_def.hpp"
+#include "raw_packet.hpp"
+#include "socket_helper.hpp"
+#include "udp_broadcast.hpp"
+#include "udp_connection.hpp"
+#include "udp_listener.hpp"
+#include "util.hpp"
+
+using namespace arelion;
+
+namespace {
+	typedef std::chrono::steady_clock load_clock;
+
+	constexpr uint8_t MSG_ID = 2;
+	// id, uint16 length, int64 send time
+	constexpr uint32_t MSG_MIN_SIZE = 1 + 2 + 8;
+
+	struct load_config {
+		std::vector<uint32_t> client_counts = {100, 500, 1000, 2000};
+
+		uint32_t step_secs = 10;
+		uint32_t client_procs = 1;
+
+		float player_frac = 0.2f;
+
+		uint32_t player_rate = 30;
+		uint32_t player_size = 24;
+		uint32_t server_rate = 30;
+		uint32_t server_size = 128;
+
+		uint16_t port = 8452;
+
+		bool broadcast = false;
+	};
+
+	struct load_client {
+		std::shared_ptr<asio::ip::udp::socket> socket;
+		std::shared_ptr<udp_connection> conn;
+
+		load_clock::time_point next_send_time;
+		load_clock::duration send_interval;
+	};
+
+
+	int64_t get_clock_ns() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(load_clock::now().time_since_epoch()).count();
+	}
+
+	double get_thread_cpu_secs() {
+		timespec ts;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+		return (ts.tv_sec + ts.tv_nsec * 1e-9);
+	}
+
+	uint64_t get_rss_bytes() {
+		FILE* file = fopen("/proc/self/statm", "r");
+		unsigned long pages[2] = {0, 0};
+
+		if (file == nullptr)
+			return 0;
+
+		if (fscanf(file, "%lu %lu", &pages[0], &pages[1]) != 2)
+			pages[1] = 0;
+
+		fclose(file);
+		return (pages[1] * uint64_t(sysconf(_SC_PAGESIZE)));
+	}
+
+	std::shared_ptr<const raw_packet> make_message(uint32_t size) {
+		std::shared_ptr<raw_packet> pkt(new raw_packet(std::max(size, MSG_MIN_SIZE)));
+
+		const uint16_t length = pkt->length;
+		const int64_t time = get_clock_ns();
+
+		std::memset(pkt->data, 0, pkt->length);
+
+		pkt->data[0] = MSG_ID;
+		std::memcpy(pkt->data + 1, &length, sizeof(length));
+		std::memcpy(pkt->data + 3, &time, sizeof(time));
+		return pkt;
+	}
+
+	int64_t get_message_time(const raw_packet& pkt) {
+		int64_t time = 0;
+
+		if (pkt.length >= MSG_MIN_SIZE)
+			std::memcpy(&time, pkt.data + 3, sizeof(time));
+
+		return time;
+	}
+
+	bool parse_args(int argc, char** argv, load_config& config) {
+		for (int i = 1; i < argc; ++i) {
+			if (strcmp(argv[i], "-b") == 0) {
+				config.broadcast = true;
+				continue;
+			}
+
+			if ((i + 1) >= argc || argv[i][0] != '-')
+				return false;
+
+			const char* arg = argv[++i];
+
+			switch (argv[i - 1][1]) {
+				case 'c': {
+					config.client_counts.clear();
+
+					for (const char* p = arg; *p != 0; p += (*p == ','))
+						config.client_counts.push_back(strtoul(p, const_cast<char**>(&p), 10));
+				} break;
+				case 's': { config.step_secs = std::max(atoi(arg), 1); } break;
+				case 'w': { config.client_procs = std::max(atoi(arg), 1); } break;
+				case 'f': { config.player_frac = atof(arg); } break;
+				case 'r': { config.player_rate = std::max(atoi(arg), 1); } break;
+				case 'z': { config.player_size = atoi(arg); } break;
+				case 'R': { config.server_rate = std::max(atoi(arg), 1); } break;
+				case 'Z': { config.server_size = atoi(arg); } break;
+				case 'p': { config.port = atoi(arg); } break;
+				default: { return false; } break;
+			}
+		}
+
+		return (!config.client_counts.empty());
+	}
+
+
+	// drives clients <proc_idx>, <proc_idx + client_procs>, ... until the last step ends
+	void run_clients(const load_config& config, uint32_t proc_idx, load_clock::time_point start_time) {
+		const asio::ip::udp::endpoint server_address(asio::ip::address_v4::loopback(), config.port);
+
+		std::vector<load_client> clients;
+
+		for (uint32_t step = 0; step < config.client_counts.size(); ++step) {
+			const load_clock::time_point step_end_time = start_time + std::chrono::seconds(config.step_secs * (step + 1));
+
+			// open this process' share of the new clients
+			for (uint32_t idx = clients.size() * config.client_procs + proc_idx; idx < config.client_counts[step]; idx += config.client_procs) {
+				load_client client;
+				asio::error_code error_code;
+
+				client.socket.reset(new asio::ip::udp::socket(netservice));
+				client.socket->open(asio::ip::udp::v4(), error_code);
+				client.socket->bind(asio::ip::udp::endpoint(asio::ip::address_v4::loopback(), 0), error_code);
+
+				if (check_error_code(error_code)) {
+					fprintf(stderr, "[%s] failed to open socket for client %u, out of file descriptors?\n", __func__, idx);
+					break;
+				}
+
+				client.socket->non_blocking(true);
+
+				client.conn.reset(new udp_connection(client.socket, server_address));
+				client.conn->unmute();
+
+				// players send at their rate, spectators only keep the connection alive
+				const bool player = (idx < uint32_t(config.client_counts.back() * config.player_frac + 0.5f));
+				const uint32_t send_rate = player? config.player_rate: 1;
+
+				client.send_interval = std::chrono::duration_cast<load_clock::duration>(std::chrono::nanoseconds(1000000000ll / send_rate));
+				client.next_send_time = load_clock::now() + client.send_interval * (idx % 16) / 16;
+
+				clients.push_back(client);
+			}
+
+			std::vector<uint8_t> recv_buffer(udp_packet::max_size());
+
+			while (load_clock::now() < step_end_time) {
+				for (load_client& client: clients) {
+					asio::ip::udp::endpoint sender;
+					asio::error_code error_code;
+
+					for (size_t size = 0; (size = client.socket->receive_from(asio::buffer(recv_buffer), sender, 0, error_code)) > 0 && !error_code; ) {
+						if (!udp_packet::has_valid_header(&recv_buffer[0], size))
+							continue;
+
+						udp_packet pkt(&recv_buffer[0], size);
+						client.conn->process_raw_packet(pkt);
+					}
+
+					// server frames are only received, not inspected
+					while (client.conn->get_data() != nullptr);
+
+					if (load_clock::now() >= client.next_send_time) {
+						client.conn->send_data(make_message(config.player_size));
+						client.next_send_time += client.send_interval;
+					}
+
+					client.conn->update();
+				}
+
+				// keep a small population from spinning a core for nothing
+				if (clients.size() < 256)
+					std::this_thread::sleep_for(std::chrono::microseconds(500));
+			}
+		}
+	}
+
+	void run_server(const load_config& config, load_clock::time_point start_time) {
+		udp_listener listener(config.port, "127.0.0.1");
+		// every client shares one address, their handshakes must not be limited
+		listener.set_source_rate_limit(0, 0);
+
+		std::vector< std::shared_ptr<udp_connection> > conns;
+		udp_broadcast_group group;
+
+		const load_clock::duration frame_interval = std::chrono::duration_cast<load_clock::duration>(std::chrono::nanoseconds(1000000000ll / config.server_rate));
+		load_clock::time_point next_frame_time = start_time;
+
+		printf("# clients  conns   cpu[%%]  rss[MB]  mem/conn[KB]  msgs/s  in[KB/s]  out[KB/s]  p50[us]  p99[us]  max[us]\n");
+
+		uint64_t prv_rss = get_rss_bytes();
+		uint64_t prv_conns = 0;
+
+		for (uint32_t step = 0; step < config.client_counts.size(); ++step) {
+			const load_clock::time_point step_end_time = start_time + std::chrono::seconds(config.step_secs * (step + 1));
+			// measure only the second half of a step, once the new clients have connected
+			const load_clock::time_point measure_time = step_end_time - std::chrono::seconds(config.step_secs) / 2;
+
+			latency_histogram latencies;
+
+			double measure_cpu_secs = 0.0;
+
+			uint64_t measure_msgs = 0;
+			uint64_t measure_in_bytes = 0;
+			uint64_t measure_out_bytes = 0;
+
+			bool measuring = false;
+
+			while (load_clock::now() < step_end_time) {
+				listener.update();
+
+				while (listener.has_incoming_connections()) {
+					conns.push_back(listener.accept_connection());
+					conns.back()->unmute();
+
+					group.add_connection(conns.back());
+				}
+
+				if (!measuring && load_clock::now() >= measure_time) {
+					measuring = true;
+					measure_cpu_secs = get_thread_cpu_secs();
+					measure_msgs = 0;
+					measure_in_bytes = listener.get_metrics().recv_bytes.get();
+					measure_out_bytes = 0;
+
+					for (const std::shared_ptr<udp_connection>& conn: conns)
+						measure_out_bytes += conn->get_metrics().data_sent.get();
+				}
+
+				const int64_t recv_time = get_clock_ns();
+
+				for (const std::shared_ptr<udp_connection>& conn: conns) {
+					for (std::shared_ptr<const raw_packet> msg = conn->get_data(); msg != nullptr; msg = conn->get_data()) {
+						if (!measuring)
+							continue;
+
+						latencies.record(std::chrono::nanoseconds(recv_time - get_message_time(*msg)));
+						measure_msgs += 1;
+					}
+				}
+
+				if (load_clock::now() >= next_frame_time) {
+					const std::shared_ptr<const raw_packet> frame = make_message(config.server_size);
+
+					if (config.broadcast) {
+						group.send_data(frame);
+					} else {
+						for (const std::shared_ptr<udp_connection>& conn: conns)
+							conn->send_data(frame);
+					}
+
+					next_frame_time += frame_interval;
+				}
+
+				listener.pace(std::chrono::high_resolution_clock::now() + std::chrono::milliseconds(1));
+
+				// idle servers should not show up as a busy core
+				listener.wait(std::min(next_frame_time, step_end_time) - load_clock::now());
+			}
+
+			uint64_t out_bytes = 0;
+
+			for (const std::shared_ptr<udp_connection>& conn: conns)
+				out_bytes += conn->get_metrics().data_sent.get();
+
+			const double measure_secs = config.step_secs * 0.5;
+			const uint64_t cur_rss = get_rss_bytes();
+
+			printf(
+				"%9u %6u %8.1f %8.1f %13.2f %7.0f %9.1f %10.1f %8" PRIu64 " %8" PRIu64 " %8" PRIu64 "\n",
+				config.client_counts[step],
+				uint32_t(conns.size()),
+				(get_thread_cpu_secs() - measure_cpu_secs) * 100.0 / measure_secs,
+				cur_rss / (1024.0 * 1024.0),
+				(conns.size() > prv_conns)? ((int64_t(cur_rss) - int64_t(prv_rss)) / 1024.0 / (conns.size() - prv_conns)): 0.0,
+				measure_msgs / measure_secs,
+				(listener.get_metrics().recv_bytes.get() - measure_in_bytes) / 1024.0 / measure_secs,
+				(out_bytes - measure_out_bytes) / 1024.0 / measure_secs,
+				latencies.get_percentile(0.5f),
+				latencies.get_percentile(0.99f),
+				latencies.get_max()
+			);
+
+			fflush(stdout);
+
+			prv_rss = cur_rss;
+			prv_conns = conns.size();
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	load_config config;
+
+	if (!parse_args(argc, argv, config)) {
+		fprintf(stderr, "usage: %s [-c <n,n,...>] [-s <secs>] [-w <procs>] [-f <frac>] [-r <hz>] [-z <bytes>] [-R <hz>] [-Z <bytes>] [-p <port>] [-b]\n", argv[0]);
+		return 1;
+	}
+
+	{
+		rlimit limit;
+
+		if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+			limit.rlim_cur = limit.rlim_max;
+			setrlimit(RLIMIT_NOFILE, &limit);
+		}
+	}
+
+	proto_def.add_type(MSG_ID, -2);
+
+	// leave the server a moment to bind before the first clients connect
+	const load_clock::time_point start_time = load_clock::now() + std::chrono::milliseconds(500);
+
+	std::vector<pid_t> client_pids;
+
+	for (uint32_t proc_idx = 0; proc_idx < config.client_procs; ++proc_idx) {
+		const pid_t pid = fork();
+
+		if (pid == 0) {
+			std::this_thread::sleep_until(start_time);
+			run_clients(config, proc_idx, start_time);
+			_exit(0);
+		}
+
+		client_pids.push_back(pid);
+	}
+
+	run_server(config, start_time);
+
+	for (const pid_t pid: client_pids)
+		waitpid(pid, nullptr, 0);
+
+	return 0;
+}
+
@@ -0,0 +1,390 @@
+// microbenchmarks for the primitives every datagram passes through
+//
+// usage: microbench [-j <file>] [-t <ms>] [-l <label>] [filter]
+//   -j  also write the results as JSON to <file>, to diff between commits
+//   -t  minimum measuring time per run in milliseconds (default 200)
+//   -l  label stored in the JSON output, e.g. a commit id
+//   filter runs only the benchmarks whose name contains it
+//
+// sizes follow a game-traffic mix: 60% tiny (4-32 bytes), 30% medium (33-256)
+// and 10% large (257-1400) messages, drawn from a fixed seed so every run and
+// every commit measures the same work
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "delta_codec.hpp"
+#include "packet_pacer.hpp"
+#include "packet_packer.hpp"
+#include "packet_unpacker.hpp"
+#include "protocol_def.hpp"
+#include "raw_packet.hpp"
+#include "stream_codec.hpp"
+#include "udp_packet.hpp"
+#include "util.hpp"
+
+using namespace arelion;
+
+namespace {
+	constexpr uint32_t NUM_SAMPLES = 4096;
+	constexpr uint32_t NUM_RUNS = 5;
+
+	struct bench_result {
+		std::string name;
+
+		double ns_per_op;
+		double bytes_per_op;
+
+		uint64_t ops;
+	};
+
+	// an operation returns the number of bytes it processed
+	typedef std::function<uint64_t(uint32_t)> bench_func;
+
+	uint64_t g_sink = 0;
+
+
+	std::vector<uint32_t> make_sizes(uint32_t count, uint32_t max_size) {
+		std::mt19937 rng(1234);
+		std::vector<uint32_t> sizes(count);
+
+		for (uint32_t& size: sizes) {
+			const uint32_t bucket = rng() % 10;
+
+			if (bucket < 6) {
+				size = 4 + rng() % 29;
+			} else if (bucket < 9) {
+				size = 33 + rng() % 224;
+			} else {
+				size = 257 + rng() % 1144;
+			}
+
+			size = std::min(size, max_size);
+		}
+
+		return sizes;
+	}
+
+	// game state compresses somewhat: mostly small values with some noise
+	std::vector<uint8_t> make_payload(uint32_t size, uint32_t seed) {
+		std::mt19937 rng(seed);
+		std::vector<uint8_t> data(size);
+
+		for (uint8_t& byte: data)
+			byte = ((rng() % 4) == 0)? rng(): (rng() % 8);
+
+		return data;
+	}
+
+	// builds a protocol message of the given size whose id encodes its length type
+	std::vector<uint8_t> make_message(uint32_t size, uint32_t seed) {
+		std::vector<uint8_t> msg = make_payload(std::max(size, 4u), seed);
+
+		if (size == 8) {
+			msg[0] = 1;
+		} else if (size < 256) {
+			msg[0] = 2;
+			msg[1] = size;
+		} else {
+			msg[0] = 3;
+			msg[1] = size & 0xFF;
+			msg[2] = size >> 8;
+		}
+
+		return msg;
+	}
+
+	std::shared_ptr<udp_packet> make_datagram(const std::vector<uint32_t>& sizes, uint32_t& idx, int32_t& chunk_num) {
+		std::shared_ptr<udp_packet> pkt(new udp_packet(chunk_num - 10, -1));
+
+		for (uint32_t size = udp_packet::hdr_size(); ; ) {
+			const std::shared_ptr<udp_packet_chunk> chunk = udp_packet_chunk::create();
+			const std::shared_ptr<udp_chunk_payload> payload = udp_chunk_payload::create();
+			const std::vector<uint8_t> data = make_payload(std::min(sizes[idx++ % sizes.size()], udp_packet_chunk::max_size()), chunk_num);
+
+			chunk->chunk_number = chunk_num;
+			chunk->channel = (chunk_num % 5) << 2;
+			chunk->stream_seq = chunk_num;
+			chunk->chunk_size = data.size();
+			chunk->payload = payload;
+
+			std::memcpy(payload->data, data.data(), data.size());
+
+			if ((size += chunk->calc_size()) > 1400 && !pkt->chunks.empty())
+				break;
+
+			pkt->chunks.push_back(chunk);
+			chunk_num += 1;
+		}
+
+		return pkt;
+	}
+
+
+	bench_result run_bench(const char* name, uint32_t min_time_ms, const bench_func& func) {
+		const std::chrono::milliseconds min_time(min_time_ms);
+
+		std::vector<double> ns_per_ops;
+		uint64_t total_ops = 0;
+		double bytes_per_op = 0.0;
+
+		// warm up caches and lazily built tables
+		for (uint32_t i = 0; i < NUM_SAMPLES; ++i)
+			g_sink += func(i);
+
+		for (uint32_t run = 0; run < NUM_RUNS; ++run) {
+			const auto start_time = std::chrono::high_resolution_clock::now();
+			auto cur_time = start_time;
+
+			uint64_t ops = 0;
+			uint64_t bytes = 0;
+
+			// check the clock only every batch of operations
+			for (; (cur_time - start_time) < min_time; cur_time = std::chrono::high_resolution_clock::now()) {
+				for (uint32_t i = 0; i < 1024; ++i)
+					bytes += func(ops++);
+			}
+
+			ns_per_ops.push_back(std::chrono::duration<double, std::nano>(cur_time - start_time).count() / ops);
+			bytes_per_op = bytes * 1.0 / ops;
+			total_ops += ops;
+		}
+
+		std::sort(ns_per_ops.begin(), ns_per_ops.end());
+		return {name, ns_per_ops[NUM_RUNS / 2], bytes_per_op, total_ops};
+	}
+
+	void write_json(const char* file_name, const char* label, const std::vector<bench_result>& results) {
+		FILE* file = fopen(file_name, "w");
+
+		if (file == nullptr) {
+			fprintf(stderr, "[%s] failed to open \"%s\"\n", __func__, file_name);
+			return;
+		}
+
+		fprintf(file, "{\n\t\"label\": \"%s\",\n\t\"benchmarks\": [\n", label);
+
+		for (size_t i = 0; i < results.size(); ++i) {
+			const bench_result& r = results[i];
+
+			fprintf(
+				file,
+				"\t\t{\"name\": \"%s\", \"ns_per_op\": %.3f, \"bytes_per_op\": %.1f, \"mb_per_s\": %.3f, \"ops\": %" PRIu64 "}%s\n",
+				r.name.c_str(),
+				r.ns_per_op,
+				r.bytes_per_op,
+				r.bytes_per_op * 1e3 / r.ns_per_op,
+				r.ops,
+				((i + 1) < results.size())? ",": ""
+			);
+		}
+
+		fprintf(file, "\t]\n}\n");
+		fclose(file);
+	}
+}
+
+int main(int argc, char** argv) {
+	const char* json_file = nullptr;
+	const char* label = "";
+	const char* filter = "";
+
+	uint32_t min_time_ms = 200;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-j") == 0 && (i + 1) < argc) {
+			json_file = argv[++i];
+		} else if (strcmp(argv[i], "-t") == 0 && (i + 1) < argc) {
+			min_time_ms = std::max(atoi(argv[++i]), 1);
+		} else if (strcmp(argv[i], "-l") == 0 && (i + 1) < argc) {
+			label = argv[++i];
+		} else {
+			filter = argv[i];
+		}
+	}
+
+	proto_def.add_type(1, 8);
+	proto_def.add_type(2, -1);
+	proto_def.add_type(3, -2);
+
+	for (uint8_t id = 4; id < (4 + 32); ++id)
+		proto_def.add_delta_type(id, 32);
+
+	const std::vector<uint32_t> msg_sizes = make_sizes(NUM_SAMPLES, 1400);
+	const std::vector<uint32_t> chunk_sizes = make_sizes(NUM_SAMPLES, udp_packet_chunk::max_size());
+
+	std::vector< std::vector<uint8_t> > messages;
+	std::vector< std::shared_ptr<udp_packet> > datagrams;
+	std::vector< std::vector<uint8_t> > serialized;
+
+	for (uint32_t i = 0; i < NUM_SAMPLES; ++i)
+		messages.push_back(make_message(msg_sizes[i], i));
+
+	{
+		uint32_t idx = 0;
+		int32_t chunk_num = 0;
+
+		for (uint32_t i = 0; i < 256; ++i) {
+			datagrams.push_back(make_datagram(chunk_sizes, idx, chunk_num));
+			serialized.emplace_back();
+			datagrams.back()->serialize(serialized.back());
+		}
+	}
+
+	std::vector<uint8_t> buffer;
+	std::vector<bench_result> results;
+
+	util::crc32_t crc;
+	packet_pacer pacer;
+
+	stream_encoder stream_enc;
+	stream_decoder stream_dec;
+	delta_encoder delta_enc;
+
+	// driven by simulated time starting at the epoch
+	pacer.init(std::chrono::high_resolution_clock::time_point(), 64 * 1024, 4 * 1400);
+
+	const auto add_bench = [&](const char* name, const bench_func& func) {
+		if (std::strstr(name, filter) == nullptr)
+			return;
+
+		results.push_back(run_bench(name, min_time_ms, func));
+
+		const bench_result& r = results.back();
+		printf("%-28s %10.1f ns/op %10.1f bytes/op %10.1f MB/s\n", r.name.c_str(), r.ns_per_op, r.bytes_per_op, r.bytes_per_op * 1e3 / r.ns_per_op);
+	};
+
+
+	add_bench("crc32_update", [&](uint32_t i) {
+		const std::vector<uint8_t>& msg = messages[i % messages.size()];
+
+		crc.init_digest();
+		crc.update(msg.data(), msg.size());
+
+		g_sink += crc.get_digest();
+		return msg.size();
+	});
+
+	add_bench("udp_packet_checksum", [&](uint32_t i) {
+		const udp_packet& pkt = *datagrams[i % datagrams.size()];
+
+		g_sink += pkt.calc_checksum(crc);
+		return serialized[i % serialized.size()].size();
+	});
+
+	add_bench("udp_packet_serialize", [&](uint32_t i) {
+		datagrams[i % datagrams.size()]->serialize(buffer);
+		return buffer.size();
+	});
+
+	add_bench("udp_packet_parse", [&](uint32_t i) {
+		const std::vector<uint8_t>& data = serialized[i % serialized.size()];
+		const udp_packet pkt(data.data(), data.size());
+
+		g_sink += pkt.chunks.size();
+		return data.size();
+	});
+
+	add_bench("packet_packer", [&](uint32_t i) {
+		packet_packer packer(buffer);
+
+		buffer.clear();
+
+		for (uint32_t n = 0; n < 16; ++n) {
+			packer.pack(uint8_t(i));
+			packer.pack(uint16_t(n));
+			packer.pack(int32_t(i + n));
+			packer.pack(float(n));
+		}
+
+		return buffer.size();
+	});
+
+	add_bench("packet_unpacker", [&](uint32_t i) {
+		const std::vector<uint8_t>& data = serialized[i % serialized.size()];
+		packet_unpacker unpacker(data.data(), data.size());
+
+		for (uint32_t value = 0; unpacker.bytes_remaining() >= sizeof(value); ) {
+			unpacker.unpack(value);
+			g_sink += value;
+		}
+
+		return data.size();
+	});
+
+	add_bench("protocol_def_packet_length", [&](uint32_t i) {
+		const std::vector<uint8_t>& msg = messages[i % messages.size()];
+
+		g_sink += proto_def.packet_length(msg.data(), msg.size());
+		return msg.size();
+	});
+
+	add_bench("packet_pacer", [&](uint32_t i) {
+		// one datagram every 20us of simulated time, as during a resend burst
+		pacer.refill(std::chrono::high_resolution_clock::time_point(std::chrono::microseconds(i * 20)));
+
+		if (pacer.can_send())
+			pacer.consume(msg_sizes[i % msg_sizes.size()]);
+
+		g_sink += pacer.get_departure_time(1400).time_since_epoch().count();
+		return 0;
+	});
+
+	add_bench("raw_packet_alloc", [&](uint32_t i) {
+		const std::vector<uint8_t>& msg = messages[i % messages.size()];
+		const std::shared_ptr<const raw_packet> pkt(new raw_packet(msg.data(), msg.size()));
+
+		g_sink += pkt->data[0];
+		return msg.size();
+	});
+
+	add_bench("stream_codec_roundtrip", [&](uint32_t i) {
+		// a flush worth of messages per block
+		buffer.clear();
+
+		for (uint32_t n = 0; n < 8; ++n) {
+			const std::vector<uint8_t>& msg = messages[(i * 8 + n) % messages.size()];
+			buffer.insert(buffer.end(), msg.begin(), msg.end());
+		}
+
+		std::vector<uint8_t> encoded;
+		std::vector<uint8_t> decoded;
+
+		stream_enc.encode_block(buffer.data(), buffer.size(), true, encoded);
+		stream_dec.feed(encoded.data(), encoded.size());
+		stream_dec.decode(decoded);
+
+		g_sink += decoded.size();
+		return buffer.size();
+	});
+
+	add_bench("delta_codec_encode", [&](uint32_t i) {
+		// fixed-size state updates of a few dozen objects
+		uint8_t state[32];
+
+		std::memcpy(state, messages[i % messages.size()].data(), std::min(sizeof(state), messages[i % messages.size()].size()));
+		state[0] = 4 + (i % 32);
+
+		buffer.clear();
+		delta_enc.encode_record(state, sizeof(state), buffer);
+		return sizeof(state);
+	});
+
+
+	printf("# sink %" PRIu64 "\n", g_sink);
+
+	if (json_file != nullptr)
+		write_json(json_file, label, results);
+
+	return 0;
+}
+
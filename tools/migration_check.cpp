@@ -0,0 +1,338 @@
+// migration check: two addresses race to take over an accepted connection
+//
+// usage: migration_check [-p <port>]
+//   -p  listener port (default 8463, the relay takes the next one and a
+//       second listener the one after)
+//
+// a client reaches the listener through a relay on loopback that switches to
+// a new upstream port midway, like a NAT rebinding; right after, an on-path
+// sender on 127.0.0.2 starts replaying a datagram it saw earlier, every tick
+// until the end. whichever address is probed first, the connection must move
+// to the relay's new port exactly once, the replaying address must not get
+// more than one probe's worth of challenges before it has, and every message
+// the client sent must arrive in order.
+//
+// then two accepted connections collide on one address: one is moved onto
+// the other's with reconnect_to, and datagrams keep arriving with the id of
+// the one it displaced. that one must lose its id along with its place in the
+// listener, so once its owner lets go it is destroyed (and nothing uses it
+// afterwards) and a newly accepted connection reuses its slot. exits with 1
+// otherwise
+
+#include <asio.hpp>
+
+#include <chrono>
+#include <cinttypes>
+#include <functional>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "config.hpp"
+#include "protocol_def.hpp"
+#include "raw_packet.hpp"
+#include "socket_helper.hpp"
+#include "udp_connection.hpp"
+#include "udp_listener.hpp"
+#include "udp_packet.hpp"
+#include "util.hpp"
+
+using namespace arelion;
+
+namespace {
+	constexpr uint8_t MSG_SEQ = 1;
+
+	constexpr uint32_t NUM_TICKS = 3000;
+	constexpr uint32_t REBIND_TICK = 500;
+	constexpr uint32_t REPLAY_TICK = REBIND_TICK + 5;
+
+	// forwards between the client and the listener, from an upstream port that can change
+	struct relay {
+	public:
+		relay(uint16_t port, const asio::ip::udp::endpoint& server_)
+			: down(netservice, asio::ip::udp::endpoint(asio::ip::address::from_string("127.0.0.1"), port))
+			, server(server_)
+		{
+			rebind();
+		}
+
+		void rebind() {
+			up.reset(new asio::ip::udp::socket(netservice, asio::ip::udp::endpoint(asio::ip::address::from_string("127.0.0.1"), 0)));
+		}
+
+		void pump() {
+			asio::ip::udp::endpoint from;
+			asio::error_code error_code;
+
+			while (down.available() > 0) {
+				const size_t size = down.receive_from(asio::buffer(buffer), client, 0, error_code);
+
+				last_upstream.assign(buffer, buffer + size);
+				up->send_to(asio::buffer(buffer, size), server, 0, error_code);
+			}
+
+			while (up->available() > 0) {
+				const size_t size = up->receive_from(asio::buffer(buffer), from, 0, error_code);
+				down.send_to(asio::buffer(buffer, size), client, 0, error_code);
+			}
+		}
+
+	public:
+		asio::ip::udp::socket down;
+		std::unique_ptr<asio::ip::udp::socket> up;
+
+		asio::ip::udp::endpoint server;
+		asio::ip::udp::endpoint client;
+
+		std::vector<uint8_t> last_upstream;
+
+		uint8_t buffer[8192];
+	};
+
+	std::shared_ptr<raw_packet> make_message(uint32_t seq) {
+		const std::shared_ptr<raw_packet> msg(new raw_packet(8));
+
+		std::memset(msg->data, 0, 8);
+		msg->data[0] = MSG_SEQ;
+		std::memcpy(msg->data + 1, &seq, sizeof(seq));
+		return msg;
+	}
+
+	// ticks the listener and <clients> (each sending a message) <num_ticks> times,
+	// accepting whatever connects into <accepted>; <forged> runs every tick
+	void run_ticks(udp_listener& listener, std::vector< std::shared_ptr<udp_connection> >& clients, std::vector< std::shared_ptr<udp_connection> >& accepted, uint32_t num_ticks, const std::function<void()>& forged = nullptr) {
+		for (uint32_t tick = 0; tick < num_ticks; ++tick) {
+			if (forged != nullptr)
+				forged();
+
+			for (const std::shared_ptr<udp_connection>& client: clients) {
+				client->send_data(make_message(tick));
+				client->update();
+			}
+
+			for (const std::shared_ptr<udp_connection>& conn: accepted) {
+				if (conn != nullptr)
+					conn->send_data(make_message(tick));
+			}
+
+			listener.update();
+
+			while (listener.has_incoming_connections()) {
+				accepted.push_back(listener.accept_connection());
+				accepted.back()->unmute();
+			}
+
+			for (const std::shared_ptr<udp_connection>& conn: accepted) {
+				while (conn != nullptr && conn->get_data() != nullptr) {
+				}
+			}
+			for (const std::shared_ptr<udp_connection>& client: clients) {
+				while (client->get_data() != nullptr) {
+				}
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+	}
+
+	bool check_collision(uint16_t port) {
+		udp_listener listener(port, "127.0.0.1");
+
+		std::vector< std::shared_ptr<udp_connection> > clients;
+		std::vector< std::shared_ptr<udp_connection> > accepted;
+
+		for (uint32_t n = 0; n < 2; ++n) {
+			clients.emplace_back(new udp_connection(0, port, "127.0.0.1"));
+			clients.back()->unmute();
+		}
+
+		run_ticks(listener, clients, accepted, 300);
+
+		if (accepted.size() != 2) {
+			fprintf(stderr, "[%s] %zu of 2 connections accepted\n", __func__, accepted.size());
+			return false;
+		}
+
+		const std::weak_ptr<udp_connection> displaced = accepted[1];
+		const uint32_t displaced_id = accepted[1]->get_conn_id();
+
+		// its client would now talk to the other connection, which only trips
+		// over acks for chunks it never sent
+		clients.erase(clients.begin() + 1);
+
+		accepted[0]->reconnect_to(*accepted[1]);
+		listener.update_connections();
+		accepted[1].reset();
+
+		asio::ip::udp::socket forger(netservice, asio::ip::udp::endpoint(asio::ip::address::from_string("127.0.0.2"), 0));
+		const asio::ip::udp::endpoint listener_address(asio::ip::address::from_string("127.0.0.1"), port);
+
+		std::vector<uint8_t> forged_datagram;
+		util::crc32_t crc;
+		udp_packet forged_pkt(-1, 0);
+
+		forged_pkt.conn_id = displaced_id;
+		forged_pkt.checksum = forged_pkt.calc_checksum(crc);
+		forged_pkt.serialize(forged_datagram);
+
+		run_ticks(listener, clients, accepted, 200, [&]() {
+			asio::error_code error_code;
+			forger.send_to(asio::buffer(forged_datagram), listener_address, 0, error_code);
+		});
+
+		clients.emplace_back(new udp_connection(0, port, "127.0.0.1"));
+		clients.back()->unmute();
+		run_ticks(listener, clients, accepted, 300);
+
+		const bool destroyed = displaced.expired();
+		const bool reused = (accepted.size() == 3 && (accepted[2]->get_conn_id() & 0xffff) == (displaced_id & 0xffff));
+
+		printf("colliding connections: displaced one %s, its slot %s\n", destroyed? "destroyed": "still alive", reused? "reused": "not reused");
+		return (destroyed && reused);
+	}
+
+	bool parse_args(int argc, char** argv, uint16_t& port) {
+		for (int i = 1; i < argc; ++i) {
+			if ((i + 1) >= argc)
+				return false;
+
+			if (std::strcmp(argv[i], "-p") == 0) {
+				port = atoi(argv[++i]);
+				continue;
+			}
+
+			return false;
+		}
+
+		return true;
+	}
+}
+
+int main(int argc, char** argv) {
+	uint16_t port = 8463;
+
+	if (!parse_args(argc, argv, port)) {
+		fprintf(stderr, "usage: %s [-p <port>]\n", argv[0]);
+		return 1;
+	}
+
+	proto_def.add_type(MSG_SEQ, 8);
+
+	const asio::ip::udp::endpoint server_address(asio::ip::address::from_string("127.0.0.1"), port);
+
+	udp_listener listener(port, "127.0.0.1");
+	relay nat(port + 1, server_address);
+	// its own address, so the replays do not eat the relay's source rate limit
+	asio::ip::udp::socket replayer(netservice, asio::ip::udp::endpoint(asio::ip::address::from_string("127.0.0.2"), 0));
+
+	udp_connection client(0, port + 1, "127.0.0.1");
+	std::shared_ptr<udp_connection> server;
+
+	std::vector<uint8_t> replay;
+	uint8_t buffer[8192];
+
+	uint32_t msgs_sent = 0;
+	uint32_t msgs_recvd = 0;
+	uint32_t msgs_unordered = 0;
+	uint32_t challenges_seen = 0;
+
+	bool moved = false;
+
+	client.unmute();
+
+	for (uint32_t tick = 0; tick < NUM_TICKS; ++tick) {
+		if (tick == REBIND_TICK) {
+			replay = nat.last_upstream;
+			nat.rebind();
+		}
+
+		if (tick >= REPLAY_TICK && !replay.empty()) {
+			asio::error_code error_code;
+			replayer.send_to(asio::buffer(replay), server_address, 0, error_code);
+		}
+
+		while (replayer.available() > 0) {
+			asio::ip::udp::endpoint from;
+			asio::error_code error_code;
+
+			replayer.receive_from(asio::buffer(buffer), from, 0, error_code);
+
+			// once moved, the replays come from just another new address
+			challenges_seen += (!moved);
+		}
+
+		// stop sending well before the end so everything can be delivered
+		if (tick < (NUM_TICKS - 500)) {
+			const std::shared_ptr<raw_packet> msg(new raw_packet(8));
+
+			std::memset(msg->data, 0, 8);
+			msg->data[0] = MSG_SEQ;
+			std::memcpy(msg->data + 1, &msgs_sent, sizeof(msgs_sent));
+
+			client.send_data(msg);
+			msgs_sent += 1;
+		}
+
+		// a connection that never sends takes acks-only datagrams for reconnects
+		if (server != nullptr) {
+			const std::shared_ptr<raw_packet> msg(new raw_packet(8));
+
+			std::memset(msg->data, 0, 8);
+			msg->data[0] = MSG_SEQ;
+			server->send_data(msg);
+		}
+
+		client.update();
+		nat.pump();
+		listener.update();
+
+		if (server == nullptr && listener.has_incoming_connections()) {
+			server = listener.accept_connection();
+			server->unmute();
+		}
+
+		if (server != nullptr && tick >= REBIND_TICK && !moved) {
+			asio::error_code error_code;
+			moved = (server->get_endpoint() == nat.up->local_endpoint(error_code));
+		}
+
+		while (client.get_data() != nullptr) {
+		}
+
+		while (server != nullptr && server->has_incoming_data()) {
+			const std::shared_ptr<const raw_packet> msg = server->get_data();
+
+			uint32_t seq = 0;
+			std::memcpy(&seq, msg->data + 1, sizeof(seq));
+
+			msgs_unordered += (seq != msgs_recvd);
+			msgs_recvd = seq + 1;
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	if (server == nullptr) {
+		fprintf(stderr, "[%s] no connection after %u ticks\n", __func__, NUM_TICKS);
+		return 1;
+	}
+
+	asio::error_code error_code;
+
+	const listener_metrics& metrics = listener.get_metrics();
+	const uint64_t num_migrations = metrics.migrated_connections.get();
+
+	moved = (server->get_endpoint() == nat.up->local_endpoint(error_code));
+
+	printf("%u messages sent and %u received (%u out of order), %" PRIu64 " migrations, %s, %u challenges to the replaying address before that\n", msgs_sent, msgs_recvd, msgs_unordered, num_migrations, moved? "moved to the relay's new port": "not on the relay's new port", challenges_seen);
+
+	if (msgs_recvd != msgs_sent || msgs_unordered != 0 || num_migrations != 1 || !moved || challenges_seen > config::path_probe_attempts)
+		return 1;
+	if (!check_collision(port + 2))
+		return 1;
+
+	return 0;
+}
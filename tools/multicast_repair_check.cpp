@@ -0,0 +1,301 @@
+// multicast repair check: a member that keeps naking the same chunks gets
+// each of them repaired once
+//
+// usage: multicast_repair_check [-p <port>]
+//   -p  listener port (default 8473, the proxy takes the next one and the
+//       groups the two after it)
+//
+// a listener sends ordered messages to a multicast group on loopback, one per
+// tick; its only member receives them through a relay that re-sends the group
+// to a second group address and drops everything during a few ticks. the
+// member's unicast traffic goes through a proxy that holds the listener's
+// side back for longer than the member waits between naks, so every loss is
+// naked at least twice before its repair arrives. each dropped chunk must be
+// repaired, no chunk more than once (the stalled progress also has chunks
+// past the gap repaired as possible tail losses), and every message must
+// arrive in order. needs multicast on the loopback interface; exits with 1 otherwise
+
+#include <asio.hpp>
+#include <asio/ip/multicast.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <set>
+#include <thread>
+#include <vector>
+
+#include "protocol_def.hpp"
+#include "raw_packet.hpp"
+#include "socket_helper.hpp"
+#include "udp_connection.hpp"
+#include "udp_listener.hpp"
+#include "udp_multicast.hpp"
+#include "udp_packet.hpp"
+
+using namespace arelion;
+
+namespace {
+	constexpr uint8_t MSG_SEQ = 1;
+	constexpr uint8_t GROUP_STREAM = 15;
+
+	constexpr uint32_t NUM_TICKS = 3000;
+	constexpr uint32_t SEND_TICKS = 1500;
+	constexpr uint32_t DROP_TICK = 600;
+	constexpr uint32_t DROP_TICKS = 20;
+
+	// longer than a member waits between naks (half its unacked resend time)
+	constexpr int32_t PROXY_DELAY_MS = 300;
+
+	const char* const GROUP_ADDRESS = "239.255.0.41";
+	const char* const RELAY_ADDRESS = "239.255.0.42";
+
+	asio::ip::address_v4 loopback_v4() { return asio::ip::address_v4::from_string("127.0.0.1"); }
+
+	// re-sends the group to another group address, minus what arrives while dropping
+	struct group_relay {
+	public:
+		group_relay(uint16_t port)
+			: in(netservice)
+			, out(netservice)
+			, target(asio::ip::address::from_string(RELAY_ADDRESS), port + 1)
+		{
+			in.open(asio::ip::udp::v4());
+			in.set_option(asio::ip::udp::socket::reuse_address(true));
+			in.bind(asio::ip::udp::endpoint(asio::ip::address::from_string(GROUP_ADDRESS), port));
+			in.set_option(asio::ip::multicast::join_group(asio::ip::address_v4::from_string(GROUP_ADDRESS), loopback_v4()));
+
+			out.open(asio::ip::udp::v4());
+			out.set_option(asio::ip::multicast::outbound_interface(loopback_v4()));
+		}
+
+		void pump(bool dropping) {
+			asio::ip::udp::endpoint from;
+			asio::error_code error_code;
+
+			while (in.available() > 0) {
+				const size_t size = in.receive_from(asio::buffer(buffer), from, 0, error_code);
+
+				if (!dropping) {
+					out.send_to(asio::buffer(buffer, size), target, 0, error_code);
+					continue;
+				}
+
+				const udp_packet pkt(buffer, size);
+
+				for (const std::shared_ptr<udp_packet_chunk>& chunk: pkt.chunks) {
+					dropped_chunks.insert(chunk->chunk_number);
+				}
+			}
+		}
+
+	public:
+		asio::ip::udp::socket in;
+		asio::ip::udp::socket out;
+		asio::ip::udp::endpoint target;
+
+		std::set<int32_t> dropped_chunks;
+
+		uint8_t buffer[8192];
+	};
+
+	// forwards unicast between the member and the listener, holding back the
+	// listener's side and counting the group chunks it carries
+	struct delay_proxy {
+	public:
+		struct held_datagram {
+			std::chrono::steady_clock::time_point time;
+			std::vector<uint8_t> data;
+		};
+
+		delay_proxy(uint16_t port, const asio::ip::udp::endpoint& server_)
+			: socket(netservice, asio::ip::udp::endpoint(asio::ip::address::from_string("127.0.0.1"), port))
+			, server(server_)
+		{
+		}
+
+		void pump() {
+			const std::chrono::steady_clock::time_point cur_time = std::chrono::steady_clock::now();
+
+			asio::ip::udp::endpoint from;
+			asio::error_code error_code;
+
+			while (socket.available() > 0) {
+				const size_t size = socket.receive_from(asio::buffer(buffer), from, 0, error_code);
+
+				if (from != server) {
+					client = from;
+					socket.send_to(asio::buffer(buffer, size), server, 0, error_code);
+					continue;
+				}
+
+				const udp_packet pkt(buffer, size);
+
+				for (const std::shared_ptr<udp_packet_chunk>& chunk: pkt.chunks) {
+					if (chunk->is_multicast())
+						repairs[chunk->chunk_number] += 1;
+				}
+
+				held.push_back({cur_time + std::chrono::milliseconds(PROXY_DELAY_MS), std::vector<uint8_t>(buffer, buffer + size)});
+			}
+
+			while (!held.empty() && held.front().time <= cur_time) {
+				socket.send_to(asio::buffer(held.front().data), client, 0, error_code);
+				held.pop_front();
+			}
+		}
+
+	public:
+		asio::ip::udp::socket socket;
+		asio::ip::udp::endpoint server;
+		asio::ip::udp::endpoint client;
+
+		std::deque<held_datagram> held;
+		// group chunk number to repairs seen
+		std::map<int32_t, uint32_t> repairs;
+
+		uint8_t buffer[8192];
+	};
+
+	std::shared_ptr<raw_packet> make_message(uint32_t seq) {
+		const std::shared_ptr<raw_packet> msg(new raw_packet(8));
+
+		std::memset(msg->data, 0, 8);
+		msg->data[0] = MSG_SEQ;
+		std::memcpy(msg->data + 1, &seq, sizeof(seq));
+		return msg;
+	}
+
+	bool parse_args(int argc, char** argv, uint16_t& port) {
+		for (int i = 1; i < argc; ++i) {
+			if ((i + 1) >= argc)
+				return false;
+
+			if (std::strcmp(argv[i], "-p") == 0) {
+				port = atoi(argv[++i]);
+				continue;
+			}
+
+			return false;
+		}
+
+		return true;
+	}
+}
+
+int main(int argc, char** argv) {
+	uint16_t port = 8473;
+
+	if (!parse_args(argc, argv, port)) {
+		fprintf(stderr, "usage: %s [-p <port>]\n", argv[0]);
+		return 1;
+	}
+
+	proto_def.add_type(MSG_SEQ, 8);
+
+	udp_listener listener(port, "127.0.0.1");
+	udp_multicast_group group(GROUP_ADDRESS, port + 2, GROUP_STREAM, "127.0.0.1");
+
+	group_relay relay(port + 2);
+	delay_proxy proxy(port + 1, asio::ip::udp::endpoint(asio::ip::address::from_string("127.0.0.1"), port));
+
+	udp_connection client(0, port + 1, "127.0.0.1");
+	std::shared_ptr<udp_connection> server;
+
+	if (!client.join_multicast(RELAY_ADDRESS, port + 3, GROUP_STREAM, "127.0.0.1")) {
+		fprintf(stderr, "[%s] failed to join %s:%u\n", __func__, RELAY_ADDRESS, port + 3);
+		return 1;
+	}
+
+	client.unmute();
+
+	uint32_t msgs_sent = 0;
+	uint32_t msgs_recvd = 0;
+	uint32_t msgs_unordered = 0;
+
+	int32_t first_seq = -1;
+
+	for (uint32_t tick = 0; tick < NUM_TICKS; ++tick) {
+		// a connection that never sends takes acks-only datagrams for reconnects
+		client.send_data(make_message(tick));
+
+		if (server != nullptr) {
+			server->send_data(make_message(tick));
+
+			if (msgs_sent < SEND_TICKS)
+				group.send_data(make_message(msgs_sent++));
+		}
+
+		group.flush();
+		group.update();
+
+		client.update();
+		relay.pump(tick >= DROP_TICK && tick < (DROP_TICK + DROP_TICKS));
+		proxy.pump();
+		listener.update();
+
+		if (server == nullptr && listener.has_incoming_connections()) {
+			server = listener.accept_connection();
+			server->unmute();
+
+			group.add_connection(server);
+		}
+
+		while (server != nullptr && server->get_data() != nullptr) {
+		}
+		while (client.get_data() != nullptr) {
+		}
+
+		while (client.has_incoming_data(GROUP_STREAM)) {
+			const std::shared_ptr<const raw_packet> msg = client.get_data(GROUP_STREAM);
+
+			int32_t seq = 0;
+			std::memcpy(&seq, msg->data + 1, sizeof(seq));
+
+			// joined wherever the group was when the member was added
+			if (first_seq < 0)
+				first_seq = seq;
+
+			msgs_unordered += (seq != (first_seq + int32_t(msgs_recvd)));
+			msgs_recvd += 1;
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+
+	if (server == nullptr) {
+		fprintf(stderr, "[%s] no connection after %u ticks\n", __func__, NUM_TICKS);
+		return 1;
+	}
+
+	uint32_t num_repairs = 0;
+	uint32_t num_repeated = 0;
+	uint32_t num_unrepaired = 0;
+	uint32_t num_undropped = 0;
+
+	for (const std::pair<const int32_t, uint32_t>& repair: proxy.repairs) {
+		num_repairs += repair.second;
+		num_repeated += (repair.second > 1);
+		num_undropped += (relay.dropped_chunks.count(repair.first) == 0);
+	}
+
+	for (const int32_t chunk_num: relay.dropped_chunks) {
+		num_unrepaired += (proxy.repairs.count(chunk_num) == 0);
+	}
+
+	const uint32_t msgs_expected = msgs_sent - std::max(first_seq, 0);
+
+	printf("%u of %u group messages received (%u out of order), %zu chunks dropped, %u repairs: %u chunks repeated, %u missing, %u not dropped\n", msgs_recvd, msgs_expected, msgs_unordered, relay.dropped_chunks.size(), num_repairs, num_repeated, num_unrepaired, num_undropped);
+
+	if (first_seq < 0 || msgs_recvd != msgs_expected || msgs_unordered != 0 || relay.dropped_chunks.empty())
+		return 1;
+	if (num_repeated != 0 || num_unrepaired != 0)
+		return 1;
+
+	return 0;
+}
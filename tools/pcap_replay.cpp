@@ -0,0 +1,238 @@
+// decodes captures written by udp_listener::start_capture (or any pcap of the
+// protocol), and replays them through udp_connection without sockets
+//
+// usage: pcap_replay [-d <defs>] [-r] [-p] [-q] <capture>
+//   -d  protocol definitions, one "<id> <length> [delta] [name]" per line where
+//       a length of -1 (-2) means the size follows the id as uint8 (uint16)
+//   -r  feed every flow into its own udp_connection and print the messages
+//       it reassembles (requires -d), instead of the datagrams and chunks;
+//       the summary then also breaks the traffic down by message id
+//   -p  replay at the recorded pace instead of as fast as possible
+//   -q  print only the summary, for benchmarking the receive path
+
+#include <asio.hpp>
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+
+#include "pcap_file.hpp"
+#include "protocol_def.hpp"
+#include "udp_connection.hpp"
+#include "udp_packet.hpp"
+#include "util.hpp"
+
+using namespace arelion;
+
+typedef std::pair<asio::ip::udp::endpoint, asio::ip::udp::endpoint> flow_key;
+
+static bool load_protocol_defs(const char* file_name) {
+	FILE* file = fopen(file_name, "r");
+
+	if (file == nullptr) {
+		fprintf(stderr, "[%s] failed to open \"%s\"\n", __func__, file_name);
+		return false;
+	}
+
+	char line[256];
+
+	while (fgets(line, sizeof(line), file) != nullptr) {
+		int32_t id = 0;
+		int32_t length = 0;
+		char words[2][32] = {{0}, {0}};
+
+		if (line[0] == '#' || sscanf(line, "%d %d %31s %31s", &id, &length, words[0], words[1]) < 2)
+			continue;
+
+		if (strcmp(words[0], "delta") == 0) {
+			proto_def.add_delta_type(id, length, words[1]);
+		} else {
+			proto_def.add_type(id, length, words[0]);
+		}
+	}
+
+	fclose(file);
+	return true;
+}
+
+static std::string format_flow(const pcap_datagram& datagram) {
+	std::ostringstream stream;
+	stream << datagram.src << " > " << datagram.dst;
+	return stream.str();
+}
+
+static void print_datagram(const pcap_datagram& datagram, int64_t start_time) {
+	static const char* delivery_names[] = {"ordered", "unordered", "sequenced", "unreliable"};
+	static util::crc32_t crc;
+
+	if (datagram.data.size() < udp_packet::hdr_size()) {
+		printf("%12.3f %s: %u bytes, too short\n", (datagram.time - start_time) * 1e-3, format_flow(datagram).c_str(), uint32_t(datagram.data.size()));
+		return;
+	}
+	if (!udp_packet::has_valid_header(&datagram.data[0], datagram.data.size())) {
+		printf("%12.3f %s: %u bytes, protocol version %u\n", (datagram.time - start_time) * 1e-3, format_flow(datagram).c_str(), uint32_t(datagram.data.size()), datagram.data[0]);
+		return;
+	}
+
+	const udp_packet pkt(&datagram.data[0], datagram.data.size());
+
+	printf(
+		"%12.3f %s: %u bytes, conn_id %08x, last_continuous %d, nak_type %d, flags 0x%02x%s\n",
+		(datagram.time - start_time) * 1e-3,
+		format_flow(datagram).c_str(),
+		uint32_t(datagram.data.size()),
+		pkt.conn_id,
+		pkt.last_continuous,
+		pkt.nak_type,
+		pkt.flags,
+		(pkt.calc_checksum(crc) != pkt.checksum)? ", bad checksum": ""
+	);
+
+	for (const uint8_t nak: pkt.naks) {
+		printf("\t\tnak %d\n", pkt.last_continuous + 1 + nak);
+	}
+
+	for (const std::shared_ptr<udp_packet_chunk>& chunk: pkt.chunks) {
+		printf("\t\tchunk %d, %s, stream %u", chunk->chunk_number, delivery_names[chunk->get_delivery()], chunk->get_stream());
+
+		if (chunk->has_sequence())
+			printf(", seq %u", chunk->stream_seq);
+
+		printf(", %u bytes\n", uint32_t(chunk->chunk_size));
+	}
+}
+
+int main(int argc, char** argv) {
+	const char* defs_file = nullptr;
+	const char* pcap_file = nullptr;
+
+	bool replay = false;
+	bool paced = false;
+	bool quiet = false;
+
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-d") == 0 && (i + 1) < argc) {
+			defs_file = argv[++i];
+		} else if (strcmp(argv[i], "-r") == 0) {
+			replay = true;
+		} else if (strcmp(argv[i], "-p") == 0) {
+			paced = true;
+		} else if (strcmp(argv[i], "-q") == 0) {
+			quiet = true;
+		} else {
+			pcap_file = argv[i];
+		}
+	}
+
+	if (pcap_file == nullptr || (replay && defs_file == nullptr)) {
+		fprintf(stderr, "usage: %s [-d <defs>] [-r] [-p] [-q] <capture>\n", argv[0]);
+		return 1;
+	}
+
+	if (defs_file != nullptr && !load_protocol_defs(defs_file))
+		return 1;
+
+	pcap_reader reader;
+	pcap_datagram datagram;
+
+	if (!reader.open(pcap_file))
+		return 1;
+
+	// receiving end of every flow, never unmuted so nothing is ever sent
+	std::map< flow_key, std::shared_ptr<udp_connection> > flows;
+
+	uint64_t num_datagrams = 0;
+	uint64_t num_bytes = 0;
+	uint64_t num_messages = 0;
+
+	int64_t start_time = -1;
+
+	const net_time_point replay_start_time = std::chrono::high_resolution_clock::now();
+
+	while (reader.read(datagram)) {
+		if (start_time < 0)
+			start_time = datagram.time;
+
+		if (paced)
+			util::sleep_until(replay_start_time + std::chrono::microseconds(datagram.time - start_time));
+
+		num_datagrams += 1;
+		num_bytes += datagram.data.size();
+
+		if (!replay) {
+			if (!quiet)
+				print_datagram(datagram, start_time);
+
+			continue;
+		}
+
+		if (!udp_packet::has_valid_header(datagram.data.data(), datagram.data.size()))
+			continue;
+
+		std::shared_ptr<udp_connection>& conn = flows[flow_key(datagram.src, datagram.dst)];
+
+		if (conn == nullptr) {
+			conn.reset(new udp_connection(std::shared_ptr<asio::ip::udp::socket>(), datagram.src));
+			conn->enable_traffic_stats();
+		}
+
+		udp_packet pkt(&datagram.data[0], datagram.data.size());
+		conn->process_raw_packet(pkt);
+
+		for (uint8_t stream = 0; stream < base_connection::MAX_STREAMS; ++stream) {
+			for (std::shared_ptr<const raw_packet> msg = conn->get_data(stream); msg != nullptr; msg = conn->get_data(stream)) {
+				num_messages += 1;
+
+				if (quiet)
+					continue;
+
+				printf("%12.3f %s: stream %u, id %u, %u bytes\n", (datagram.time - start_time) * 1e-3, format_flow(datagram).c_str(), stream, msg->data[0], msg->length);
+			}
+		}
+	}
+
+	const std::chrono::duration<double> replay_time = std::chrono::high_resolution_clock::now() - replay_start_time;
+
+	printf("# %" PRIu64 " datagrams, %" PRIu64 " bytes", num_datagrams, num_bytes);
+
+	if (replay)
+		printf(", %" PRIu64 " messages in %u flows", num_messages, uint32_t(flows.size()));
+
+	printf(" in %.3fs (%.0f datagrams/s, %.3f MB/s)\n", replay_time.count(), num_datagrams / replay_time.count(), num_bytes / replay_time.count() * 1e-6);
+
+	if (!replay)
+		return 0;
+
+	// flows only receive, so everything shows up as received by the flow's destination
+	printf("# %3s %-16s %10s %12s %8s\n", "id", "name", "msgs", "bytes", "share");
+
+	uint64_t id_msgs[256] = {0};
+	uint64_t id_bytes[256] = {0};
+	uint64_t total_bytes = 0;
+
+	for (const auto& pair: flows) {
+		const message_traffic_stats* stats = pair.second->get_traffic_stats();
+
+		for (uint32_t id = 0; id < 256; ++id) {
+			id_msgs[id] += stats->ids[id].recv_msgs.get();
+			id_bytes[id] += stats->ids[id].recv_bytes.get();
+			total_bytes += stats->ids[id].recv_bytes.get();
+		}
+	}
+
+	for (uint32_t id = 0; id < 256; ++id) {
+		if (id_msgs[id] == 0)
+			continue;
+
+		printf("  %3u %-16s %10" PRIu64 " %12" PRIu64 " %7.2f%%\n", id, proto_def.get_type_name(id), id_msgs[id], id_bytes[id], id_bytes[id] * 100.0 / total_bytes);
+	}
+
+	return 0;
+}
+
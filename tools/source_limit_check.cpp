@@ -0,0 +1,254 @@
+// source limit check: per-source datagram budgets hold at their thresholds
+//
+// usage: source_limit_check [-p <port>]
+//   -p  listener port (default 8493)
+//
+// first the limiter on its own, with a simulated clock: a source passes
+// exactly its burst at once, then its rate (to within a datagram of rounding)
+// and never more than its burst however long it was idle; every port of an
+// address shares that budget, a thousand other addresses still pass while
+// one is exhausted, and a zero rate disables limiting.
+//
+// then a listener on loopback is flooded from 127.0.0.2 with datagrams that
+// each ask for a cookie, while a client on 127.0.0.1 connects and sends a
+// message every tick. the flood may get no more cookies than the configured
+// burst plus rate over its duration, everything past that has to be counted
+// as limited, and the client must be accepted with every message arriving in
+// order. exits with 1 otherwise
+
+#include <asio.hpp>
+
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "config.hpp"
+#include "protocol_def.hpp"
+#include "raw_packet.hpp"
+#include "socket_helper.hpp"
+#include "source_limiter.hpp"
+#include "udp_connection.hpp"
+#include "udp_listener.hpp"
+#include "udp_packet.hpp"
+#include "util.hpp"
+
+using namespace arelion;
+
+namespace {
+	constexpr uint8_t MSG_SEQ = 1;
+
+	constexpr uint32_t NUM_TICKS = 2000;
+	constexpr uint32_t FLOOD_TICKS = 1000;
+	constexpr uint32_t FLOOD_DATAGRAMS = 20;
+	constexpr uint32_t FLOOD_DRAIN_TICKS = 10;
+
+	constexpr int32_t RATE = 100;
+	constexpr int32_t BURST = 50;
+
+	std::shared_ptr<raw_packet> make_message(uint32_t seq) {
+		const std::shared_ptr<raw_packet> msg(new raw_packet(8));
+
+		std::memset(msg->data, 0, 8);
+		msg->data[0] = MSG_SEQ;
+		std::memcpy(msg->data + 1, &seq, sizeof(seq));
+		return msg;
+	}
+
+	asio::ip::udp::endpoint make_endpoint(const char* address, uint16_t port) {
+		return asio::ip::udp::endpoint(asio::ip::address::from_string(address), port);
+	}
+
+	// datagrams passed by <limiter> out of <count> from <address> at <t>
+	uint32_t consume_n(source_limiter& limiter, const asio::ip::udp::endpoint& address, source_limiter::time_point t, uint32_t count) {
+		uint32_t passed = 0;
+
+		for (uint32_t n = 0; n < count; ++n) {
+			passed += limiter.consume(address, t);
+		}
+
+		return passed;
+	}
+
+	bool check_thresholds() {
+		source_limiter limiter;
+		limiter.set_rate(RATE, BURST);
+
+		const source_limiter::time_point t0 = std::chrono::high_resolution_clock::now();
+		const asio::ip::udp::endpoint source = make_endpoint("10.0.0.1", 1000);
+
+		const uint32_t burst = consume_n(limiter, source, t0, BURST * 2);
+		const uint32_t after_200ms = consume_n(limiter, source, t0 + std::chrono::milliseconds(200), BURST * 2);
+		// other ports of the same address draw from the same (empty) buckets
+		const uint32_t other_port = consume_n(limiter, make_endpoint("10.0.0.1", 2000), t0 + std::chrono::milliseconds(200), 1);
+
+		uint32_t others_passed = 0;
+
+		for (uint32_t n = 0; n < 1000; ++n) {
+			const std::string address = "10.1." + std::to_string(n / 250) + "." + std::to_string(n % 250 + 1);
+			others_passed += consume_n(limiter, make_endpoint(address.c_str(), 1000), t0 + std::chrono::milliseconds(200), 1);
+		}
+
+		// a long idle period refills no more than the burst
+		const uint32_t after_idle = consume_n(limiter, source, t0 + std::chrono::seconds(60), BURST * 2);
+
+		limiter.set_rate(0, BURST);
+
+		const uint32_t disabled = consume_n(limiter, source, t0 + std::chrono::seconds(60), BURST * 2);
+
+		printf("limiter: %u passed at once, %u 200ms later, %u from another port, %u of 1000 other addresses, %u after a minute idle, %u of %u with no rate\n", burst, after_200ms, other_port, others_passed, after_idle, disabled, BURST * 2);
+
+		if (burst != BURST || after_200ms > uint32_t(RATE / 5) || (after_200ms + 1) < uint32_t(RATE / 5) || other_port != 0)
+			return false;
+		if (others_passed != 1000 || after_idle != BURST || disabled != (BURST * 2))
+			return false;
+
+		return true;
+	}
+
+	bool check_flood(uint16_t port) {
+		udp_listener listener(port, "127.0.0.1");
+		listener.set_source_rate_limit(RATE, BURST);
+
+		asio::ip::udp::socket flooder(netservice, make_endpoint("127.0.0.2", 0));
+		const asio::ip::udp::endpoint listener_address = make_endpoint("127.0.0.1", port);
+
+		// a first contact with some data, so the cookie is no larger than the request
+		std::vector<uint8_t> request;
+		util::crc32_t crc;
+		udp_packet request_pkt(-1, 0);
+
+		const std::shared_ptr<udp_packet_chunk> chunk = udp_packet_chunk::create();
+		const std::shared_ptr<udp_chunk_payload> payload = udp_chunk_payload::create();
+
+		std::memset(payload->data, 0, 32);
+		chunk->chunk_size = 32;
+		chunk->payload = payload;
+
+		request_pkt.chunks.push_back(chunk);
+		request_pkt.checksum = request_pkt.calc_checksum(crc);
+		request_pkt.serialize(request);
+
+		udp_connection client(0, port, "127.0.0.1");
+		std::shared_ptr<udp_connection> server;
+
+		uint32_t msgs_sent = 0;
+		uint32_t msgs_recvd = 0;
+		uint32_t msgs_unordered = 0;
+		uint32_t cookies_recvd = 0;
+
+		uint8_t buffer[8192];
+
+		client.unmute();
+
+		const std::chrono::steady_clock::time_point flood_start = std::chrono::steady_clock::now();
+		std::chrono::steady_clock::time_point flood_end = flood_start;
+
+		for (uint32_t tick = 0; tick < NUM_TICKS; ++tick) {
+			if (tick < FLOOD_TICKS) {
+				for (uint32_t n = 0; n < FLOOD_DATAGRAMS; ++n) {
+					asio::error_code error_code;
+					flooder.send_to(asio::buffer(request), listener_address, 0, error_code);
+				}
+			}
+
+			while (flooder.available() > 0) {
+				asio::ip::udp::endpoint from;
+				asio::error_code error_code;
+
+				const size_t size = flooder.receive_from(asio::buffer(buffer), from, 0, error_code);
+
+				if (udp_packet::has_valid_header(buffer, size))
+					cookies_recvd += ((udp_packet(buffer, size).flags & udp_packet::PKT_FLAG_COOKIE_CHALLENGE) != 0);
+			}
+
+			if (tick < (NUM_TICKS - 500))
+				client.send_data(make_message(msgs_sent++));
+
+			// a connection that never sends takes acks-only datagrams for reconnects
+			if (server != nullptr)
+				server->send_data(make_message(tick));
+
+			client.update();
+			listener.update();
+
+			// the last of the flood may take a few updates to be read
+			if (tick < (FLOOD_TICKS + FLOOD_DRAIN_TICKS))
+				flood_end = std::chrono::steady_clock::now();
+
+			if (server == nullptr && listener.has_incoming_connections()) {
+				server = listener.accept_connection();
+				server->unmute();
+			}
+
+			while (client.get_data() != nullptr) {
+			}
+
+			while (server != nullptr && server->has_incoming_data()) {
+				const std::shared_ptr<const raw_packet> msg = server->get_data();
+
+				uint32_t seq = 0;
+				std::memcpy(&seq, msg->data + 1, sizeof(seq));
+
+				msgs_unordered += (seq != msgs_recvd);
+				msgs_recvd = seq + 1;
+			}
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		const listener_metrics& metrics = listener.get_metrics();
+
+		const double flood_secs = std::chrono::duration<double>(flood_end - flood_start).count();
+		const uint64_t num_limited = metrics.limited_datagrams.get();
+		const uint64_t num_accepted = metrics.accepted_connections.get();
+		const uint32_t max_cookies = BURST + uint32_t(RATE * flood_secs) + 1;
+
+		printf("flood: %u datagrams over %.3f s, %u cookies back (at most %u), %" PRIu64 " limited, %" PRIu64 " connections, %u messages sent and %u received (%u out of order)\n", FLOOD_TICKS * FLOOD_DATAGRAMS, flood_secs, cookies_recvd, max_cookies, num_limited, num_accepted, msgs_sent, msgs_recvd, msgs_unordered);
+
+		if (cookies_recvd < uint32_t(BURST) || cookies_recvd > max_cookies || num_limited == 0)
+			return false;
+		if (num_accepted != 1 || msgs_recvd != msgs_sent || msgs_unordered != 0)
+			return false;
+
+		return true;
+	}
+
+	bool parse_args(int argc, char** argv, uint16_t& port) {
+		for (int i = 1; i < argc; ++i) {
+			if ((i + 1) >= argc)
+				return false;
+
+			if (std::strcmp(argv[i], "-p") == 0) {
+				port = atoi(argv[++i]);
+				continue;
+			}
+
+			return false;
+		}
+
+		return true;
+	}
+}
+
+int main(int argc, char** argv) {
+	uint16_t port = 8493;
+
+	if (!parse_args(argc, argv, port)) {
+		fprintf(stderr, "usage: %s [-p <port>]\n", argv[0]);
+		return 1;
+	}
+
+	proto_def.add_type(MSG_SEQ, 8);
+
+	if (!check_thresholds())
+		return 1;
+	if (!check_flood(port))
+		return 1;
+
+	return 0;
+}
@@ -0,0 +1,235 @@
+// timer check: the timer wheel expires timers in order, on time, and never
+// once they were cancelled
+//
+// usage: timer_check [-n <timers>] [-s <seed>]
+//   -n  timers to schedule (default 5000)
+//   -s  random seed (default 1)
+//
+// timers are scheduled up to half a minute out on a wheel of 1ms ticks,
+// and a few several hours out, past its coarsest level; the wheel is then
+// advanced in random steps over a simulated clock while timers are
+// cancelled, rescheduled and destroyed at random. every timer still
+// scheduled has to become ready at the first advance past its expiry tick,
+// never before its time and never more than a tick after it, cancelled and
+// destroyed ones never, and the ready list has to hand them out in the order
+// they expired. get_next_expiry_time must never be later than the earliest
+// timer scheduled, and schedule_now has to keep a ready timer's place in
+// line. exits with 1 otherwise
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "timer_wheel.hpp"
+
+using namespace arelion;
+
+namespace {
+	typedef std::chrono::high_resolution_clock::time_point time_point;
+
+	struct test_timer {
+	public:
+		test_timer(uint32_t id_): id(id_) {}
+
+	public:
+		timer_node<test_timer> node{this};
+
+		// max() while not scheduled
+		time_point time = time_point::max();
+		uint32_t id = 0;
+	};
+
+	struct check_result {
+	public:
+		uint32_t num_fired = 0;
+		uint32_t num_early = 0;
+		uint32_t num_late = 0;
+		uint32_t num_unordered = 0;
+		uint32_t num_unscheduled = 0;
+		uint32_t num_missed = 0;
+		uint32_t num_next_late = 0;
+	};
+
+	// pops every ready timer after advancing from <prv_advance_time> to
+	// <cur_time>, checking it against both and the timers popped before it
+	void drain(timer_wheel<test_timer>& wheel, time_point prv_advance_time, time_point cur_time, time_point& prv_time, const std::chrono::nanoseconds tick_time, check_result& result) {
+		while (test_timer* timer = wheel.pop_ready()) {
+			result.num_fired += 1;
+			result.num_unscheduled += (timer->time == time_point::max());
+			result.num_early += (timer->time > cur_time);
+			// its expiry tick had already been reached by the previous advance
+			result.num_late += ((timer->time + tick_time) <= prv_advance_time);
+			// a tick's worth of rounding apart, timers leave in the order they expire
+			result.num_unordered += ((timer->time + tick_time) < prv_time);
+
+			prv_time = std::max(prv_time, timer->time);
+			timer->time = time_point::max();
+		}
+	}
+
+	bool check_wheel(uint32_t num_timers, uint32_t seed) {
+		std::mt19937 rng(seed);
+
+		const std::chrono::nanoseconds tick_time = std::chrono::milliseconds(1);
+
+		timer_wheel<test_timer> wheel(tick_time);
+		time_point cur_time = std::chrono::high_resolution_clock::now();
+
+		std::vector< std::unique_ptr<test_timer> > timers;
+
+		const auto schedule = [&](test_timer& timer) {
+			// one in fifty past the coarsest wheel, hours out
+			const uint32_t max_delay_ms = ((rng() % 50) == 0)? (5 * 3600 * 1000): (30 * 1000);
+
+			timer.time = cur_time + std::chrono::milliseconds(rng() % max_delay_ms);
+			wheel.schedule(timer.node, timer.time);
+		};
+
+		for (uint32_t n = 0; n < num_timers; ++n) {
+			timers.emplace_back(new test_timer(n));
+			schedule(*timers.back());
+		}
+
+		check_result result;
+		time_point prv_time = time_point::min();
+
+		uint32_t num_cancelled = 0;
+		uint32_t num_destroyed = 0;
+
+		// half a minute in small steps, then straight past the far ones
+		for (uint32_t step = 0; step < 2000; ++step) {
+			for (uint32_t n = 0; n < (num_timers / 1000); ++n) {
+				std::unique_ptr<test_timer>& timer = timers[rng() % timers.size()];
+
+				switch (rng() % 3) {
+					case 0: {
+						num_cancelled += (timer->time != time_point::max());
+						timer->time = time_point::max();
+						wheel.cancel(timer->node);
+					} break;
+					case 1: {
+						schedule(*timer);
+					} break;
+					case 2: {
+						// unlinks itself
+						num_destroyed += 1;
+						timer.reset(new test_timer(timer->id));
+					} break;
+				}
+			}
+
+			// not later than the earliest timer
+			const time_point next_time = wheel.get_next_expiry_time();
+
+			for (const std::unique_ptr<test_timer>& timer: timers) {
+				result.num_next_late += (timer->time < time_point::max() && next_time > (timer->time + tick_time));
+			}
+
+			const time_point prv_advance_time = cur_time;
+
+			cur_time += std::chrono::microseconds(rng() % 30000);
+
+			wheel.advance(cur_time);
+			drain(wheel, prv_advance_time, cur_time, prv_time, tick_time, result);
+		}
+
+		const time_point prv_advance_time = cur_time;
+
+		cur_time += std::chrono::hours(6);
+
+		wheel.advance(cur_time);
+		drain(wheel, prv_advance_time, cur_time, prv_time, tick_time, result);
+
+		for (const std::unique_ptr<test_timer>& timer: timers) {
+			result.num_missed += (timer->time != time_point::max());
+		}
+
+		printf("wheel: %u timers fired (%u cancelled and %u destroyed before), %u early, %u late, %u out of order, %u unscheduled, %u missed, %u next expiry times too late\n", result.num_fired, num_cancelled, num_destroyed, result.num_early, result.num_late, result.num_unordered, result.num_unscheduled, result.num_missed, result.num_next_late);
+
+		if (result.num_fired == 0 || result.num_early != 0 || result.num_late != 0 || result.num_unordered != 0)
+			return false;
+		if (result.num_unscheduled != 0 || result.num_missed != 0 || result.num_next_late != 0)
+			return false;
+
+		return true;
+	}
+
+	bool check_ready_list() {
+		timer_wheel<test_timer> wheel;
+		test_timer timers[4] = {{0}, {1}, {2}, {3}};
+
+		const time_point cur_time = std::chrono::high_resolution_clock::now();
+
+		wheel.schedule(timers[0].node, cur_time);
+		wheel.schedule(timers[1].node, cur_time + std::chrono::milliseconds(5));
+		wheel.schedule(timers[2].node, cur_time + std::chrono::milliseconds(10));
+		wheel.advance(cur_time + std::chrono::milliseconds(7));
+
+		// already ready, keeps its place in front of timer 1
+		wheel.schedule_now(timers[0].node);
+		wheel.schedule_now(timers[3].node);
+
+		// left undrained, stays ahead of timer 2 expiring later
+		wheel.advance(cur_time + std::chrono::milliseconds(20));
+
+		const bool next_min = (wheel.get_next_expiry_time() == time_point::min());
+
+		uint32_t order[4] = {0, 0, 0, 0};
+		uint32_t num_popped = 0;
+
+		while (test_timer* timer = wheel.pop_ready()) {
+			if (num_popped < 4)
+				order[num_popped] = timer->id;
+
+			num_popped += 1;
+		}
+
+		const bool in_order = (num_popped == 4 && order[0] == 0 && order[1] == 1 && order[2] == 3 && order[3] == 2);
+		const bool next_max = (wheel.get_next_expiry_time() == time_point::max());
+
+		printf("ready list: %u timers popped (%u %u %u %u), %s while ready, %s once empty\n", num_popped, order[0], order[1], order[2], order[3], next_min? "min()": "not min()", next_max? "max()": "not max()");
+		return (in_order && next_min && next_max);
+	}
+
+	bool parse_args(int argc, char** argv, uint32_t& num_timers, uint32_t& seed) {
+		for (int i = 1; i < argc; ++i) {
+			if ((i + 1) >= argc)
+				return false;
+
+			if (std::strcmp(argv[i], "-n") == 0) {
+				num_timers = atoi(argv[++i]);
+				continue;
+			}
+			if (std::strcmp(argv[i], "-s") == 0) {
+				seed = atoi(argv[++i]);
+				continue;
+			}
+
+			return false;
+		}
+
+		return (num_timers >= 1000);
+	}
+}
+
+int main(int argc, char** argv) {
+	uint32_t num_timers = 5000;
+	uint32_t seed = 1;
+
+	if (!parse_args(argc, argv, num_timers, seed)) {
+		fprintf(stderr, "usage: %s [-n <timers>] [-s <seed>]\n", argv[0]);
+		return 1;
+	}
+
+	if (!check_wheel(num_timers, seed))
+		return 1;
+	if (!check_ready_list())
+		return 1;
+
+	return 0;
+}
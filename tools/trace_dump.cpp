@@ -0,0 +1,115 @@
+// prints the timeline of a trace ring dumped by udp_connection::dump_trace
+//
+// usage: trace_dump <file>
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "packet_trace.hpp"
+
+using arelion::packet_trace;
+using arelion::packet_trace_event;
+
+static const char* get_type_name(uint8_t type) {
+	switch (type) {
+		case packet_trace_event::TYPE_SEND    : return "send";
+		case packet_trace_event::TYPE_RECV    : return "recv";
+		case packet_trace_event::TYPE_RECV_BAD: return "recv-bad";
+		case packet_trace_event::TYPE_PACED   : return "paced";
+		default: break;
+	}
+
+	return "unknown";
+}
+
+int main(int argc, char** argv) {
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s <file>\n", argv[0]);
+		return 1;
+	}
+
+	FILE* file = fopen(argv[1], "rb");
+
+	if (file == nullptr) {
+		fprintf(stderr, "[%s] failed to open \"%s\"\n", __func__, argv[1]);
+		return 1;
+	}
+
+	packet_trace::file_header header;
+	std::vector<packet_trace_event> events;
+
+	if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != packet_trace::FILE_MAGIC) {
+		fprintf(stderr, "[%s] \"%s\" is not a trace dump\n", __func__, argv[1]);
+		fclose(file);
+		return 1;
+	}
+
+	if (header.version != packet_trace::FILE_VERSION || header.event_size != sizeof(packet_trace_event)) {
+		fprintf(stderr, "[%s] unsupported trace version %u (event size %u)\n", __func__, header.version, header.event_size);
+		fclose(file);
+		return 1;
+	}
+
+	events.resize(header.num_events);
+
+	if (!events.empty() && fread(&events[0], sizeof(packet_trace_event), events.size(), file) != events.size()) {
+		fprintf(stderr, "[%s] truncated trace, expected %u events\n", __func__, header.num_events);
+		fclose(file);
+		return 1;
+	}
+
+	fclose(file);
+
+	header.label[sizeof(header.label) - 1] = 0;
+	printf("# %s, %u events\n", header.label, header.num_events);
+	printf("#   time[ms]  delta[ms]  event     size  last_cont  nak  chunks                 new  old  unrel  flags\n");
+
+	uint32_t counts[4] = {0, 0, 0, 0};
+	uint64_t bytes[4] = {0, 0, 0, 0};
+
+	for (size_t i = 0; i < events.size(); ++i) {
+		const packet_trace_event& e = events[i];
+
+		const double time_ms = (e.time - events[0].time) * 1e-6;
+		const double delta_ms = (e.time - events[std::max(i, size_t(1)) - 1].time) * 1e-6;
+
+		counts[e.type & 3] += 1;
+		bytes[e.type & 3] += e.size;
+
+		if (e.type == packet_trace_event::TYPE_PACED) {
+			printf("%12.3f %10.3f  %-8s  held back for %uus\n", time_ms, delta_ms, get_type_name(e.type), e.value);
+			continue;
+		}
+
+		char chunks[32] = {0};
+
+		if (e.first_chunk >= 0)
+			snprintf(chunks, sizeof(chunks), "[%d..%d]", e.first_chunk, e.last_chunk);
+
+		printf(
+			"%12.3f %10.3f  %-8s %5u  %9d  %3d  %-21s %4u %4u  %5u   0x%02x\n",
+			time_ms,
+			delta_ms,
+			get_type_name(e.type),
+			e.size,
+			e.last_continuous,
+			e.nak_type,
+			chunks,
+			e.new_chunks,
+			e.old_chunks,
+			e.unreliable_chunks,
+			e.flags
+		);
+	}
+
+	printf("#\n");
+
+	for (uint8_t type = 0; type < 4; ++type) {
+		printf("# %-8s %8u events %10" PRIu64 " bytes\n", get_type_name(type), counts[type], bytes[type]);
+	}
+
+	return 0;
+}
+
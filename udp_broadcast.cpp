@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "udp_broadcast.hpp"
+#include "alloc_audit.hpp"
+#include "delta_codec.hpp"
+#include "protocol_def.hpp"
+#include "stream_codec.hpp"
+#include "udp_connection.hpp"
+
+namespace arelion {
+	void udp_broadcast_group::add_connection(std::shared_ptr<udp_connection> conn) {
+		remove_connection(conn.get());
+		m_connections.push_back(conn);
+	}
+
+	void udp_broadcast_group::remove_connection(const udp_connection* conn) {
+		const auto pred = [&](const std::weak_ptr<udp_connection>& ptr) {
+			const std::shared_ptr<udp_connection> locked = ptr.lock();
+			return (locked == nullptr || locked.get() == conn);
+		};
+
+		m_connections.erase(std::remove_if(m_connections.begin(), m_connections.end(), pred), m_connections.end());
+	}
+
+	void udp_broadcast_group::clear() {
+		while (!m_connections.empty()) {
+			remove_connection(m_connections.back().lock().get());
+		}
+	}
+
+	void udp_broadcast_group::send_block(const udp_broadcast_block& block) {
+		for (const std::weak_ptr<udp_connection>& ptr: m_connections) {
+			const std::shared_ptr<udp_connection> conn = ptr.lock();
+
+			if (conn != nullptr)
+				conn->send_broadcast_block(block);
+		}
+	}
+
+	void udp_broadcast_group::send_data(std::shared_ptr<const raw_packet> data, const uint8_t delivery, const uint8_t stream) {
+		assert(data->length > 0);
+		assert(stream < base_connection::MAX_STREAMS);
+
+		// unordered packets too large for a single chunk are sent reliable and in-order
+		if (delivery == base_connection::DELIVERY_RELIABLE_ORDERED || data->length > udp_packet_chunk::max_size()) {
+			m_outgoing_data.emplace_back(std::move(data), base_connection::DELIVERY_RELIABLE_ORDERED | (stream << 2));
+		} else {
+			m_outgoing_data.emplace_back(std::move(data), delivery | (stream << 2));
+		}
+
+		if (m_batch_depth == 0)
+			flush();
+	}
+
+	void udp_broadcast_group::end_batch() {
+		assert(m_batch_depth > 0);
+
+		if ((m_batch_depth -= 1) > 0)
+			return;
+
+		flush();
+	}
+
+	void udp_broadcast_group::flush() {
+		if (m_outgoing_data.empty())
+			return;
+
+		ALLOC_AUDIT_SCOPE("broadcast");
+
+		// released connections are dropped here rather than on every block
+		remove_connection(nullptr);
+
+		// one bit per delivery class and stream
+		uint64_t channels = 0;
+
+		for (const auto& pair: m_outgoing_data) {
+			channels |= (uint64_t(1) << pair.second);
+		}
+
+		for (uint8_t channel = 0; channels != 0; ++channel, channels >>= 1) {
+			if ((channels & 1) == 0)
+				continue;
+
+			flush_channel(channel);
+		}
+
+		m_outgoing_data.clear();
+	}
+
+	void udp_broadcast_group::flush_channel(const uint8_t channel) {
+		const bool ordered = ((channel & 3) == base_connection::DELIVERY_RELIABLE_ORDERED);
+
+		m_block.clear();
+		m_block.channel = channel;
+		m_max_msg_length = 0;
+
+		for (const auto& pair: m_outgoing_data) {
+			if (pair.second != channel)
+				continue;
+
+			const raw_packet& pkt = *pair.first;
+
+			if (!proto_def.is_valid_packet(pkt.data, pkt.length))
+				continue;
+
+			if (ordered) {
+				const bool delta_coded = proto_def.is_delta_type(pkt.data[0]);
+				const uint32_t max_pkt_size = delta_coded? delta_codec::max_record_size(pkt.length): pkt.length;
+
+				// blocks only ever contain whole packets
+				if ((m_block.raw_data.size() + max_pkt_size) > stream_codec::max_block_size())
+					flush_block();
+			} else {
+				// several small packets of the same class and stream can share a chunk
+				if ((m_block.raw_data.size() + pkt.length) > udp_packet_chunk::max_size())
+					flush_block();
+			}
+
+			const uint32_t block_size = m_block.raw_data.size();
+
+			if (ordered && proto_def.is_delta_type(pkt.data[0])) {
+				delta_encoder::frame_full_record(pkt.data, pkt.length, m_block.raw_data);
+				m_block.delta_packets.push_back(pair.first);
+			} else {
+				m_block.raw_data.insert(m_block.raw_data.end(), pkt.data, pkt.data + pkt.length);
+			}
+
+			m_block.msg_sizes.emplace_back(pkt.data[0], m_block.raw_data.size() - block_size);
+
+			if (pkt.length > m_max_msg_length) {
+				m_max_msg_length = pkt.length;
+				m_block.msg_id = pkt.data[0];
+			}
+		}
+
+		flush_block();
+	}
+
+	void udp_broadcast_group::flush_block() {
+		if (m_block.raw_data.empty())
+			return;
+
+		m_encode_buffer.clear();
+
+		if ((m_block.channel & 3) == base_connection::DELIVERY_RELIABLE_ORDERED) {
+			stream_encoder::frame_raw_block(&m_block.raw_data[0], m_block.raw_data.size(), m_encode_buffer);
+		} else {
+			m_encode_buffer.assign(m_block.raw_data.begin(), m_block.raw_data.end());
+		}
+
+		// fragmented once, to the same sizes every connection would have used
+		for (uint32_t pos = 0; pos < m_encode_buffer.size(); ) {
+			const std::shared_ptr<udp_chunk_payload> payload = udp_chunk_payload::create();
+			const uint32_t num_chunk_bytes = std::min(udp_packet_chunk::max_size(), uint32_t(m_encode_buffer.size() - pos));
+
+			std::memcpy(payload->data, &m_encode_buffer[pos], num_chunk_bytes);
+
+			m_block.payloads.push_back(payload);
+			m_block.payload_sizes.push_back(num_chunk_bytes);
+
+			pos += num_chunk_bytes;
+		}
+
+		send_block(m_block);
+
+		const uint8_t channel = m_block.channel;
+
+		m_block.clear();
+		m_block.channel = channel;
+		m_max_msg_length = 0;
+	}
+}
+
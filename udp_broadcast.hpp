@@ -0,0 +1,113 @@
+#ifndef ARELION_UDP_BROADCAST_HDR
+#define ARELION_UDP_BROADCAST_HDR
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "base_connection.hpp"
+#include "mem_pool.hpp"
+#include "raw_packet.hpp"
+#include "udp_packet.hpp"
+
+
+namespace arelion {
+	class udp_connection;
+
+	// chunk payloads of one stream block (or one unordered chunk) built once by
+	// udp_broadcast_group and referenced by the chunks of all its connections
+	struct udp_broadcast_block {
+	public:
+		uint32_t get_payload_bytes() const {
+			uint32_t size = 0;
+
+			for (const uint8_t n: payload_sizes)
+				size += n;
+
+			return size;
+		}
+
+		void clear() {
+			raw_data.clear();
+			delta_packets.clear();
+			msg_sizes.clear();
+			payloads.clear();
+			payload_sizes.clear();
+
+			channel = 0;
+			msg_id = 0;
+		}
+
+	public:
+		// unframed contents of the block, which every stream encoder must see, or
+		// of the unordered chunk
+		std::vector<uint8_t> raw_data;
+		// delta-coded packets sent as full records in the block, same reason
+		std::vector< std::shared_ptr<const raw_packet> > delta_packets;
+		// id and encoded size of each message, for traffic stats
+		std::vector< std::pair<uint8_t, uint32_t> > msg_sizes;
+
+		std::vector< std::shared_ptr<const udp_chunk_payload> > payloads;
+		std::vector<uint8_t> payload_sizes;
+
+		uint8_t channel = 0;
+		// largest message in the block, its chunks are charged to it on resends
+		uint8_t msg_id = 0;
+	};
+
+
+	// sends the same messages to a set of connections, chunking and copying them
+	// only once; every connection still numbers, acks and resends the shared
+	// chunks on its own. ordered blocks are never compressed and delta-coded ids
+	// are sent as full records, since the history behind either is per connection
+	class udp_broadcast_group {
+	public:
+		virtual ~udp_broadcast_group() = default;
+
+		// connections are held weakly and dropped once released; removing
+		// nullptr only drops those
+		virtual void add_connection(std::shared_ptr<udp_connection> conn);
+		virtual void remove_connection(const udp_connection* conn);
+		void clear();
+
+		// same rules as udp_connection::send_data; outside of a batch the
+		// message is handed to the connections right away
+		void send_data(std::shared_ptr<const raw_packet> data, const uint8_t delivery = base_connection::DELIVERY_RELIABLE_ORDERED, const uint8_t stream = 0);
+
+		// messages sent within a batch share blocks and chunks where possible
+		void begin_batch() { m_batch_depth += 1; }
+		void end_batch();
+		virtual void flush();
+
+		size_t get_num_connections() const { return m_connections.size(); }
+
+	protected:
+		// hands a finished block to every connection
+		virtual void send_block(const udp_broadcast_block& block);
+
+	private:
+		// turns the queued messages of one channel into blocks for all connections
+		void flush_channel(const uint8_t channel);
+		void flush_block();
+
+	protected:
+		std::vector< std::weak_ptr<udp_connection> > m_connections;
+
+	private:
+		// queued messages, paired with their chunk channel
+		pool_deque< std::pair<std::shared_ptr<const raw_packet>, uint8_t> > m_outgoing_data;
+
+		// reused for every block, so a warmed up group does not allocate
+		udp_broadcast_block m_block;
+		std::vector<uint8_t> m_encode_buffer;
+
+		// largest message in the current block
+		uint32_t m_max_msg_length = 0;
+		// nesting level of begin_batch calls
+		uint32_t m_batch_depth = 0;
+	};
+}
+
+#endif
+
@@ -1,7 +1,16 @@
+#include <algorithm>
 #include <memory>
+#include <random>
 #include <cinttypes>
 
+#include <asio/ip/multicast.hpp>
+
 #include "udp_connection.hpp"
+#include "address_resolver.hpp"
+#include "alloc_audit.hpp"
+#include "phase_profiler.hpp"
+#include "udp_broadcast.hpp"
+#include "udp_multicast.hpp"
 #include "udp_packet.hpp"
 #include "protocol_def.hpp"
 #include "socket_helper.hpp"
@@ -18,11 +27,14 @@ namespace arelion {
 		asio::error_code error_code;
 		m_net_address = resolve_addr(address_str, dst_port, &error_code);
 
-		const asio::ip::address source_addr = get_any_address(m_net_address.address().is_v6());
-		const asio::ip::udp::endpoint source_endpoint = asio::ip::udp::endpoint(source_addr, src_port);
-
-		m_socket.reset(new asio::ip::udp::socket(arelion::netservice, source_endpoint));
+		init_socket(src_port);
+		init(false);
+	}
 
+	udp_connection::udp_connection(int32_t src_port, const asio::ip::udp::endpoint& net_address)
+		: m_net_address(net_address)
+	{
+		init_socket(src_port);
 		init(false);
 	}
 
@@ -32,6 +44,15 @@ namespace arelion {
 	}
 
 
+	void udp_connection::init_socket(int32_t src_port) {
+		const asio::ip::address source_addr = get_any_address(m_net_address.address().is_v6());
+		const asio::ip::udp::endpoint source_endpoint = asio::ip::udp::endpoint(source_addr, src_port);
+
+		m_socket.reset(new asio::ip::udp::socket(arelion::netservice, source_endpoint));
+		m_waiter.reset(new net_waiter());
+		m_waiter->add_socket(*m_socket);
+	}
+
 	void udp_connection::init(bool shared_socket) {
 		m_prv_nak_time = std::chrono::high_resolution_clock::now();
 		m_prv_unack_resend_time = std::chrono::high_resolution_clock::now();
@@ -41,6 +62,9 @@ namespace arelion {
 		m_prv_update_time = std::chrono::high_resolution_clock::now();
 
 
+		m_pacer.init(m_prv_update_time, config::link_outgoing_bandwidth, config::link_outgoing_burst);
+		m_latency_budget = std::chrono::milliseconds(config::udp_latency_budget_ms);
+
 		m_max_transmission_unit = config::max_transmission_unit;
 		m_reconnect_time_secs = config::reconnect_time_secs;
 		m_netloss_factor = config::network_loss_factor;
@@ -51,21 +75,27 @@ namespace arelion {
 		m_last_mid_chunk = -1;
 
 		m_packet_chunk_num = 0;
-
-		m_resent_chunks = 0;
-		m_dropped_chunks = 0;
-
-		m_sent_packets = 0;
-		m_recv_packets = 0;
-
-		m_sent_overhead = 0;
-		m_recv_overhead = 0;
+		m_unreliable_chunk_num = 0;
+		m_queued_chunk_bytes = 0;
+		m_outgoing_bytes = 0;
+		m_batch_depth = 0;
 
 
 		m_muted = true;
 		m_closed = false;
 		m_resend = false;
+		m_batch_ended = false;
+		m_pacer_held = false;
 		m_shared_socket = shared_socket;
+		m_stream_compression = config::stream_compression;
+		m_peer_stream_compression = false;
+
+		if (config::message_latency_stats)
+			enable_latency_stats();
+		if (config::message_traffic_stats)
+			enable_traffic_stats();
+		if (config::packet_trace_events > 0)
+			m_trace.reset(new packet_trace(config::packet_trace_events));
 	}
 
 
@@ -80,57 +110,150 @@ namespace arelion {
 	void udp_connection::init_connection(asio::ip::udp::endpoint address, std::shared_ptr<asio::ip::udp::socket> socket) {
 		m_net_address = address;
 		m_socket = socket;
+		wake();
 	}
 
-	udp_connection::~udp_connection() {
-		m_fragment_buffer.delete_data();
+	bool udp_connection::validate_address(const asio::ip::udp::endpoint& address, const udp_packet& pkt) {
+		if (pkt.conn_id != m_conn_id || pkt.calc_checksum(m_crc) != pkt.checksum)
+			return false;
+
+		if (m_probe_nonce != 0 && address == m_probe_address) {
+			if ((pkt.flags & udp_packet::PKT_FLAG_PATH_RESPONSE) == 0 || pkt.path_nonce != m_probe_nonce)
+				return false;
+
+			m_net_address = address;
+			m_probe_nonce = 0;
+			return true;
+		}
+
+		// a pending probe is kept until answered or out of attempts, anyone
+		// seeing a valid datagram could otherwise keep redirecting it
+		if (m_probe_nonce != 0)
+			return false;
+		// nor does one that went unanswered get to go first again right away
+		if (address == m_failed_probe_address && (std::chrono::high_resolution_clock::now() - m_failed_probe_time) < std::chrono::milliseconds(config::path_probe_interval_ms * config::path_probe_attempts))
+			return false;
+
+		m_probe_address = address;
+		m_probe_nonce = std::random_device{}() | 1;
+		m_probe_attempts = 0;
+		m_prv_probe_time = net_time_point();
+		wake();
+		return false;
+	}
+
+	void udp_connection::send_path_challenge(const net_time_point& cur_time) {
+		if ((cur_time - m_prv_probe_time) < std::chrono::milliseconds(config::path_probe_interval_ms))
+			return;
+
+		if ((m_probe_attempts += 1) > config::path_probe_attempts) {
+			m_probe_nonce = 0;
+			m_failed_probe_address = m_probe_address;
+			m_failed_probe_time = cur_time;
+			return;
+		}
 
-		for (auto& it: m_waiting_packets)
-			delete it.second;
+		// carries nothing but the current ack, which is valid on any path
+		udp_packet pkt(m_last_inorder, 0);
+
+		pkt.flags = (udp_packet::PKT_FLAG_STREAM_LZ * m_stream_compression) | udp_packet::PKT_FLAG_PATH_CHALLENGE;
+		pkt.conn_id = m_conn_id;
+		pkt.path_nonce = m_probe_nonce;
+		pkt.checksum = pkt.calc_checksum(m_crc);
+		pkt.serialize(m_send_buffer);
 
+		asio::error_code error_code;
+		m_socket->send_to(asio::buffer(m_send_buffer), m_probe_address, 0, error_code);
+		m_prv_probe_time = cur_time;
+
+		if (check_error_code(error_code))
+			return;
+
+		if (m_capture != nullptr)
+			m_capture->write(m_local_address, m_probe_address, &m_send_buffer[0], m_send_buffer.size());
+
+		m_metrics.data_sent.add(m_send_buffer.size());
+		m_metrics.sent_packets.add(1);
+	}
+
+	udp_connection::~udp_connection() {
 		flush(true);
 	}
 
-	void udp_connection::send_data(std::shared_ptr<const raw_packet> data) {
+	void udp_connection::send_data(std::shared_ptr<const raw_packet> data, const uint8_t delivery, const uint8_t stream) {
 		assert(data->length > 0);
-		m_outgoing_data.push_back(data);
+		assert(stream < MAX_STREAMS);
+		assert(m_multicast == nullptr || stream != m_multicast->stream);
+
+		// both ends number the group's stream in its own sequence
+		if (m_multicast != nullptr && stream == m_multicast->stream) {
+			fprintf(stderr, "[%s] refusing to send on multicast stream %u", __func__, stream);
+			return;
+		}
+
+		ALLOC_AUDIT_SCOPE("send_data");
+
+		if (delivery == DELIVERY_RELIABLE_ORDERED || data->length > udp_packet_chunk::max_size()) {
+			udp_stream& data_stream = get_stream(stream);
+
+			// latency budget starts counting down for the first packet of a batch
+			if (data_stream.outgoing_data.empty())
+				data_stream.queue_time = std::chrono::high_resolution_clock::now();
+
+			data_stream.outgoing_data.push_back(data);
+			m_outgoing_bytes += data->length;
+
+			if (m_latency_stats != nullptr)
+				data_stream.outgoing_times.push_back(std::chrono::high_resolution_clock::now());
+
+			wake();
+			return;
+		}
+
+		m_outgoing_unordered.emplace_back(data, delivery | (stream << 2));
+		wake();
 	}
 
-	std::shared_ptr<const raw_packet> udp_connection::peek(uint32_t index) const {
-		if (index >= m_msg_queue.size())
+	std::shared_ptr<const raw_packet> udp_connection::peek(uint32_t index, const uint8_t stream) const {
+		if (index >= get_packet_queue_size(stream))
 			return {};
 
-		return m_msg_queue[index];
+		return m_streams[stream]->msg_queue[index];
 	}
 
-	std::shared_ptr<const raw_packet> udp_connection::get_data() {
-		if (m_msg_queue.empty())
+	std::shared_ptr<const raw_packet> udp_connection::get_data(const uint8_t stream) {
+		if (get_packet_queue_size(stream) == 0)
 			return {};
 
-		std::shared_ptr<const raw_packet> msg = m_msg_queue.front();
-		m_msg_queue.pop_front();
+		ALLOC_AUDIT_SCOPE("get_data");
+
+		auto& msg_queue = m_streams[stream]->msg_queue;
+		std::shared_ptr<const raw_packet> msg = msg_queue.front();
+		msg_queue.pop_front();
 		return msg;
 	}
 
 
-	void udp_connection::delete_buffer_packet_at(uint32_t index) {
-		if (index >= m_msg_queue.size())
+	void udp_connection::delete_buffer_packet_at(uint32_t index, const uint8_t stream) {
+		if (index >= get_packet_queue_size(stream))
 			return;
 
-		m_msg_queue.erase(m_msg_queue.begin() + index);
+		auto& msg_queue = m_streams[stream]->msg_queue;
+		msg_queue.erase(msg_queue.begin() + index);
 	}
 
 	void udp_connection::update() {
 		const net_time_point cur_update_time{std::chrono::high_resolution_clock::now()};
-		const net_time_range dif_update_time{cur_update_time - m_prv_update_time}; // ns
-		const net_time_range   max_poll_time{10ll * 1000ll * 1000ll}; // 10ms
+		const net_time_range   max_poll_time = std::chrono::milliseconds(config::udp_update_budget_ms);
 
-		// convert dt to ms
-		m_outgoing_bw_tracker.update_time(dif_update_time.count() / (1000ll * 1000ll));
+		ALLOC_AUDIT_SCOPE("update");
 
 		if (!m_shared_socket && !m_closed) {
+			PHASE_TIMER(recv_timer, m_metrics.phases, phase_metrics::PHASE_RECV);
+
 			// NB: duplicated in udp_listener
 			netservice.poll();
+			netresolver.poll();
 
 			size_t bytes_available = 0;
 
@@ -147,10 +270,15 @@ namespace arelion {
 				if (check_error_code(error_code))
 					break;
 
-				if (bytes_received < udp_packet::hdr_size())
+				if (m_capture != nullptr)
+					m_capture->write(udp_endpoint, m_local_address, &m_recv_buffer[0], bytes_received);
+
+				if (!udp_packet::has_valid_header(&m_recv_buffer[0], bytes_received))
 					continue;
 
+				PHASE_TIMER(parse_timer, m_metrics.phases, phase_metrics::PHASE_PARSE);
 				udp_packet data(&m_recv_buffer[0], bytes_received);
+				PHASE_TIMER_STOP(parse_timer);
 
 				if (is_using_address(udp_endpoint))
 					process_raw_packet(data);
@@ -161,22 +289,33 @@ namespace arelion {
 			}
 		}
 
+		if (m_multicast != nullptr && m_multicast->socket != nullptr && !m_closed)
+			recv_multicast();
+		if (m_probe_nonce != 0 && !m_closed)
+			send_path_challenge(cur_update_time);
+
 		m_prv_update_time = cur_update_time;
 
 		flush(false);
+		schedule_update(cur_update_time);
 	}
 
 	void udp_connection::process_raw_packet(udp_packet& pkt) {
+		ALLOC_AUDIT_SCOPE("process_packet");
+
 		m_prv_packet_recv_time = std::chrono::high_resolution_clock::now();
-		m_data_recv += pkt.calc_size();
-		m_recv_overhead += udp_packet::hdr_size();
-		m_recv_packets += 1;
+		// acks, naks and reassembled data may all be due now
+		wake();
+		m_metrics.data_recv.add(pkt.calc_size());
+		m_metrics.recv_overhead.add(udp_packet::hdr_size());
+		m_metrics.recv_packets.add(1);
 
 		if (emulate_packet_loss(m_loss_counter))
 			return;
 
 		if (pkt.calc_checksum(m_crc) != pkt.checksum) {
 			fprintf(stderr, "[%s] discarding incoming corrupted packet: CRC %d, LEN %d", __func__, pkt.checksum, pkt.calc_size());
+			trace_packet(packet_trace_event::TYPE_RECV_BAD, pkt, pkt.calc_size(), 0);
 			return;
 		}
 
@@ -185,6 +324,28 @@ namespace arelion {
 			return;
 		}
 
+		m_peer_stream_compression = ((pkt.flags & udp_packet::PKT_FLAG_STREAM_LZ) != 0);
+
+		if (m_conn_id == 0)
+			m_conn_id = pkt.conn_id;
+		if ((pkt.flags & udp_packet::PKT_FLAG_PATH_CHALLENGE) != 0)
+			m_path_response = pkt.path_nonce;
+
+		// the other end accepts us once we echo the cookie, our first chunks were
+		// dropped without a trace and have to be sent again right away
+		if ((pkt.flags & udp_packet::PKT_FLAG_COOKIE_CHALLENGE) != 0 && pkt.cookie != m_cookie) {
+			m_cookie = pkt.cookie;
+
+			for (const std::shared_ptr<udp_packet_chunk>& chunk: m_unacked_chunks) {
+				request_resend(chunk);
+			}
+		}
+		// an ack means it has, the cookie is no longer needed
+		if (pkt.last_continuous >= 0)
+			m_cookie = 0;
+
+		PHASE_TIMER(ack_timer, m_metrics.phases, phase_metrics::PHASE_ACK);
+
 		ack_chunks(pkt.last_continuous);
 
 		if (!m_unacked_chunks.empty()) {
@@ -227,132 +388,801 @@ namespace arelion {
 			}
 		}
 
+		PHASE_TIMER_STOP(ack_timer);
+
+		// streams with chunks that might be reassembled now
+		uint32_t ready_streams = 0;
+
+		if (m_multicast != nullptr && process_multicast_report(pkt))
+			ready_streams |= (1u << m_multicast->stream);
+
+		const uint64_t dropped_chunks = m_metrics.dropped_chunks.get();
+
 		for (auto ci = pkt.chunks.begin(); ci != pkt.chunks.end(); ++ci) {
 			const std::shared_ptr<arelion::udp_packet_chunk>& chunk = *ci;
 
-			if ((m_last_inorder >= chunk->chunk_number) || (m_waiting_packets.find(chunk->chunk_number) != m_waiting_packets.end())) {
-				m_dropped_chunks += 1;
+			// repairs of chunks a multicast group sent
+			if (chunk->is_multicast()) {
+				if (m_multicast != nullptr && process_multicast_chunk(chunk))
+					ready_streams |= (1u << m_multicast->stream);
+
 				continue;
 			}
 
-			m_waiting_packets.emplace(chunk->chunk_number, new raw_packet(&chunk->data[0], chunk->data.size()));
-		}
+			// the group's stream only takes the group's sequence, see send_data
+			if (m_multicast != nullptr && chunk->get_stream() == m_multicast->stream) {
+				m_metrics.dropped_chunks.add(1);
+
+				if (chunk->is_reliable() && m_last_inorder < chunk->chunk_number)
+					m_received_chunks.insert(chunk->chunk_number);
+
+				continue;
+			}
 
+			udp_stream& stream = get_stream(chunk->get_stream());
 
-		// process all in-order packets that we have waiting
-		for (auto wpi = m_waiting_packets.find(m_last_inorder + 1); wpi != m_waiting_packets.end(); wpi = m_waiting_packets.find(m_last_inorder + 1)) {
-			m_wait_buffer.clear();
+			switch (chunk->get_delivery()) {
+				case DELIVERY_RELIABLE_ORDERED:
+				case DELIVERY_RELIABLE_UNORDERED: {
+					if ((m_last_inorder >= chunk->chunk_number) || (m_received_chunks.find(chunk->chunk_number) != m_received_chunks.end())) {
+						m_metrics.dropped_chunks.add(1);
+						continue;
+					}
+
+					m_received_chunks.insert(chunk->chunk_number);
+
+					if (chunk->get_delivery() == DELIVERY_RELIABLE_UNORDERED) {
+						queue_chunk_packets(*chunk, stream);
+						continue;
+					}
 
-			if (m_fragment_buffer.data != nullptr) {
-				// combine fragment with wait-buffer (packet reassembly)
-				m_wait_buffer.resize(m_fragment_buffer.length);
-				m_wait_buffer.assign(m_fragment_buffer.data, m_fragment_buffer.data + m_fragment_buffer.length);
+					// the parsed chunk is kept as is, nothing else refers to it
+					stream.waiting_chunks.emplace(stream.unwrap_sequence(chunk->stream_seq), chunk);
 
-				m_fragment_buffer.delete_data();
+					if (m_latency_stats != nullptr)
+						stream.waiting_times.emplace(stream.unwrap_sequence(chunk->stream_seq), m_prv_packet_recv_time);
+
+					ready_streams |= (1u << chunk->get_stream());
+				} break;
+
+				case DELIVERY_UNRELIABLE_SEQUENCED: {
+					if (stream.last_sequenced >= chunk->chunk_number) {
+						m_metrics.dropped_chunks.add(1);
+						continue;
+					}
+
+					stream.last_sequenced = chunk->chunk_number;
+					queue_chunk_packets(*chunk, stream);
+				} break;
+
+				case DELIVERY_UNRELIABLE: {
+					queue_chunk_packets(*chunk, stream);
+				} break;
 			}
+		}
+
+		trace_packet(packet_trace_event::TYPE_RECV, pkt, pkt.calc_size(), m_metrics.dropped_chunks.get() - dropped_chunks);
 
+		// advance over all reliable chunks received contiguously, regardless of stream
+		for (auto rci = m_received_chunks.begin(); rci != m_received_chunks.end() && *rci == (m_last_inorder + 1); rci = m_received_chunks.erase(rci)) {
 			m_last_inorder += 1;
+		}
+
+		for (uint8_t n = 0; ready_streams != 0; ++n, ready_streams >>= 1) {
+			if ((ready_streams & 1) == 0)
+				continue;
 
-			std::copy(wpi->second->data, wpi->second->data + wpi->second->length, std::back_inserter(m_wait_buffer));
-			m_waiting_packets.erase(wpi);
+			reassemble_stream(*m_streams[n]);
+		}
+	}
 
-			for (uint32_t pos = 0; pos < m_wait_buffer.size(); ) {
-				const uint8_t* bufp = &m_wait_buffer[pos];
+	void udp_connection::reassemble_stream(udp_stream& stream) {
+		ALLOC_AUDIT_SCOPE("reassembly");
+		PHASE_TIMER(timer, m_metrics.phases, phase_metrics::PHASE_REASSEMBLY);
 
-				const uint32_t msg_length = m_wait_buffer.size() - pos;
-				const int32_t pkt_length = proto_def.packet_length(bufp, msg_length);
+		// process all in-order chunks that we have waiting
+		for (auto wci = stream.waiting_chunks.find(stream.last_inorder + 1); wci != stream.waiting_chunks.end(); wci = stream.waiting_chunks.find(stream.last_inorder + 1)) {
+			stream.last_inorder += 1;
+			stream.stream_dec.feed(wci->second->get_data(), wci->second->chunk_size);
 
-				// this returns false for zero or invalid pkt_length
-				if (proto_def.is_valid_length(pkt_length, msg_length)) {
-					m_msg_queue.push_back(std::shared_ptr<const raw_packet>(new raw_packet(bufp, pkt_length)));
+			const auto wti = stream.waiting_times.find(wci->first);
 
-					pos += pkt_length;
-				} else {
-					if (pkt_length >= 0) {
-						// partial packet in buffer
-						m_fragment_buffer = std::move(raw_packet(bufp, msg_length));
-						break;
-					}
+			if (wti != stream.waiting_times.end()) {
+				m_latency_stats->stages[message_latency_stats::STAGE_REASSEMBLY].record(std::chrono::high_resolution_clock::now() - wti->second);
+				stream.waiting_times.erase(wti);
+			}
+
+			stream.waiting_chunks.erase(wci);
+		}
 
-					fprintf(stderr, "[%s] discarding incoming invalid packet: id %d, len %d", __func__, int32_t(*bufp), pkt_length);
+		// combine fragment with wait-buffer (packet reassembly)
+		m_wait_buffer.assign(stream.fragment_buffer.begin(), stream.fragment_buffer.end());
+		stream.fragment_buffer.clear();
 
-					// skip a single byte until we encounter a valid packet
-					pos += 1;
+		const bool stream_intact = stream.stream_dec.decode(m_wait_buffer);
+
+		if (!stream_intact)
+			fprintf(stderr, "[%s] discarding incoming corrupted stream block", __func__);
+
+		for (uint32_t pos = 0; pos < m_wait_buffer.size(); ) {
+			const uint8_t* bufp = &m_wait_buffer[pos];
+
+			const uint32_t msg_length = m_wait_buffer.size() - pos;
+
+			// for delta-coded ids this is the length of the record rather than the packet
+			const bool delta_coded = proto_def.is_delta_type(*bufp);
+			const int32_t pkt_length = delta_coded? stream.delta_dec.decode_record(bufp, msg_length, m_delta_buffer): proto_def.packet_length(bufp, msg_length);
+
+			// this returns false for zero or invalid pkt_length
+			if (proto_def.is_valid_length(pkt_length, msg_length)) {
+				if (m_traffic_stats != nullptr)
+					m_traffic_stats->record_recv(*bufp, pkt_length);
+
+				if (delta_coded) {
+					stream.msg_queue.push_back(make_pooled<raw_packet>(&m_delta_buffer[0], m_delta_buffer.size()));
+				} else {
+					stream.msg_queue.push_back(make_pooled<raw_packet>(bufp, pkt_length));
 				}
+
+				pos += pkt_length;
+			} else {
+				if (pkt_length >= 0) {
+					// partial packet in buffer
+					stream.fragment_buffer.assign(bufp, bufp + msg_length);
+					break;
+				}
+
+				fprintf(stderr, "[%s] discarding incoming invalid packet: id %d, len %d", __func__, int32_t(*bufp), pkt_length);
+
+				// skip a single byte until we encounter a valid packet
+				pos += 1;
 			}
 		}
+
+		// the rest of a partial packet went down with the corrupted block
+		if (!stream_intact)
+			stream.fragment_buffer.clear();
 	}
 
 	void udp_connection::flush(const bool forced) {
 		if (m_muted)
 			return;
 
-		const net_time_point cur_flush_time{std::chrono::high_resolution_clock::now()};
-		const net_time_range dif_flush_time{cur_flush_time - m_prv_chunk_created_time}; // ns
-		const net_time_range max_chunk_time{(1000ll * 1000ll * 1000ll) / config::udp_chunks_per_sec}; // ns per chunk
-		const net_time_range nlf_limit_time{(200 >> m_netloss_factor) * 1000ll * 1000ll}; // (200 >> nlf) ms
+		ALLOC_AUDIT_SCOPE("flush");
 
-		// do not create chunks faster than <udp_chunks_per_sec> Hz
-		const bool wait_more = (m_prv_chunk_created_time >= (cur_flush_time - max_chunk_time));
+		// an open batch leaves as a whole once it ends
+		if (m_batch_depth == 0 || forced) {
+			flush_unordered(forced);
 
-		// subtract dt to reduce send frequency of tiny packets (which barely contribute to outgoing_length)
-		const int32_t required_length = (nlf_limit_time - dif_flush_time).count() / (10ll * 1000ll * 1000ll);
+			// coalesce reliable data until it fills a datagram or runs out of latency budget
+			if (forced || m_batch_ended || std::chrono::high_resolution_clock::now() >= get_flush_deadline()) {
+				bool send_more_data = true;
 
-		int32_t outgoing_length = 0;
+				for (uint8_t n = 0; n < MAX_STREAMS && send_more_data; ++n) {
+					const uint8_t stream_idx = (m_flush_stream + n) % MAX_STREAMS;
 
-		if (!wait_more) {
-			for (auto pi = m_outgoing_data.begin(); (pi != m_outgoing_data.end()) && (outgoing_length <= required_length); ++pi) {
-				outgoing_length += (*pi)->length;
+					if (m_streams[stream_idx] == nullptr || m_streams[stream_idx]->outgoing_data.empty())
+						continue;
+
+					send_more_data = flush_stream(*m_streams[stream_idx], stream_idx, forced);
+				}
+
+				m_flush_stream = (m_flush_stream + 1) % MAX_STREAMS;
 			}
+
+			m_batch_ended = false;
 		}
 
-		if (forced || (!wait_more && outgoing_length > required_length)) {
-			uint8_t buffer[udp_packet::max_size()];
-			uint32_t pos = 0;
+		send_if_necessary(forced);
+		update_gauges();
+	}
 
-			// manually fragment packets to respect configured MTU
-			bool partial_packet = false;
-			bool send_more_data = true;
+	void udp_connection::update_gauges() {
+		uint64_t waiting_chunks = 0;
+		uint64_t reassembly_bytes = 0;
 
-			do {
-				send_more_data  = (m_outgoing_bw_tracker.get_average(true) <= config::link_outgoing_bandwidth);
-				send_more_data |= ((config::link_outgoing_bandwidth <= 0) || partial_packet || forced);
+		for (uint8_t n = 0; n < MAX_STREAMS; ++n) {
+			if (m_streams[n] == nullptr)
+				continue;
 
-				if (!m_outgoing_data.empty() && send_more_data) {
-					std::shared_ptr<const raw_packet>& raw_pkt = *(m_outgoing_data.begin());
+			for (const auto& pair: m_streams[n]->waiting_chunks) {
+				reassembly_bytes += pair.second->chunk_size;
+			}
 
-					if (!partial_packet && !proto_def.is_valid_packet(raw_pkt->data, raw_pkt->length)) {
-						// discard invalid outgoing raw packet
-						m_outgoing_data.pop_front();
-					} else {
-						const uint32_t num_chunk_bytes = std::min(udp_packet_chunk::max_size() - pos, raw_pkt->length);
+			waiting_chunks += m_streams[n]->waiting_chunks.size();
+			reassembly_bytes += m_streams[n]->fragment_buffer.size();
+		}
 
-						assert(raw_pkt->length > 0);
-						memcpy(buffer + pos, raw_pkt->data, num_chunk_bytes);
+		m_metrics.outgoing_queue_bytes.set(m_outgoing_bytes);
+		m_metrics.pending_chunk_bytes.set(m_queued_chunk_bytes);
+		m_metrics.unacked_chunks.set(m_unacked_chunks.size());
+		m_metrics.waiting_chunks.set(waiting_chunks);
+		m_metrics.reassembly_bytes.set(reassembly_bytes);
+	}
 
-						pos += num_chunk_bytes;
-						m_recv_overhead += udp_packet::hdr_size();
+	void udp_connection::end_batch() {
+		assert(m_batch_depth > 0);
 
-						m_outgoing_bw_tracker.data_sent(num_chunk_bytes, true);
+		if ((m_batch_depth -= 1) > 0)
+			return;
 
-						if ((partial_packet = (num_chunk_bytes != raw_pkt->length))) {
-							// partially transfered
-							raw_pkt.reset(new raw_packet(raw_pkt->data + num_chunk_bytes, raw_pkt->length - num_chunk_bytes));
-						} else {
-							// full packet copied
-							m_outgoing_data.pop_front();
-						}
+		m_batch_ended = true;
+		flush(false);
+		wake();
+	}
+
+	net_time_point udp_connection::get_flush_deadline() const {
+		if (m_batch_depth > 0)
+			return net_time_point::max();
+
+		// unordered packets never wait, nor does a full datagram
+		if (!m_outgoing_unordered.empty() || (m_outgoing_bytes + udp_packet::hdr_size()) >= m_max_transmission_unit)
+			return net_time_point::min();
+
+		net_time_point deadline = net_time_point::max();
+
+		for (uint8_t n = 0; n < MAX_STREAMS; ++n) {
+			if (m_streams[n] == nullptr || m_streams[n]->outgoing_data.empty())
+				continue;
+
+			deadline = std::min(deadline, m_streams[n]->queue_time + m_streams[n]->latency_budget);
+		}
+
+		return deadline;
+	}
+
+	bool udp_connection::flush_stream(udp_stream& stream, const uint8_t stream_idx, const bool forced) {
+		PHASE_TIMER(timer, m_metrics.phases, phase_metrics::PHASE_FRAGMENT);
+
+		const net_time_point cur_flush_time = (m_latency_stats != nullptr)? std::chrono::high_resolution_clock::now(): net_time_point();
+
+		// drops the front packet, which was either chunked or found invalid
+		const auto pop_outgoing = [&](const raw_packet& raw_pkt, bool chunked) {
+			if (m_latency_stats != nullptr) {
+				if (chunked)
+					m_latency_stats->stages[message_latency_stats::STAGE_QUEUED].record(cur_flush_time - stream.outgoing_times.front());
+
+				stream.outgoing_times.pop_front();
+			}
+
+			m_outgoing_bytes -= raw_pkt.length;
+			stream.outgoing_data.pop_front();
+		};
+
+		bool send_more_data = true;
+
+		// largest packet in the block, its chunks are charged to it on resends
+		uint32_t max_pkt_length = 0;
+		uint8_t max_pkt_id = 0;
+
+		m_block_buffer.clear();
+
+		do {
+			// only chunk what the pacer can let out soon, the rest may still join a later block
+			send_more_data = m_pacer.can_send(m_queued_chunk_bytes + m_block_buffer.size()) || forced;
+
+			if (!stream.outgoing_data.empty() && send_more_data) {
+				const std::shared_ptr<const raw_packet>& raw_pkt = *(stream.outgoing_data.begin());
+
+				if (!proto_def.is_valid_packet(raw_pkt->data, raw_pkt->length)) {
+					// discard invalid outgoing raw packet
+					pop_outgoing(*raw_pkt, false);
+					continue;
+				}
+
+				const bool delta_coded = proto_def.is_delta_type(raw_pkt->data[0]);
+				const uint32_t max_pkt_size = delta_coded? delta_codec::max_record_size(raw_pkt->length): raw_pkt->length;
+
+				// blocks only ever contain whole packets
+				if ((m_block_buffer.size() + max_pkt_size) > stream_codec::max_block_size())
+					break;
+
+				assert(raw_pkt->length > 0);
+
+				const uint32_t block_size = m_block_buffer.size();
+
+				if (delta_coded) {
+					stream.delta_enc.encode_record(raw_pkt->data, raw_pkt->length, m_block_buffer);
+				} else {
+					m_block_buffer.insert(m_block_buffer.end(), raw_pkt->data, raw_pkt->data + raw_pkt->length);
+				}
+
+				if (m_traffic_stats != nullptr) {
+					m_traffic_stats->record_sent(raw_pkt->data[0], m_block_buffer.size() - block_size);
+
+					if (raw_pkt->length > max_pkt_length) {
+						max_pkt_length = raw_pkt->length;
+						max_pkt_id = raw_pkt->data[0];
 					}
 				}
 
-				if ((pos > 0) && (m_outgoing_data.empty() || (pos == udp_packet_chunk::max_size()) || !send_more_data)) {
-					create_chunk(buffer, pos, m_packet_chunk_num++);
-					pos = 0;
+				pop_outgoing(*raw_pkt, true);
+			}
+		} while (!stream.outgoing_data.empty() && send_more_data);
+
+		if (m_block_buffer.empty())
+			return send_more_data;
+
+		const bool compress = (m_stream_compression && m_peer_stream_compression);
+
+		m_encode_buffer.clear();
+		stream.stream_enc.encode_block(&m_block_buffer[0], m_block_buffer.size(), compress, m_encode_buffer);
+
+		m_metrics.stream_raw_bytes.add(m_block_buffer.size());
+		m_metrics.stream_enc_bytes.add(m_encode_buffer.size());
+
+		// manually fragment the block to respect configured MTU
+		for (uint32_t pos = 0; pos < m_encode_buffer.size(); ) {
+			const uint32_t num_chunk_bytes = std::min(udp_packet_chunk::max_size(), uint32_t(m_encode_buffer.size() - pos));
+
+			create_chunk(&m_encode_buffer[pos], num_chunk_bytes, m_packet_chunk_num++, DELIVERY_RELIABLE_ORDERED | (stream_idx << 2), stream.next_sequence++, max_pkt_id);
+
+			pos += num_chunk_bytes;
+			m_metrics.sent_overhead.add(udp_packet_chunk::hdr_size() + sizeof(uint16_t));
+		}
+
+		return send_more_data;
+	}
+
+	void udp_connection::flush_unordered(const bool forced) {
+		PHASE_TIMER(timer, m_metrics.phases, phase_metrics::PHASE_FRAGMENT);
+
+		uint8_t buffers[4][udp_packet_chunk::max_size()];
+		uint8_t channels[4] = {0, 0, 0, 0};
+		uint32_t sizes[4] = {0, 0, 0, 0};
+
+		// largest packet in each chunk, for charging resends
+		uint32_t max_lengths[4] = {0, 0, 0, 0};
+		uint8_t max_ids[4] = {0, 0, 0, 0};
+
+		const auto create_class_chunk = [&](uint8_t delivery) {
+			if (sizes[delivery] == 0)
+				return;
+
+			if (delivery == DELIVERY_RELIABLE_UNORDERED) {
+				create_chunk(buffers[delivery], sizes[delivery], m_packet_chunk_num++, channels[delivery], 0, max_ids[delivery]);
+			} else {
+				create_chunk(buffers[delivery], sizes[delivery], m_unreliable_chunk_num++, channels[delivery], 0, max_ids[delivery]);
+			}
+
+			m_metrics.sent_overhead.add(udp_packet_chunk::hdr_size());
+			sizes[delivery] = 0;
+			max_lengths[delivery] = 0;
+		};
+
+		while (!m_outgoing_unordered.empty()) {
+			if (!m_pacer.can_send(m_queued_chunk_bytes) && !forced)
+				break;
+
+			const std::shared_ptr<const raw_packet>& raw_pkt = m_outgoing_unordered.front().first;
+
+			const uint8_t channel = m_outgoing_unordered.front().second;
+			const uint8_t delivery = channel & 3;
+
+			if (proto_def.is_valid_packet(raw_pkt->data, raw_pkt->length)) {
+				// several small packets of the same class and stream can share a chunk
+				if ((sizes[delivery] + raw_pkt->length) > udp_packet_chunk::max_size() || channels[delivery] != channel)
+					create_class_chunk(delivery);
+
+				std::memcpy(&buffers[delivery][sizes[delivery]], raw_pkt->data, raw_pkt->length);
+
+				channels[delivery] = channel;
+				sizes[delivery] += raw_pkt->length;
+
+				if (m_traffic_stats != nullptr) {
+					m_traffic_stats->record_sent(raw_pkt->data[0], raw_pkt->length);
+
+					if (raw_pkt->length > max_lengths[delivery]) {
+						max_lengths[delivery] = raw_pkt->length;
+						max_ids[delivery] = raw_pkt->data[0];
+					}
 				}
-			} while (!m_outgoing_data.empty() && send_more_data);
+			}
+
+			m_outgoing_unordered.pop_front();
 		}
 
-		send_if_necessary(forced);
+		create_class_chunk(DELIVERY_RELIABLE_UNORDERED);
+		create_class_chunk(DELIVERY_UNRELIABLE_SEQUENCED);
+		create_class_chunk(DELIVERY_UNRELIABLE);
+	}
+
+	void udp_connection::send_broadcast_block(const udp_broadcast_block& block) {
+		if (m_closed)
+			return;
+
+		ALLOC_AUDIT_SCOPE("send_data");
+		PHASE_TIMER(timer, m_metrics.phases, phase_metrics::PHASE_FRAGMENT);
+
+		const uint8_t delivery = block.channel & 3;
+		const uint8_t stream_idx = (block.channel >> 2) & 15;
+
+		if (delivery == DELIVERY_RELIABLE_ORDERED) {
+			udp_stream& stream = get_stream(stream_idx);
+
+			while (!stream.outgoing_data.empty()) {
+				flush_stream(stream, stream_idx, true);
+			}
+
+			// both codecs must see the block as if they had produced it
+			for (const std::shared_ptr<const raw_packet>& pkt: block.delta_packets) {
+				stream.delta_enc.add_full_record(pkt->data, pkt->length);
+			}
+
+			stream.stream_enc.add_raw_block(&block.raw_data[0], block.raw_data.size());
+
+			m_metrics.stream_raw_bytes.add(block.raw_data.size());
+			m_metrics.stream_enc_bytes.add(block.get_payload_bytes());
+		} else {
+			flush_unordered(true);
+		}
+
+		for (size_t n = 0; n < block.payloads.size(); ++n) {
+			const uint32_t size = block.payload_sizes[n];
+
+			switch (delivery) {
+				case DELIVERY_RELIABLE_ORDERED: {
+					create_chunk(block.payloads[n], size, m_packet_chunk_num++, block.channel, get_stream(stream_idx).next_sequence++, block.msg_id);
+					m_metrics.sent_overhead.add(udp_packet_chunk::hdr_size() + sizeof(uint16_t));
+				} break;
+				case DELIVERY_RELIABLE_UNORDERED: {
+					create_chunk(block.payloads[n], size, m_packet_chunk_num++, block.channel, 0, block.msg_id);
+					m_metrics.sent_overhead.add(udp_packet_chunk::hdr_size());
+				} break;
+				default: {
+					create_chunk(block.payloads[n], size, m_unreliable_chunk_num++, block.channel, 0, block.msg_id);
+					m_metrics.sent_overhead.add(udp_packet_chunk::hdr_size());
+				} break;
+			}
+		}
+
+		wake();
+
+		if (m_traffic_stats == nullptr)
+			return;
+
+		for (const std::pair<uint8_t, uint32_t>& msg: block.msg_sizes) {
+			m_traffic_stats->record_sent(msg.first, msg.second);
+		}
+	}
+
+	bool udp_connection::join_multicast(const std::string& address, uint16_t port, uint8_t stream, const std::string& interface) {
+		assert(stream < MAX_STREAMS);
+
+		asio::error_code error_code;
+
+		const asio::ip::udp::endpoint group_endpoint(wrap_ip(address, &error_code), port);
+
+		std::unique_ptr<udp_multicast_state> state(new udp_multicast_state());
+		state->socket.reset(new asio::ip::udp::socket(netservice));
+
+		if (!error_code)
+			state->socket->open(group_endpoint.protocol(), error_code);
+		// every receiver on a host binds the same group and port
+		if (!error_code)
+			state->socket->set_option(asio::ip::udp::socket::reuse_address(true), error_code);
+		if (!error_code)
+			state->socket->bind(group_endpoint, error_code);
+
+		if (!error_code) {
+			if (!interface.empty() && group_endpoint.address().is_v4()) {
+				state->socket->set_option(asio::ip::multicast::join_group(group_endpoint.address().to_v4(), wrap_ip(interface, &error_code).to_v4()), error_code);
+			} else {
+				state->socket->set_option(asio::ip::multicast::join_group(group_endpoint.address()), error_code);
+			}
+		}
+
+		if (check_error_code(error_code)) {
+			fprintf(stderr, "[%s] failed to join multicast group %s:%u", __func__, address.c_str(), port);
+			return false;
+		}
+
+		state->prv_report_time = std::chrono::high_resolution_clock::now();
+		state->stream = stream;
+		state->receiving = true;
+
+		m_multicast = std::move(state);
+		wake();
+		return true;
+	}
+
+	void udp_connection::leave_multicast() {
+		m_multicast.reset();
+	}
+
+	void udp_connection::set_multicast_state(std::unique_ptr<udp_multicast_state> state) {
+		m_multicast = std::move(state);
+		wake();
+	}
+
+	bool udp_connection::has_multicast_repairs() const {
+		return (m_multicast != nullptr && (m_multicast->report_due || !m_multicast->repair_chunks.empty()));
+	}
+
+	void udp_connection::recv_multicast() {
+		asio::ip::udp::socket& socket = *m_multicast->socket;
+
+		size_t bytes_available = 0;
+
+		while ((bytes_available = socket.available()) > 0) {
+			m_recv_buffer.clear();
+			m_recv_buffer.resize(bytes_available, 0);
+
+			asio::ip::udp::endpoint udp_endpoint;
+			asio::ip::udp::socket::message_flags msg_flags = 0;
+			asio::error_code error_code;
+
+			const size_t bytes_received = socket.receive_from(asio::buffer(m_recv_buffer), udp_endpoint, msg_flags, error_code);
+
+			if (check_error_code(error_code))
+				break;
+
+			if (!udp_packet::has_valid_header(&m_recv_buffer[0], bytes_received))
+				continue;
+
+			PHASE_TIMER(parse_timer, m_metrics.phases, phase_metrics::PHASE_PARSE);
+			udp_packet data(&m_recv_buffer[0], bytes_received);
+			PHASE_TIMER_STOP(parse_timer);
+
+			process_multicast_packet(data);
+		}
+	}
+
+	void udp_connection::process_multicast_packet(udp_packet& pkt) {
+		ALLOC_AUDIT_SCOPE("process_packet");
+
+		m_metrics.data_recv.add(pkt.calc_size());
+		m_metrics.recv_overhead.add(udp_packet::hdr_size());
+		m_metrics.recv_packets.add(1);
+
+		if (pkt.calc_checksum(m_crc) != pkt.checksum) {
+			fprintf(stderr, "[%s] discarding incoming corrupted multicast packet: CRC %d, LEN %d", __func__, pkt.checksum, pkt.calc_size());
+			return;
+		}
+
+		bool ready = false;
+
+		for (const std::shared_ptr<udp_packet_chunk>& chunk: pkt.chunks) {
+			if (chunk->is_multicast())
+				ready |= process_multicast_chunk(chunk);
+		}
+
+		if (ready)
+			reassemble_stream(get_stream(m_multicast->stream));
+	}
+
+	bool udp_connection::process_multicast_chunk(const std::shared_ptr<udp_packet_chunk>& chunk) {
+		udp_multicast_state& state = *m_multicast;
+
+		if (!state.receiving)
+			return false;
+
+		if (!state.synced) {
+			if (state.early_chunks.size() < config::multicast_history_chunks)
+				state.early_chunks.push_back(chunk);
+
+			return false;
+		}
+
+		udp_stream& stream = get_stream(state.stream);
+
+		switch (chunk->get_delivery()) {
+			case DELIVERY_RELIABLE_ORDERED:
+			case DELIVERY_RELIABLE_UNORDERED: {
+				if ((state.last_inorder >= chunk->chunk_number) || (state.received_chunks.find(chunk->chunk_number) != state.received_chunks.end())) {
+					m_metrics.dropped_chunks.add(1);
+					return false;
+				}
+
+				// a new gap is reported right away
+				state.report_due |= (state.received_chunks.empty() && chunk->chunk_number != (state.last_inorder + 1));
+				state.received_chunks.insert(chunk->chunk_number);
+
+				for (auto rci = state.received_chunks.begin(); rci != state.received_chunks.end() && *rci == (state.last_inorder + 1); rci = state.received_chunks.erase(rci)) {
+					state.last_inorder += 1;
+				}
+
+				if (chunk->get_delivery() == DELIVERY_RELIABLE_UNORDERED) {
+					queue_chunk_packets(*chunk, stream);
+					return false;
+				}
+
+				stream.waiting_chunks.emplace(stream.unwrap_sequence(chunk->stream_seq), chunk);
+
+				if (m_latency_stats != nullptr)
+					stream.waiting_times.emplace(stream.unwrap_sequence(chunk->stream_seq), std::chrono::high_resolution_clock::now());
+
+				return true;
+			} break;
+
+			case DELIVERY_UNRELIABLE_SEQUENCED: {
+				if (stream.last_sequenced >= chunk->chunk_number) {
+					m_metrics.dropped_chunks.add(1);
+					return false;
+				}
+
+				stream.last_sequenced = chunk->chunk_number;
+				queue_chunk_packets(*chunk, stream);
+			} break;
+
+			case DELIVERY_UNRELIABLE: {
+				queue_chunk_packets(*chunk, stream);
+			} break;
+		}
+
+		return false;
+	}
+
+	bool udp_connection::process_multicast_report(const udp_packet& pkt) {
+		udp_multicast_state& state = *m_multicast;
+
+		if (!state.receiving) {
+			if ((pkt.flags & udp_packet::PKT_FLAG_MCAST_ACK) == 0)
+				return false;
+
+			if (pkt.mcast_last_continuous > state.last_inorder) {
+				state.last_inorder = pkt.mcast_last_continuous;
+				state.prv_report_time = std::chrono::high_resolution_clock::now();
+			}
+
+			for (const uint8_t nak: pkt.mcast_naks) {
+				state.naks.push_back(pkt.mcast_last_continuous + 1 + nak);
+			}
+
+			state.synced = true;
+			return false;
+		}
+
+		if ((pkt.flags & udp_packet::PKT_FLAG_MCAST_SYNC) == 0 || state.synced)
+			return false;
+
+		state.first_chunk = pkt.mcast_first_chunk;
+		state.first_sequence = pkt.mcast_first_sequence;
+		state.last_inorder = pkt.mcast_first_chunk - 1;
+		state.synced = true;
+		state.report_due = true;
+
+		get_stream(state.stream).last_inorder = pkt.mcast_first_sequence - 1;
+
+		bool ready = false;
+
+		// anything sent before the join point is dropped as a duplicate
+		for (const std::shared_ptr<udp_packet_chunk>& chunk: state.early_chunks) {
+			ready |= process_multicast_chunk(chunk);
+		}
+
+		state.early_chunks.clear();
+		return ready;
+	}
+
+	void udp_connection::add_multicast_report(udp_packet& pkt, const net_time_point& cur_time, const net_time_range& nak_time) {
+		udp_multicast_state& state = *m_multicast;
+
+		state.report_due = false;
+
+		if (!state.receiving) {
+			// until the other end acks, which implies it knows the join point
+			if (state.synced)
+				return;
+
+			pkt.flags |= udp_packet::PKT_FLAG_MCAST_SYNC;
+			pkt.mcast_first_chunk = state.first_chunk;
+			pkt.mcast_first_sequence = state.first_sequence;
+			return;
+		}
+
+		if (!state.synced)
+			return;
+
+		pkt.flags |= udp_packet::PKT_FLAG_MCAST_ACK;
+		pkt.mcast_last_continuous = state.last_inorder;
+
+		// naks take a byte each, so do not repeat them too often
+		if (state.received_chunks.empty() || (cur_time - state.prv_report_time) < nak_time)
+			return;
+
+		int32_t chunk_num = state.last_inorder + 1;
+
+		for (auto rci = state.received_chunks.begin(); rci != state.received_chunks.end() && pkt.mcast_naks.size() < 255; ++rci, ++chunk_num) {
+			for (; chunk_num < *rci && (chunk_num - state.last_inorder - 1) <= 255 && pkt.mcast_naks.size() < 255; ++chunk_num) {
+				pkt.mcast_naks.push_back(chunk_num - (state.last_inorder + 1));
+			}
+		}
+
+		state.prv_report_time = cur_time;
+	}
+
+	net_time_point udp_connection::get_next_departure_time() const {
+		if (m_muted)
+			return net_time_point::max();
+
+		const net_time_point flush_deadline = get_flush_deadline();
+
+		net_time_point departure_time = net_time_point::max();
+
+		// due data can only be chunked once the pacer has room past the pending chunks
+		if (flush_deadline != net_time_point::max())
+			departure_time = std::max(flush_deadline, m_pacer.get_departure_time(m_queued_chunk_bytes));
+
+		if (m_new_chunks.empty() && m_unreliable_chunks.empty() && m_resend_req_pkts.empty() && !has_multicast_repairs() && m_path_response == 0)
+			return departure_time;
+
+		return (std::min(departure_time, m_pacer.get_departure_time()));
+	}
+
+	void udp_connection::send_paced() {
+		flush(false);
+		schedule_update(std::chrono::high_resolution_clock::now());
+	}
+
+	net_time_point udp_connection::get_next_update_time() const {
+		// nobody else watches a multicast member's socket
+		if (!m_closed && m_multicast != nullptr && m_multicast->socket != nullptr)
+			return net_time_point::min();
+
+		return (get_next_timer_time());
+	}
+
+	net_time_point udp_connection::get_next_timer_time() const {
+		if (m_closed)
+			return net_time_point::max();
+
+		net_time_point update_time = get_next_departure_time();
+
+		if (m_probe_nonce != 0)
+			update_time = std::min(update_time, m_prv_probe_time + std::chrono::milliseconds(config::path_probe_interval_ms));
+
+		// muted connections neither send nor ack anything
+		if (m_muted)
+			return update_time;
+
+		const net_time_range max_unack_time = get_max_unack_time();
+
+		// see send_if_necessary; keepalives also carry the ack
+		update_time = std::min(update_time, m_prv_packet_send_time + max_unack_time / 2);
+
+		if (!m_received_chunks.empty())
+			update_time = std::min(update_time, m_prv_nak_time + max_unack_time / 2);
+		if (!m_unacked_chunks.empty())
+			update_time = std::min(update_time, std::max(m_prv_chunk_created_time, m_prv_unack_resend_time) + max_unack_time);
+
+		return update_time;
+	}
+
+	bool udp_connection::wait(net_time_range timeout) {
+		if (m_waiter == nullptr)
+			return false;
+
+		const net_time_point cur_time = std::chrono::high_resolution_clock::now();
+		const net_time_point timeout_time = cur_time + timeout;
+
+		asio::error_code error_code;
+
+		if (!m_closed && m_socket->available(error_code) > 0)
+			return true;
+
+		if (!m_closed && m_multicast != nullptr && m_multicast->socket != nullptr) {
+			if (m_multicast->socket->available(error_code) > 0)
+				return true;
+
+			// groups come and go, re-adding a watched socket does nothing
+			m_waiter->add_socket(*m_multicast->socket);
+		}
+
+		// before the next update time is known, so work queued meanwhile wakes us
+		m_waiter->arm();
+
+		const net_time_point deadline = std::min(timeout_time, get_next_timer_time());
+
+		return (m_waiter->wait_until(deadline) || deadline < timeout_time);
+	}
+
+	void udp_connection::schedule_update(const net_time_point& cur_time) {
+		if (m_timer_wheel == nullptr)
+			return;
+
+		// even idle connections are visited now and then, so the listener notices their owners letting go
+		m_timer_wheel->schedule(m_timer, std::min(get_next_update_time(), cur_time + std::chrono::milliseconds(config::udp_idle_update_ms)));
 	}
 
 	bool udp_connection::check_timeout(int32_t seconds, bool initial) const {
@@ -360,7 +1190,7 @@ namespace arelion {
 
 		switch (util::clamp(seconds, -1, 1)) {
 			case  0: {
-				timeout_secs = (m_data_recv > 0 && !initial)? config::network_timeout_secs: config::initial_network_timeout_secs;
+				timeout_secs = (m_metrics.data_recv.get() > 0 && !initial)? config::network_timeout_secs: config::initial_network_timeout_secs;
 			} break;
 			case  1: {
 				timeout_secs = seconds;
@@ -396,20 +1226,97 @@ namespace arelion {
 
 
 	std::string udp_connection::get_statistics() const {
-		char buf[512] = {0};
+		const connection_metrics metrics = get_metrics();
+
+		const uint64_t data_sent = metrics.data_sent.get();
+		const uint64_t data_recv = metrics.data_recv.get();
+		const uint64_t sent_packets = metrics.sent_packets.get();
+		const uint64_t recv_packets = metrics.recv_packets.get();
+		const uint64_t stream_raw_bytes = metrics.stream_raw_bytes.get();
+		const uint64_t stream_enc_bytes = metrics.stream_enc_bytes.get();
+
+		char buf[4096] = {0};
 		char* ptr = &buf[0];
 		const char* fmts[] = {
-			"\t%u bytes sent   in %u packets (%.3f bytes/packet)\n",
-			"\t%u bytes recv'd in %u packets (%.3f bytes/packet)\n",
+			"\t%" PRIu64 " bytes sent   in %" PRIu64 " packets (%.3f bytes/packet)\n",
+			"\t%" PRIu64 " bytes recv'd in %" PRIu64 " packets (%.3f bytes/packet)\n",
 			"\t{%.3fx, %.3fx} relative protocol overhead {up, down}\n",
-			"\t%u incoming chunks dropped, %u outgoing chunks resent\n",
+			"\t%" PRIu64 " incoming chunks dropped, %" PRIu64 " outgoing chunks resent\n",
+			"\t%" PRIu64 " stream bytes compressed to %" PRIu64 " (%.3fx)\n",
+			"\t%-10s latency: %" PRIu64 " samples, mean %" PRIu64 "us, p50 %" PRIu64 "us, p99 %" PRIu64 "us, max %" PRIu64 "us\n",
+			"\t%-10s phase: %" PRIu64 " calls, %.3fms total, %.3fus per call\n",
+			"\tid %3u %-16s sent %" PRIu64 " msgs %" PRIu64 " bytes, recv'd %" PRIu64 " msgs %" PRIu64 " bytes, resent %" PRIu64 " bytes\n",
 		};
 
 		ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), "[udp_connection::%s]\n", __func__);
-		ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), fmts[0], m_data_sent, m_sent_packets, m_data_sent * 1.0f / m_sent_packets);
-		ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), fmts[1], m_data_recv, m_recv_packets, m_data_recv * 1.0f / m_recv_packets);
-		ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), fmts[2], m_sent_overhead * 1.0f / m_data_sent, m_recv_overhead * 1.0f / m_data_recv);
-		ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), fmts[3], m_dropped_chunks, m_resent_chunks);
+		ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), fmts[0], data_sent, sent_packets, data_sent * 1.0f / sent_packets);
+		ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), fmts[1], data_recv, recv_packets, data_recv * 1.0f / recv_packets);
+		ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), fmts[2], metrics.sent_overhead.get() * 1.0f / data_sent, metrics.recv_overhead.get() * 1.0f / data_recv);
+		ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), fmts[3], metrics.dropped_chunks.get(), metrics.resent_chunks.get());
+		ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), fmts[4], stream_raw_bytes, stream_enc_bytes, stream_enc_bytes * 1.0f / stream_raw_bytes);
+
+		for (uint32_t n = 0; m_latency_stats != nullptr && n < message_latency_stats::NUM_STAGES; ++n) {
+			const latency_histogram& hist = m_latency_stats->stages[n];
+
+			ptr += snprintf(
+				ptr,
+				sizeof(buf) - (ptr - buf),
+				fmts[5],
+				message_latency_stats::get_stage_name(n),
+				hist.get_count(),
+				hist.get_mean(),
+				hist.get_percentile(0.5f),
+				hist.get_percentile(0.99f),
+				hist.get_max()
+			);
+		}
+
+		// only collected by profiler builds
+		for (uint32_t n = 0; n < phase_metrics::NUM_PHASES; ++n) {
+			const uint64_t calls = metrics.phases.calls[n].get();
+
+			// converting calibrates the tick rate on first use, which takes a while
+			if (calls == 0)
+				continue;
+
+			const double secs = phase_profiler::ticks_to_secs(metrics.phases.ticks[n].get());
+
+			ptr += snprintf(ptr, sizeof(buf) - (ptr - buf), fmts[6], phase_metrics::get_phase_name(n), calls, secs * 1e3, secs * 1e6 / calls);
+		}
+
+		if (m_traffic_stats != nullptr) {
+			const message_traffic_stats::id_counters* ids = m_traffic_stats->ids;
+
+			std::vector<uint8_t> top_ids;
+
+			for (uint32_t id = 0; id < 256; ++id) {
+				if (ids[id].get_total_bytes() > 0)
+					top_ids.push_back(id);
+			}
+
+			// the heaviest ids only, the buffer is limited
+			const auto cmp = [&](uint8_t a, uint8_t b) { return (ids[a].get_total_bytes() > ids[b].get_total_bytes()); };
+			const size_t num_ids = std::min(top_ids.size(), size_t(12));
+
+			std::partial_sort(top_ids.begin(), top_ids.begin() + num_ids, top_ids.end(), cmp);
+
+			for (size_t n = 0; n < num_ids; ++n) {
+				const message_traffic_stats::id_counters& c = ids[top_ids[n]];
+
+				ptr += snprintf(
+					ptr,
+					sizeof(buf) - (ptr - buf),
+					fmts[7],
+					top_ids[n],
+					proto_def.get_type_name(top_ids[n]),
+					c.sent_msgs.get(),
+					c.sent_bytes.get(),
+					c.recv_msgs.get(),
+					c.recv_bytes.get(),
+					c.resent_bytes.get()
+				);
+			}
+		}
 
 		return buf;
 	}
@@ -425,30 +1332,76 @@ namespace arelion {
 	}
 
 
-	void udp_connection::create_chunk(const uint8_t* data, const uint32_t length, const int32_t chunk_num) {
+	void udp_connection::create_chunk(const uint8_t* data, const uint32_t length, const int32_t chunk_num, const uint8_t channel, const uint16_t stream_seq, const uint8_t msg_id) {
 		assert((length > 0) && (length < 255));
 
-		std::shared_ptr<udp_packet_chunk> chunk(new udp_packet_chunk());
+		const std::shared_ptr<udp_chunk_payload> payload = udp_chunk_payload::create();
+
+		std::memcpy(payload->data, data, length);
+		create_chunk(payload, length, chunk_num, channel, stream_seq, msg_id);
+	}
+
+	void udp_connection::create_chunk(std::shared_ptr<const udp_chunk_payload> payload, const uint32_t length, const int32_t chunk_num, const uint8_t channel, const uint16_t stream_seq, const uint8_t msg_id) {
+		assert((length > 0) && (length < 255));
+
+		const std::shared_ptr<udp_packet_chunk> chunk = udp_packet_chunk::create();
 
 		chunk->chunk_number = chunk_num;
 		chunk->chunk_size = length;
+		chunk->channel = channel;
+		chunk->stream_seq = stream_seq;
+		chunk->msg_id = msg_id;
+		chunk->payload = std::move(payload);
+
+		m_queued_chunk_bytes += chunk->calc_size();
 
-		chunk->data.resize(length);
-		chunk->data.assign(data, data + length);
+		if (m_latency_stats != nullptr)
+			chunk->create_time = std::chrono::high_resolution_clock::now();
+
+		if (!chunk->is_reliable()) {
+			m_unreliable_chunks.push_back(chunk);
+			return;
+		}
 
 		m_new_chunks.push_back(chunk);
 
+		// unordered reliable chunks are acked and resent like ordered ones, so
+		// they hold off the tail resend just the same
 		m_prv_chunk_created_time = std::chrono::high_resolution_clock::now();
 	}
 
+	void udp_connection::queue_chunk_packets(const udp_packet_chunk& chunk, udp_stream& stream) {
+		for (uint32_t pos = 0; pos < chunk.chunk_size; ) {
+			const uint8_t* bufp = chunk.get_data() + pos;
+
+			const uint32_t msg_length = chunk.chunk_size - pos;
+			const int32_t pkt_length = proto_def.packet_length(bufp, msg_length);
+
+			// unordered packets never span chunks
+			if (!proto_def.is_valid_length(pkt_length, msg_length)) {
+				fprintf(stderr, "[%s] discarding incoming invalid packet: id %d, len %d", __func__, int32_t(*bufp), pkt_length);
+				break;
+			}
+
+			if (m_traffic_stats != nullptr)
+				m_traffic_stats->record_recv(*bufp, pkt_length);
+
+			stream.msg_queue.push_back(make_pooled<raw_packet>(bufp, pkt_length));
+			pos += pkt_length;
+		}
+	}
+
 	void udp_connection::send_if_necessary(bool flushed) {
 		const net_time_point curr_send_time{std::chrono::high_resolution_clock::now()};
 		const net_time_range diff_send_time{curr_send_time - m_prv_packet_send_time};
-		const net_time_range max_unack_time{(400 >> m_netloss_factor) * 1000llu * 1000llu}; // (400 >> nlf) ms
+		const net_time_range max_unack_time = get_max_unack_time();
 
 		const net_time_range chunk_delta_time{curr_send_time - m_prv_chunk_created_time};
 		const net_time_range unack_delta_time{curr_send_time - m_prv_unack_resend_time};
 
+		ALLOC_AUDIT_SCOPE("send_packets");
+		PHASE_TIMER(timer, m_metrics.phases, phase_metrics::PHASE_SCHEDULE);
+
 		int8_t nak_count = 0;
 		int32_t rev_index = 0;
 
@@ -457,8 +1410,8 @@ namespace arelion {
 		{
 			int32_t packet_num = m_last_inorder + 1;
 
-			for (const auto& pair: m_waiting_packets) {
-				const int32_t diff = pair.first - packet_num;
+			for (const int32_t chunk_num: m_received_chunks) {
+				const int32_t diff = chunk_num - packet_num;
 
 				for (int32_t i = 0; i < diff; ++i) {
 					m_dropped_packets.push_back(packet_num++);
@@ -499,8 +1452,8 @@ namespace arelion {
 		}
 
 
-		const bool flush_send = (flushed || !m_new_chunks.empty());
-		const bool other_send = (use_min_loss_factor() && !m_resend_req_pkts.empty());
+		const bool flush_send = (flushed || !m_new_chunks.empty() || !m_unreliable_chunks.empty());
+		const bool other_send = (use_min_loss_factor() && !m_resend_req_pkts.empty()) || has_multicast_repairs() || (m_path_response != 0);
 		const bool unack_send = (nak_count > 0) || (diff_send_time.count() > (max_unack_time.count() * 0.5f));
 
 		if (!flush_send && !other_send && !unack_send)
@@ -509,11 +1462,11 @@ namespace arelion {
 		size_t max_resend_size = m_resend_req_pkts.size();
 		size_t unack_prev_size = m_unacked_chunks.size();
 
-		std::map<int32_t, std::shared_ptr<udp_packet_chunk> >::iterator resend_iter_fwd = m_resend_req_pkts.begin();
-		std::map<int32_t, std::shared_ptr<udp_packet_chunk> >::iterator resend_iter_mid;
-		std::map<int32_t, std::shared_ptr<udp_packet_chunk> >::iterator resend_iter_beg;
-		std::map<int32_t, std::shared_ptr<udp_packet_chunk> >::iterator resend_iter_end;
-		std::map<int32_t, std::shared_ptr<udp_packet_chunk> >::reverse_iterator resend_iter_rev;
+		decltype(m_resend_req_pkts)::iterator resend_iter_fwd = m_resend_req_pkts.begin();
+		decltype(m_resend_req_pkts)::iterator resend_iter_mid;
+		decltype(m_resend_req_pkts)::iterator resend_iter_beg;
+		decltype(m_resend_req_pkts)::iterator resend_iter_end;
+		decltype(m_resend_req_pkts)::reverse_iterator resend_iter_rev;
 
 		if (!use_min_loss_factor()) {
 			// limit resend to a reasonable number of packet chunks
@@ -539,9 +1492,28 @@ namespace arelion {
 				resend_iter_mid = resend_iter_beg;
 		}
 
-		while (((m_outgoing_bw_tracker.get_average(false) <= config::link_outgoing_bandwidth) || (config::link_outgoing_bandwidth <= 0))) {
+		m_pacer.refill(curr_send_time);
+
+		while (m_pacer.can_send()) {
 			udp_packet pkt(m_last_inorder, nak_count);
 
+			// advertise whether we accept compressed blocks in return
+			pkt.flags = udp_packet::PKT_FLAG_STREAM_LZ * m_stream_compression;
+			pkt.conn_id = m_conn_id;
+
+			if (m_path_response != 0) {
+				pkt.flags |= udp_packet::PKT_FLAG_PATH_RESPONSE;
+				pkt.path_nonce = m_path_response;
+				m_path_response = 0;
+			}
+			if (m_cookie != 0) {
+				pkt.flags |= udp_packet::PKT_FLAG_COOKIE_ECHO;
+				pkt.cookie = m_cookie;
+			}
+
+			if (m_multicast != nullptr)
+				add_multicast_report(pkt, curr_send_time, max_unack_time / 2);
+
 			if (nak_count > 0) {
 				pkt.naks.resize(nak_count);
 
@@ -555,17 +1527,45 @@ namespace arelion {
 
 
 			bool sent = false;
+			uint32_t resent = 0;
 
 			while (true) {
 				const size_t buffer_size = pkt.calc_size();
-				const size_t resend_size = ((use_min_loss_factor() || (rev_index == 0)) ? resend_iter_fwd->second->calc_size() : ((rev_index == 1) ? resend_iter_rev->second->calc_size() : resend_iter_mid->second->calc_size())); // resend chunk size
+				const size_t resend_size = (max_resend_size == 0)? 0: ((use_min_loss_factor() || (rev_index == 0)) ? resend_iter_fwd->second->calc_size() : ((rev_index == 1) ? resend_iter_rev->second->calc_size() : resend_iter_mid->second->calc_size())); // resend chunk size
 
 				const bool can_resend = (max_resend_size > 0) && ((buffer_size + resend_size) <= m_max_transmission_unit);
 				const bool can_send_new = !m_new_chunks.empty() && ((buffer_size + m_new_chunks[0]->calc_size()) <= m_max_transmission_unit);
+				const bool can_send_unreliable = !m_unreliable_chunks.empty() && ((buffer_size + m_unreliable_chunks[0]->calc_size()) <= m_max_transmission_unit);
+				const bool can_send_repair = (m_multicast != nullptr) && !m_multicast->repair_chunks.empty() && ((buffer_size + m_multicast->repair_chunks[0]->calc_size()) <= m_max_transmission_unit);
 
-				if (!can_resend && !can_send_new)
+				if (!can_resend && !can_send_new && !can_send_unreliable && !can_send_repair)
 					break;
 
+				// the other end's multicast stream is stalled until these arrive
+				if (can_send_repair) {
+					pkt.chunks.push_back(m_multicast->repair_chunks[0]);
+					m_multicast->repair_chunks.pop_front();
+
+					m_metrics.resent_chunks.add(1);
+
+					sent = true;
+					continue;
+				}
+
+				// unreliable data is superseded quickly, let it go first
+				if (can_send_unreliable) {
+					m_queued_chunk_bytes -= m_unreliable_chunks[0]->calc_size();
+
+					if (m_latency_stats != nullptr)
+						m_latency_stats->stages[message_latency_stats::STAGE_PACED].record(curr_send_time - m_unreliable_chunks[0]->create_time);
+
+					pkt.chunks.push_back(m_unreliable_chunks[0]);
+					m_unreliable_chunks.pop_front();
+
+					sent = true;
+					continue;
+				}
+
 				// alternate between send and resend to make sure none is starved
 				m_resend = !m_resend;
 
@@ -597,7 +1597,13 @@ namespace arelion {
 						rev_index = (rev_index + 1) % 4;
 					}
 
-					m_resent_chunks += 1;
+					pkt.chunks.back()->resent = true;
+					resent += 1;
+
+					if (m_traffic_stats != nullptr)
+						m_traffic_stats->record_resent(pkt.chunks.back()->msg_id, pkt.chunks.back()->calc_size());
+
+					m_metrics.resent_chunks.add(1);
 					max_resend_size -= 1;
 
 					sent = true;
@@ -605,6 +1611,13 @@ namespace arelion {
 				}
 
 				if (!m_resend && can_send_new) {
+					m_queued_chunk_bytes -= m_new_chunks[0]->calc_size();
+
+					if (m_latency_stats != nullptr) {
+						m_latency_stats->stages[message_latency_stats::STAGE_PACED].record(curr_send_time - m_new_chunks[0]->create_time);
+						m_new_chunks[0]->send_time = curr_send_time;
+					}
+
 					pkt.chunks.push_back(m_new_chunks[0]);
 					m_unacked_chunks.push_back(m_new_chunks[0]);
 					m_new_chunks.pop_front();
@@ -616,11 +1629,28 @@ namespace arelion {
 
 			emulate_packet_corruption(pkt.checksum = pkt.calc_checksum(m_crc));
 			send_packet(pkt);
+			trace_packet(packet_trace_event::TYPE_SEND, pkt, m_send_buffer.size(), resent);
+
+			m_pacer_held = false;
 
-			if (!sent || (max_resend_size == 0 && m_new_chunks.empty()))
+			if (!sent || (max_resend_size == 0 && m_new_chunks.empty() && m_unreliable_chunks.empty() && !has_multicast_repairs()))
 				break;
 		}
 
+		// only the start of each hold is traced, not every update spent waiting
+		if (m_trace != nullptr && !m_pacer_held && !m_pacer.can_send() && (!m_new_chunks.empty() || !m_unreliable_chunks.empty() || !m_resend_req_pkts.empty() || get_flush_deadline() <= curr_send_time)) {
+			packet_trace_event event;
+
+			const net_time_point cur_time = std::chrono::high_resolution_clock::now();
+
+			event.time = cur_time.time_since_epoch().count();
+			event.value = std::chrono::duration_cast<std::chrono::microseconds>(std::max(m_pacer.get_departure_time() - cur_time, net_time_range(0))).count();
+			event.type = packet_trace_event::TYPE_PACED;
+
+			m_trace->record(event);
+			m_pacer_held = true;
+		}
+
 		if (!use_min_loss_factor()) {
 			// on a lossy connection the packet will be sent multiple times
 			for (size_t i = unack_prev_size; i < m_unacked_chunks.size(); ++i) {
@@ -630,8 +1660,10 @@ namespace arelion {
 	}
 
 	void udp_connection::send_packet(udp_packet& pkt) {
+		PHASE_TIMER(timer, m_metrics.phases, phase_metrics::PHASE_SEND);
+
 		pkt.serialize(m_send_buffer);
-		m_outgoing_bw_tracker.data_sent(m_send_buffer.size(), false);
+		m_pacer.consume(m_send_buffer.size());
 
 		asio::ip::udp::socket::message_flags msg_flags = 0;
 		asio::error_code error_code;
@@ -642,13 +1674,60 @@ namespace arelion {
 		if (check_error_code(error_code))
 			return;
 
+		if (m_capture != nullptr)
+			m_capture->write(m_local_address, m_net_address, &m_send_buffer[0], m_send_buffer.size());
+
 		m_prv_packet_send_time = std::chrono::high_resolution_clock::now();
-		m_data_sent += m_send_buffer.size();
-		m_sent_packets += 1;
+		m_metrics.data_sent.add(m_send_buffer.size());
+		m_metrics.sent_packets.add(1);
+	}
+
+	void udp_connection::set_capture(std::shared_ptr<pcap_writer> capture) {
+		asio::error_code error_code;
+
+		if ((m_capture = capture) != nullptr)
+			m_local_address = m_socket->local_endpoint(error_code);
+	}
+
+	void udp_connection::trace_packet(uint8_t type, const udp_packet& pkt, uint32_t size, uint32_t old_chunks) {
+		if (m_trace == nullptr)
+			return;
+
+		packet_trace_event event;
+
+		event.time = std::chrono::high_resolution_clock::now().time_since_epoch().count();
+		event.last_continuous = pkt.last_continuous;
+		event.size = size;
+		event.type = type;
+		event.nak_type = pkt.nak_type;
+		event.flags = pkt.flags;
+		event.old_chunks = old_chunks;
+
+		for (const std::shared_ptr<udp_packet_chunk>& chunk: pkt.chunks) {
+			if (!chunk->is_reliable()) {
+				event.unreliable_chunks += 1;
+				continue;
+			}
+
+			event.first_chunk = (event.first_chunk < 0)? chunk->chunk_number: std::min(event.first_chunk, chunk->chunk_number);
+			event.last_chunk = std::max(event.last_chunk, chunk->chunk_number);
+			event.new_chunks += 1;
+		}
+
+		event.new_chunks -= old_chunks;
+
+		m_trace->record(event);
 	}
 
 	void udp_connection::ack_chunks(int32_t last_ack) {
+		const net_time_point cur_ack_time = (m_latency_stats != nullptr)? std::chrono::high_resolution_clock::now(): net_time_point();
+
 		while (!m_unacked_chunks.empty() && (last_ack >= (*m_unacked_chunks.begin())->chunk_number)) {
+			const udp_packet_chunk& chunk = *m_unacked_chunks.front();
+
+			if (m_latency_stats != nullptr)
+				m_latency_stats->stages[message_latency_stats::STAGE_DELIVERED + chunk.resent].record(cur_ack_time - chunk.send_time);
+
 			m_unacked_chunks.pop_front();
 		}
 
@@ -672,6 +1751,7 @@ namespace arelion {
 
 		flush(flush_);
 		m_muted = true;
+		m_multicast.reset();
 
 		if (!m_shared_socket) {
 			try {
@@ -683,6 +1763,7 @@ namespace arelion {
 
 		// FIXME: only if no exception?
 		m_closed = true;
+		wake();
 	}
 }
 
@@ -6,82 +6,252 @@
 #include <chrono>
 #include <memory>
 
-#include <deque>
-#include <list>
 #include <map>
 #include <vector>
 
 #include "base_connection.hpp"
-#include "bandwidth_tracker.hpp"
 #include "config.hpp"
+#include "latency_histogram.hpp"
+#include "mem_pool.hpp"
+#include "message_traffic.hpp"
+#include "net_waiter.hpp"
+#include "packet_pacer.hpp"
+#include "packet_trace.hpp"
+#include "pcap_file.hpp"
+#include "timer_wheel.hpp"
 #include "udp_packet.hpp"
+#include "udp_stream.hpp"
 #include "util.hpp"
 
 
 namespace arelion {
+	struct udp_broadcast_block;
+	struct udp_multicast_state;
+
 	class udp_connection: public base_connection {
 	public:
 		udp_connection(std::shared_ptr<asio::ip::udp::socket> udp_socket, const asio::ip::udp::endpoint& net_address);
+		// blocks while a hostname <address_str> is looked up unless it is cached, the
+		// endpoint can be resolved beforehand with netresolver.resolve instead
 		udp_connection(int32_t src_port, const uint32_t dst_port, const std::string& address_str);
+		udp_connection(int32_t src_port, const asio::ip::udp::endpoint& net_address);
 		udp_connection(base_connection& conn);
 		~udp_connection();
 
 
-		void send_data(std::shared_ptr<const raw_packet> data) override;
+		// unordered packets too large for a single chunk are sent reliable and in-order;
+		// the stream of a multicast group joined or added to is refused, its sequence
+		// state belongs to the group
+		void send_data(std::shared_ptr<const raw_packet> data, const uint8_t delivery = DELIVERY_RELIABLE_ORDERED, const uint8_t stream = 0) override;
 
-		std::shared_ptr<const raw_packet> peek(uint32_t index) const override;
-		std::shared_ptr<const raw_packet> get_data() override;
+		std::shared_ptr<const raw_packet> peek(uint32_t index, const uint8_t stream = 0) const override;
+		std::shared_ptr<const raw_packet> get_data(const uint8_t stream = 0) override;
 
 		void update() override;
-		void delete_buffer_packet_at(uint32_t index) override;
+		void delete_buffer_packet_at(uint32_t index, const uint8_t stream = 0) override;
 
 		void flush(const bool forced) override;
+		void begin_batch() override { m_batch_depth += 1; }
+		void end_batch() override;
 		void reconnect_to(base_connection& conn) override;
 
-		bool has_incoming_data() const override { return (!m_msg_queue.empty()); }
+		bool has_incoming_data(const uint8_t stream = 0) const override { return (get_packet_queue_size(stream) != 0); }
 		bool check_timeout(int32_t seconds = 0, bool initial = false) const override;
 		bool can_reconnect() const override { return (m_reconnect_time_secs > 0); }
 		bool needs_reconnect() override;
 
-		uint32_t get_packet_queue_size() const override { return (m_msg_queue.size()); }
+		uint32_t get_packet_queue_size(const uint8_t stream = 0) const override { return ((m_streams[stream] != nullptr)? m_streams[stream]->msg_queue.size(): 0); }
 
 		std::string get_statistics() const override;
 		std::string get_full_address() const override;
 
 
-		// strips and parses udp header, then adds raw data to m_waiting_packets
+		// queues chunks referring to the shared payloads of a block built by
+		// udp_broadcast_group, numbered and acked like any other; data sent on
+		// the same stream before is chunked first so it keeps its place
+		void send_broadcast_block(const udp_broadcast_block& block);
+
+		// receives the chunks a udp_multicast_group sends to <address>:<port>, through
+		// the interface with local IPv4 address <interface> (any if empty); the group's
+		// data is delivered on <stream>, which must not be used for anything else:
+		// send_data refuses it and unicast chunks arriving on it are acked but dropped
+		bool join_multicast(const std::string& address, uint16_t port, uint8_t stream, const std::string& interface = "");
+		void leave_multicast();
+
+		// for udp_multicast_group; nullptr unless joined or added to one
+		udp_multicast_state* get_multicast_state() { return m_multicast.get(); }
+
+		// without acks for this long unacked chunks are resent, half of it passes between keepalives
+		net_time_range get_max_unack_time() const { return net_time_range((400 >> m_netloss_factor) * 1000ll * 1000ll); }
+		void set_multicast_state(std::unique_ptr<udp_multicast_state> state);
+
+		// strips and parses udp header, then adds raw data to the waiting chunks of its stream
 		// udp_connection takes ownership of the packet and will delete it later
 		void process_raw_packet(udp_packet& packet);
 
 		// connections are silent by default, unmuting allows them to send data
-		void unmute() override { m_muted = false; }
+		void unmute() override { m_muted = false; wake(); }
 		void close(bool flush) override;
 		void set_loss_factor(int32_t factor) override {
 			m_netloss_factor = util::clamp(factor, int32_t(config::MIN_LOSS_FACTOR), int32_t(config::MAX_LOSS_FACTOR));
+			wake();
+		}
+
+		// compression of outgoing blocks also requires the remote end to accept them
+		void set_stream_compression(bool enable) { m_stream_compression = enable; }
+		// default for new streams and override for all existing ones
+		void set_latency_budget(net_time_range budget) {
+			m_latency_budget = budget;
+
+			for (uint8_t n = 0; n < MAX_STREAMS; ++n) {
+				if (m_streams[n] != nullptr)
+					m_streams[n]->latency_budget = budget;
+			}
+
+			wake();
+		}
+		void set_stream_latency_budget(const uint8_t stream, net_time_range budget) { get_stream(stream).latency_budget = budget; wake(); }
+		// must be called before any data is sent or received, stays on afterwards
+		void enable_latency_stats() {
+			if (m_latency_stats == nullptr)
+				m_latency_stats.reset(new message_latency_stats());
+		}
+		// nullptr unless enabled; may be read from any thread
+		const message_latency_stats* get_latency_stats() const { return m_latency_stats.get(); }
+
+		// stays on once enabled, counts only what passes afterwards
+		void enable_traffic_stats() {
+			if (m_traffic_stats == nullptr)
+				m_traffic_stats.reset(new message_traffic_stats());
+		}
+		// nullptr unless enabled; may be read from any thread
+		const message_traffic_stats* get_traffic_stats() const { return m_traffic_stats.get(); }
+
+		// writes the trace ring to <file_name>, see tools/trace_dump
+		bool dump_trace(const std::string& file_name) const { return (m_trace != nullptr && m_trace->dump(file_name, get_full_address())); }
+
+		// records every datagram sent and (if not on a shared socket) received, nullptr stops
+		void set_capture(std::shared_ptr<pcap_writer> capture);
+
+		// target rate in bytes per second (<= 0 for unlimited) and burst allowance in bytes
+		void set_outgoing_rate(int32_t rate, int32_t burst) { m_pacer.set_rate(rate, burst); wake(); }
+
+		// time at which queued data is due or the pacer lets the next pending
+		// datagram leave, whichever comes first; max() if nothing is waiting
+		net_time_point get_next_departure_time() const;
+		// sends whatever is due and the pacer allows right now
+		void send_paced();
+
+		// earliest time update() has anything to do: data or a resend, ack, nak or
+		// probe falling due; min() while a multicast socket has to be polled
+		net_time_point get_next_update_time() const;
+
+		// for connections with their own socket: block until a datagram arrives,
+		// the next update time comes or notify() is called, for at most <timeout>;
+		// false if <timeout> simply passed (and always, right away, for those on a
+		// udp_listener's socket, which waits for them)
+		bool wait(net_time_range timeout);
+		// makes a blocked wait() return, e.g. after another thread queued work
+		// for the network thread; may be called from any thread, send_data and
+		// everything else that wakes the connection already do
+		void notify() {
+			if (m_waiter != nullptr)
+				m_waiter->notify();
+		}
+
+		// for udp_listener, which only updates its connections once their next
+		// update time has come or they were woken; nullptr detaches
+		void set_timer_wheel(timer_wheel<udp_connection>* wheel) {
+			m_timer.unlink();
+			m_timer_wheel = wheel;
+			wake();
+		}
+		// has the owning udp_listener (if any) update this connection on its next
+		// update, or ends a wait() in progress on another thread, after anything
+		// that may have brought the next update time forward
+		void wake() {
+			if (m_timer_wheel != nullptr)
+				m_timer_wheel->schedule_now(m_timer);
+			if (m_waiter != nullptr)
+				m_waiter->notify_waiting();
 		}
 
 		const asio::ip::udp::endpoint& get_endpoint() const { return m_net_address; }
 
+		// id the accepting udp_listener routes this connection's datagrams by, the
+		// connecting end adopts it from the first datagram it receives (0 if none)
+		uint32_t get_conn_id() const { return m_conn_id; }
+		void set_conn_id(uint32_t conn_id) { m_conn_id = conn_id; }
+
+		// for udp_listener, on a datagram with our id from another address; the
+		// other end is challenged to prove it is reachable there, true once it has
+		// and the connection has moved to <address>; one address is probed at a time
+		bool validate_address(const asio::ip::udp::endpoint& address, const udp_packet& pkt);
+
 		bool is_using_address(const asio::ip::udp::endpoint& from) const { return (m_net_address == from); }
 		bool use_min_loss_factor() const { return (m_netloss_factor == config::MIN_LOSS_FACTOR); }
 
 	private:
 		void init(bool shared_socket);
+		// binds our own socket on <src_port>, in the family of m_net_address
+		void init_socket(int32_t src_port);
 
 		void init_connection(asio::ip::udp::endpoint address, std::shared_ptr<asio::ip::udp::socket> socket);
 		void copy_connection(udp_connection& conn);
 
+		void send_path_challenge(const net_time_point& cur_time);
+		// re-arms our timer in m_timer_wheel for the next update time
+		void schedule_update(const net_time_point& cur_time);
+		// get_next_update_time, leaving the multicast socket to the caller
+		net_time_point get_next_timer_time() const;
+
 		void set_max_transmission_unit(uint32_t max_transmission_unit) {
 			m_max_transmission_unit = util::clamp(max_transmission_unit, 300u, udp_packet::max_size());
 		}
 
+		udp_stream& get_stream(const uint8_t stream) {
+			if (m_streams[stream] == nullptr) {
+				m_streams[stream].reset(new udp_stream());
+				m_streams[stream]->latency_budget = m_latency_budget;
+			}
+
+			return *m_streams[stream];
+		}
+
+		// earliest time at which flush() sends the outgoing data, because it fills a
+		// datagram or has used up its latency budget; max() if nothing is queued
+		net_time_point get_flush_deadline() const;
+
+		// packs unordered packets into chunks of their own
+		void flush_unordered(const bool forced);
+		// turns outgoing data of one stream into chunks, returns false if the pacer is saturated
+		bool flush_stream(udp_stream& stream, const uint8_t stream_idx, const bool forced);
+
 		// add header to data and send it
-		void create_chunk(const uint8_t* data, const uint32_t length, const int32_t chunk_num);
+		void create_chunk(const uint8_t* data, const uint32_t length, const int32_t chunk_num, const uint8_t channel = DELIVERY_RELIABLE_ORDERED, const uint16_t stream_seq = 0, const uint8_t msg_id = 0);
+		void create_chunk(std::shared_ptr<const udp_chunk_payload> payload, const uint32_t length, const int32_t chunk_num, const uint8_t channel, const uint16_t stream_seq, const uint8_t msg_id);
+		// queues the whole packets contained in an unordered chunk
+		void queue_chunk_packets(const udp_packet_chunk& chunk, udp_stream& stream);
+		// reassembles the in-order chunks waiting in a stream into packets
+		void reassemble_stream(udp_stream& stream);
 		void send_if_necessary(bool flushed);
+
+		void recv_multicast();
+		void process_multicast_packet(udp_packet& pkt);
+		// returns true if the stream of the chunk might be reassembled now
+		bool process_multicast_chunk(const std::shared_ptr<udp_packet_chunk>& chunk);
+		// handles the multicast acks or join point in a unicast datagram
+		bool process_multicast_report(const udp_packet& pkt);
+		void add_multicast_report(udp_packet& pkt, const net_time_point& cur_time, const net_time_range& nak_time);
+		bool has_multicast_repairs() const;
+		// copies queue sizes into the metrics gauges
+		void update_gauges();
 		void ack_chunks(int32_t lastAck);
 
 		void request_resend(std::shared_ptr<udp_packet_chunk> ptr);
 		void send_packet(udp_packet& pkt);
+		// <old_chunks> are resent (outgoing) or duplicate (incoming) reliable chunks
+		void trace_packet(uint8_t type, const udp_packet& pkt, uint32_t size, uint32_t old_chunks);
 
 
 		#ifdef NETWORK_TEST
@@ -140,26 +310,34 @@ namespace arelion {
 		#endif
 
 	private:
-		// outgoing data (without header) waiting to be sent
-		std::list< std::shared_ptr<const raw_packet> > m_outgoing_data;
-		// packets we have received but not yet read
-		std::map<int, raw_packet*> m_waiting_packets;
+		// outgoing data of the other delivery classes, paired with its chunk channel
+		pool_deque< std::pair<std::shared_ptr<const raw_packet>, uint8_t> > m_outgoing_unordered;
+		// numbers of the reliable chunks received past m_last_inorder
+		pool_set<int32_t> m_received_chunks;
+
+		// created on first use
+		std::unique_ptr<udp_stream> m_streams[MAX_STREAMS];
 
 		// newly created and not yet sent
-		std::deque< std::shared_ptr<udp_packet_chunk> > m_new_chunks;
+		pool_deque< std::shared_ptr<udp_packet_chunk> > m_new_chunks;
+		// newly created unreliable chunks, never acked or resent
+		pool_deque< std::shared_ptr<udp_packet_chunk> > m_unreliable_chunks;
 		// packets the other side did not ack until now
-		std::deque< std::shared_ptr<udp_packet_chunk> > m_unacked_chunks;
+		pool_deque< std::shared_ptr<udp_packet_chunk> > m_unacked_chunks;
 
 		// packets the other side missed
-		std::map<int32_t, std::shared_ptr<udp_packet_chunk> > m_resend_req_pkts;
-
-		// complete packets we received but did not yet consume
-		std::deque< std::shared_ptr<const raw_packet> > m_msg_queue;
+		pool_map<int32_t, std::shared_ptr<udp_packet_chunk> > m_resend_req_pkts;
 
 		std::vector<uint8_t> m_send_buffer;
 		std::vector<uint8_t> m_recv_buffer;
 		std::vector<uint8_t> m_wait_buffer;
 
+		// raw outgoing data of the next stream block, and the framed block itself
+		std::vector<uint8_t> m_block_buffer;
+		std::vector<uint8_t> m_encode_buffer;
+		// full packet rebuilt from an incoming delta record
+		std::vector<uint8_t> m_delta_buffer;
+
 		std::vector<int> m_dropped_packets;
 
 		#ifdef	NETWORK_TEST
@@ -174,10 +352,28 @@ namespace arelion {
 
 		// address of the other end
 		asio::ip::udp::endpoint m_net_address;
+		// address of our end, as written to captures
+		asio::ip::udp::endpoint m_local_address;
+		// address the other end claims to have moved to, until it echoes m_probe_nonce
+		asio::ip::udp::endpoint m_probe_address;
+		// last address that let a probe run out of attempts, not probed again for as long
+		asio::ip::udp::endpoint m_failed_probe_address;
+
+		std::shared_ptr<pcap_writer> m_capture;
+
+
+		packet_pacer m_pacer;
 
+		std::unique_ptr<message_latency_stats> m_latency_stats;
+		std::unique_ptr<message_traffic_stats> m_traffic_stats;
+		std::unique_ptr<packet_trace> m_trace;
+		std::unique_ptr<udp_multicast_state> m_multicast;
 
-		raw_packet m_fragment_buffer;
-		bandwidth_tracker m_outgoing_bw_tracker;
+		timer_node<udp_connection> m_timer{this};
+		// wheel of the udp_listener updating us, nullptr if none
+		timer_wheel<udp_connection>* m_timer_wheel = nullptr;
+		// for wait(), only created along with our own socket
+		std::unique_ptr<net_waiter> m_waiter;
 
 
 		net_time_point m_prv_chunk_created_time;
@@ -188,6 +384,10 @@ namespace arelion {
 		net_time_point m_prv_nak_time;
 
 		net_time_point m_prv_update_time;
+		net_time_point m_prv_probe_time;
+		net_time_point m_failed_probe_time;
+
+		net_time_range m_latency_budget;
 
 
 		// maximum size of packets to send
@@ -202,21 +402,36 @@ namespace arelion {
 		int32_t m_last_mid_chunk = 0;
 
 		uint32_t m_packet_chunk_num = 0;
-
-		uint32_t m_resent_chunks = 0;
-		uint32_t m_dropped_chunks = 0;
-
-		uint32_t m_sent_packets = 0;
-		uint32_t m_recv_packets = 0;
-
-		uint32_t m_sent_overhead = 0;
-		uint32_t m_recv_overhead = 0;
+		uint32_t m_unreliable_chunk_num = 0;
+
+		// bytes in new chunks that have not yet been sent
+		uint32_t m_queued_chunk_bytes = 0;
+		// bytes of reliable in-order data not yet turned into chunks
+		uint32_t m_outgoing_bytes = 0;
+		// nesting level of begin_batch calls
+		uint32_t m_batch_depth = 0;
+
+		uint32_t m_conn_id = 0;
+		// challenge sent to m_probe_address, 0 if none is pending
+		uint32_t m_probe_nonce = 0;
+		uint32_t m_probe_attempts = 0;
+		// challenge to echo with the next datagram, 0 if none
+		uint32_t m_path_response = 0;
+		// echoed with every datagram until the other end acks one, 0 if none
+		uint64_t m_cookie = 0;
+
+		// stream to start the next flush with, rotates for fairness
+		uint8_t m_flush_stream = 0;
 
 		bool m_muted = false;
 		bool m_closed = false;
 		bool m_resend = false;
+		bool m_batch_ended = false;
+		bool m_pacer_held = false;
 		bool m_shared_socket = true;
 		bool m_log_messages = false;
+		bool m_stream_compression = false;
+		bool m_peer_stream_compression = false;
 	};
 }
 
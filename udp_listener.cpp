@@ -1,25 +1,41 @@
 #include <asio.hpp>
 
+#include <algorithm>
+#include <random>
+
 #include "udp_listener.hpp"
 #include "udp_connection.hpp"
+#include "address_resolver.hpp"
+#include "alloc_audit.hpp"
+#include "config.hpp"
+#include "phase_profiler.hpp"
 #include "protocol_def.hpp"
 #include "socket_helper.hpp"
 
 
 namespace arelion {
 	udp_listener::udp_listener(uint16_t port, const std::string& ip) {
+		std::random_device random;
+
+		m_cookie_key[0] = (uint64_t(random()) << 32) | random();
+		m_cookie_key[1] = (uint64_t(random()) << 32) | random();
+
 		// resets socket on any exception
 		const std::string& err_msg = try_bind_socket(port, m_socket, ip);
 
 		assert(err_msg.empty());
 
 		m_socket->non_blocking(true);
+		m_waiter.add_socket(*m_socket);
+		m_source_limiter.set_rate(config::source_rate_limit, config::source_rate_burst);
+		m_update_budget = std::chrono::milliseconds(config::udp_update_budget_ms);
 		set_accepting_connections(true);
 	}
 
 	udp_listener::~udp_listener() {
-		for (const auto& pair: m_dropped_ips) {
-			printf("[%s] dropped %u packets from unknown IP %s", __func__, pair.second, (pair.first).c_str());
+		// their owners may keep them around after we are gone
+		for (size_t n = 0; n < m_active_conns.size(); ++n) {
+			m_active_conns.value_at(n)->set_timer_wheel(nullptr);
 		}
 	}
 
@@ -75,11 +91,24 @@ namespace arelion {
 	}
 
 	void udp_listener::update() {
+		ALLOC_AUDIT_SCOPE("listener_update");
+
+		PHASE_TIMER(recv_timer, m_metrics.phases, phase_metrics::PHASE_RECV);
+
 		netservice.poll();
+		netresolver.poll();
+
+		const net_time_point cur_time = std::chrono::high_resolution_clock::now();
+		const net_time_point recv_deadline = cur_time + m_update_budget;
 
 		size_t bytes_available = 0;
+		size_t num_datagrams = 0;
 
 		while ((bytes_available = m_socket->available()) > 0) {
+			// the rest waits in the socket rather than starve the connections
+			if ((num_datagrams++) > 0 && std::chrono::high_resolution_clock::now() >= recv_deadline)
+				break;
+
 			m_recv_buffer.clear();
 			m_recv_buffer.resize(bytes_available, 0);
 
@@ -89,89 +118,376 @@ namespace arelion {
 
 			const size_t bytes_received = m_socket->receive_from(asio::buffer(m_recv_buffer), udp_endpoint, msgFlags, error_code);
 
-			const auto ci = m_active_conns.find(udp_endpoint);
+			if (check_error_code(error_code))
+				break;
+
+			if (m_capture != nullptr)
+				m_capture->write(udp_endpoint, m_local_address, &m_recv_buffer[0], bytes_received);
+
+			m_metrics.recv_datagrams.add(1);
+			m_metrics.recv_bytes.add(bytes_received);
 
-			// known connection but expired
-			if (ci != m_active_conns.end() && ci->second.expired())
+			if (!udp_packet::has_valid_header(&m_recv_buffer[0], bytes_received)) {
+				m_metrics.dropped_datagrams.add(1);
 				continue;
+			}
 
-			if (check_error_code(error_code))
-				break;
+			const conn_slot* slot = find_conn_slot(udp_packet::peek_conn_id(&m_recv_buffer[0]));
+			const std::shared_ptr<udp_connection> slot_conn = (slot != nullptr)? slot->conn.lock(): nullptr;
 
-			if (bytes_received < udp_packet_chunk::hdr_size())
+			udp_connection* udp_conn = (slot_conn != nullptr && slot_conn->is_using_address(udp_endpoint))? slot_conn.get(): nullptr;
+
+			// connections not accepted here, or not yet knowing their id
+			if (udp_conn == nullptr) {
+				const std::shared_ptr<udp_connection>* handle = m_active_conns.find(udp_endpoint);
+				udp_conn = (handle != nullptr)? handle->get(): nullptr;
+			}
+
+			// everything else is limited per source address before it is parsed
+			if (udp_conn == nullptr && !m_source_limiter.consume(udp_endpoint, cur_time)) {
+				m_metrics.limited_datagrams.add(1);
 				continue;
+			}
 
+			PHASE_TIMER(parse_timer, m_metrics.phases, phase_metrics::PHASE_PARSE);
 			udp_packet pkt(&m_recv_buffer[0], bytes_received);
+			PHASE_TIMER_STOP(parse_timer);
 
-			if (ci != m_active_conns.end()) {
-				ci->second.lock()->process_raw_packet(pkt);
+			if (udp_conn != nullptr) {
+				udp_conn->process_raw_packet(pkt);
+				continue;
+			}
+
+			// known id from an unknown address, e.g. after the client's NAT mapping changed
+			if (slot_conn != nullptr) {
+				migrate_connection(slot_conn.get(), udp_endpoint, pkt);
 				continue;
 			}
 
 
 			// unknown connection but still have the packet, maybe a new client wants to connect from sender's address
 			if (m_accept_new_connections && pkt.last_continuous == -1 && pkt.nak_type == 0)	{
-				if (!pkt.chunks.empty() && (*pkt.chunks.begin())->chunk_number == 0) {
-					std::shared_ptr<udp_connection> udp_conn(new udp_connection(m_socket, udp_endpoint));
-					m_waiting_conns.push(udp_conn);
-					m_active_conns[udp_endpoint] = udp_conn;
-					udp_conn->process_raw_packet(pkt);
+				const auto chunk_pred = [](const std::shared_ptr<udp_packet_chunk>& c) { return c->is_reliable(); };
+
+				// nothing is kept about the sender until it has proven that it
+				// receives at its address, so spoofed floods cost no memory; a
+				// valid echo is taken whatever chunks it carries, since a client
+				// whose echo was lost only resends its newest chunk on timeout
+				if ((pkt.flags & udp_packet::PKT_FLAG_COOKIE_ECHO) == 0 || !check_cookie(udp_endpoint, pkt.cookie)) {
+					if (std::find_if(pkt.chunks.begin(), pkt.chunks.end(), chunk_pred) != pkt.chunks.end()) {
+						send_cookie(udp_endpoint, bytes_received);
+					} else {
+						m_metrics.dropped_datagrams.add(1);
+					}
+
+					continue;
 				}
 
+				std::shared_ptr<udp_connection> udp_conn(new udp_connection(m_socket, udp_endpoint));
+				udp_conn->set_capture(m_capture);
+				udp_conn->set_conn_id(assign_conn_id(udp_conn));
+				udp_conn->set_timer_wheel(&m_timers);
+				m_waiting_conns.push(udp_conn);
+				file_connection(udp_endpoint, udp_conn);
+				m_metrics.accepted_connections.add(1);
+				udp_conn->process_raw_packet(pkt);
 				continue;
 			}
 
+			m_metrics.dropped_datagrams.add(1);
+		}
 
-			const asio::ip::address& sender_addr = udp_endpoint.address();
-			const std::string& sender_ip_str = sender_addr.to_string();
+		PHASE_TIMER_STOP(recv_timer);
 
-			if (m_dropped_ips.find(sender_ip_str) == m_dropped_ips.end()) {
-				// unknown ip, drop packet
-				m_dropped_ips[sender_ip_str] = 0;
-			} else {
-				m_dropped_ips[sender_ip_str] += 1;
+		// departures that have come due are left to the timers
+		while (!m_departures.empty() && m_departures.front().time <= cur_time) {
+			std::pop_heap(m_departures.begin(), m_departures.end());
+			m_departures.pop_back();
+		}
+
+		const net_time_point service_time = std::chrono::high_resolution_clock::now();
+		const net_time_point service_deadline = service_time + m_update_budget;
+
+		// only connections that received data, were woken or whose next update time
+		// has come are ready; they are updated in the order they became ready until
+		// the budget runs out, the rest keep their place in line for the next update
+		m_timers.advance(service_time);
+
+		while (m_timers.has_ready()) {
+			update_connection(m_timers.pop_ready());
+
+			if (m_timers.has_ready() && std::chrono::high_resolution_clock::now() >= service_deadline) {
+				m_metrics.deferred_updates.add(1);
+				break;
 			}
 		}
 
-		for (auto i = m_active_conns.cbegin(); i != m_active_conns.cend(); ) {
-			if (i->second.expired()) {
-				i = m_active_conns.erase(i);
+		m_metrics.active_connections.set(m_active_conns.size());
+	}
+
+	void udp_listener::update_connection(udp_connection* conn) {
+		const std::shared_ptr<udp_connection>* handle = m_active_conns.find(conn->get_endpoint());
+
+		// moved by reconnect_to, not yet re-registered by update_connections
+		if (handle == nullptr || handle->get() != conn) {
+			conn->update();
+			return;
+		}
+
+		// only the table still refers to it, its owner has let go
+		if (handle->use_count() == 1) {
+			release_conn_id(conn);
+			m_active_conns.erase(conn->get_endpoint());
+			return;
+		}
+
+		conn->update();
+		schedule_departure(*handle);
+	}
+
+	void udp_listener::pace(const net_time_point deadline) {
+		ALLOC_AUDIT_SCOPE("listener_pace");
+
+		while (!m_departures.empty()) {
+			const departure next = m_departures.front();
+
+			if (next.time > deadline)
+				break;
+
+			if (next.time > std::chrono::high_resolution_clock::now())
+				util::sleep_until(next.time);
+
+			std::pop_heap(m_departures.begin(), m_departures.end());
+			m_departures.pop_back();
+
+			const std::shared_ptr<udp_connection> udp_conn = next.conn.lock();
+
+			if (udp_conn == nullptr)
 				continue;
-			}
 
-			i->second.lock()->update();
-			++i;
+			udp_conn->send_paced();
+
+			// no progress means it waits on something other than the pacer
+			if (udp_conn->get_next_departure_time() > next.time)
+				schedule_departure(udp_conn);
+		}
+	}
+
+	bool udp_listener::wait(net_time_range timeout) {
+		const net_time_point cur_time = std::chrono::high_resolution_clock::now();
+
+		// datagrams or ready connections the update budget left over
+		if (m_timers.has_ready() || m_socket->available() > 0)
+			return true;
+
+		const net_time_point timeout_time = cur_time + timeout;
+
+		net_time_point deadline = std::min(timeout_time, m_timers.get_next_expiry_time());
+
+		if (!m_departures.empty())
+			deadline = std::min(deadline, m_departures.front().time);
+
+		return (m_waiter.wait_until(deadline) || deadline < timeout_time);
+	}
+
+	void udp_listener::schedule_departure(const std::shared_ptr<udp_connection>& conn) {
+		const net_time_point departure_time = conn->get_next_departure_time();
+
+		if (departure_time == net_time_point::max())
+			return;
+
+		m_departures.push_back({departure_time, conn});
+		std::push_heap(m_departures.begin(), m_departures.end());
+	}
+
+
+	uint64_t udp_listener::make_cookie(const asio::ip::udp::endpoint& endpoint, uint32_t time_slot) const {
+		const endpoint_key key = endpoint_key::pack(endpoint);
+		const uint64_t data[4] = {key.addr[0], key.addr[1], (uint64_t(key.port) << 32) | key.scope, time_slot};
+
+		// low byte of the slot in the top byte, so checks know which slot to try
+		return ((uint64_t(time_slot & 0xff) << 56) | (util::siphash24(m_cookie_key, data, sizeof(data)) >> 8));
+	}
+
+	bool udp_listener::check_cookie(const asio::ip::udp::endpoint& endpoint, uint64_t cookie) const {
+		const uint32_t time_slot = get_cookie_time_slot();
+
+		// issued in this slot or the one before
+		for (uint32_t n = 0; n < 2; ++n) {
+			if ((cookie >> 56) == ((time_slot - n) & 0xff))
+				return (cookie == make_cookie(endpoint, time_slot - n));
+		}
+
+		return false;
+	}
+
+	uint32_t udp_listener::get_cookie_time_slot() const {
+		const auto time = std::chrono::high_resolution_clock::now().time_since_epoch();
+		return (std::chrono::duration_cast<std::chrono::seconds>(time).count() / config::connection_cookie_secs);
+	}
+
+	void udp_listener::send_cookie(const asio::ip::udp::endpoint& endpoint, uint32_t request_size) {
+		udp_packet pkt(-1, 0);
+
+		pkt.flags = udp_packet::PKT_FLAG_COOKIE_CHALLENGE;
+		pkt.cookie = make_cookie(endpoint, get_cookie_time_slot());
+		pkt.checksum = pkt.calc_checksum(m_crc);
+
+		// never more than was received, or spoofed requests would amplify
+		if (pkt.calc_size() > request_size) {
+			m_metrics.dropped_datagrams.add(1);
+			return;
+		}
+
+		pkt.serialize(m_send_buffer);
+
+		asio::error_code error_code;
+		m_socket->send_to(asio::buffer(m_send_buffer), endpoint, 0, error_code);
+
+		if (check_error_code(error_code))
+			return;
+
+		if (m_capture != nullptr)
+			m_capture->write(m_local_address, endpoint, &m_send_buffer[0], m_send_buffer.size());
+
+		m_metrics.sent_cookies.add(1);
+	}
+
+
+	uint32_t udp_listener::assign_conn_id(const std::shared_ptr<udp_connection>& conn) {
+		uint32_t index = m_conn_slots.size();
+
+		if (!m_free_conn_slots.empty()) {
+			index = m_free_conn_slots.back();
+			m_free_conn_slots.pop_back();
+		} else {
+			if (index >= MAX_CONN_SLOTS)
+				return 0;
+
+			m_conn_slots.emplace_back();
+		}
+
+		// never zero, which means no id
+		const uint32_t tag = (std::random_device{}() | 1) & 0xffff;
+
+		m_conn_slots[index].conn = conn;
+		m_conn_slots[index].conn_id = (tag << 16) | index;
+		return m_conn_slots[index].conn_id;
+	}
+
+	void udp_listener::release_conn_id(const udp_connection* conn) {
+		const uint32_t index = conn->get_conn_id() & (MAX_CONN_SLOTS - 1);
+
+		// connections spawned here carry an id assigned by the other end
+		if (conn->get_conn_id() == 0 || index >= m_conn_slots.size() || m_conn_slots[index].conn.lock().get() != conn)
+			return;
+
+		m_conn_slots[index] = conn_slot();
+		m_free_conn_slots.push_back(index);
+	}
+
+	void udp_listener::file_connection(const asio::ip::udp::endpoint& address, const std::shared_ptr<udp_connection>& conn) {
+		const std::shared_ptr<udp_connection> replaced = m_active_conns.insert(address, conn);
+
+		if (replaced == nullptr || replaced == conn)
+			return;
+
+		fprintf(stderr, "[udp_listener::%s] %s was taken over by another connection", __func__, replaced->get_full_address().c_str());
+
+		// its owner may keep it, but datagrams from <address> are no longer its
+		release_conn_id(replaced.get());
+		replaced->set_timer_wheel(nullptr);
+	}
+
+	void udp_listener::migrate_connection(udp_connection* conn, const asio::ip::udp::endpoint& address, udp_packet& pkt) {
+		const asio::ip::udp::endpoint old_address = conn->get_endpoint();
+		const std::shared_ptr<udp_connection>* handle = m_active_conns.find(old_address);
+
+		// not filed under its current address (e.g. moved by reconnect_to), checked
+		// before validating so it can not end up moved but filed under neither
+		if (handle == nullptr || handle->get() != conn) {
+			m_metrics.dropped_datagrams.add(1);
+			return;
+		}
+
+		// until the other end has proven it is reachable there, nothing it sends
+		// from the new address is processed
+		if (!conn->validate_address(address, pkt)) {
+			m_metrics.dropped_datagrams.add(1);
+			return;
+		}
+
+		const std::shared_ptr<udp_connection> udp_conn = *handle;
+
+		m_active_conns.erase(old_address);
+		file_connection(address, udp_conn);
+		m_metrics.migrated_connections.add(1);
+
+		conn->process_raw_packet(pkt);
+	}
+
+
+	bool udp_listener::start_capture(const std::string& file_name) {
+		std::shared_ptr<pcap_writer> capture(new pcap_writer());
+
+		if (!capture->open(file_name))
+			return false;
+
+		asio::error_code error_code;
+
+		m_capture = capture;
+		m_local_address = m_socket->local_endpoint(error_code);
+
+		for (size_t n = 0; n < m_active_conns.size(); ++n) {
+			m_active_conns.value_at(n)->set_capture(m_capture);
 		}
+
+		return true;
+	}
+
+	void udp_listener::stop_capture() {
+		for (size_t n = 0; n < m_active_conns.size(); ++n) {
+			m_active_conns.value_at(n)->set_capture(nullptr);
+		}
+
+		// connections still holding on to it are detached above, this closes the file
+		m_capture.reset();
 	}
 
 
 	std::shared_ptr<udp_connection> udp_listener::spawn_connection(const std::string& ip, uint16_t port) {
-		std::shared_ptr<udp_connection> new_conn(new udp_connection(m_socket, asio::ip::udp::endpoint(wrap_ip(ip), port)));
-		m_active_conns[new_conn->get_endpoint()] = new_conn;
+		return (spawn_connection(asio::ip::udp::endpoint(wrap_ip(ip), port)));
+	}
+
+	std::shared_ptr<udp_connection> udp_listener::spawn_connection(const asio::ip::udp::endpoint& address) {
+		std::shared_ptr<udp_connection> new_conn(new udp_connection(m_socket, address));
+		new_conn->set_capture(m_capture);
+		new_conn->set_timer_wheel(&m_timers);
+		file_connection(new_conn->get_endpoint(), new_conn);
 		return new_conn;
 	}
 
 	std::shared_ptr<udp_connection> udp_listener::accept_connection() {
 		std::shared_ptr<udp_connection> new_conn = m_waiting_conns.front();
 		m_waiting_conns.pop();
-		m_active_conns[new_conn->get_endpoint()] = new_conn;
+		file_connection(new_conn->get_endpoint(), new_conn);
 		return new_conn;
 	}
 
 
 	void udp_listener::update_connections() {
-		for (auto i = m_active_conns.begin(); i != m_active_conns.end(); ) {
-			std::shared_ptr<udp_connection> udp_conn = i->second.lock();
-
-			// update registry if an endpoint has changed (i.e. reconnected)
-			// note that insertion does not invalidate the current iterator
-			if (udp_conn != nullptr && i->first != udp_conn->get_endpoint()) {
-				m_active_conns[udp_conn->get_endpoint()] = udp_conn;
-				i = m_active_conns.erase(i);
+		for (size_t n = 0; n < m_active_conns.size(); ) {
+			const std::shared_ptr<udp_connection> udp_conn = m_active_conns.value_at(n);
+
+			// update registry if an endpoint has changed (i.e. reconnected); the
+			// last entry takes the erased one's place, so <n> is visited again
+			if (m_active_conns.key_at(n) != endpoint_key::pack(udp_conn->get_endpoint())) {
+				m_active_conns.erase_at(n);
+				file_connection(udp_conn->get_endpoint(), udp_conn);
 				continue;
 			}
 
-			++i;
+			++n;
 		}
 	}
 }
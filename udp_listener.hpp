@@ -7,8 +7,18 @@
 #include <memory>
 #include <string>
 
-#include <map>
 #include <queue>
+#include <vector>
+
+#include "base_connection.hpp"
+#include "connection_metrics.hpp"
+#include "endpoint_table.hpp"
+#include "net_waiter.hpp"
+#include "pcap_file.hpp"
+#include "source_limiter.hpp"
+#include "timer_wheel.hpp"
+#include "udp_packet.hpp"
+#include "util.hpp"
 
 
 namespace arelion {
@@ -38,15 +48,33 @@ namespace arelion {
 		 */
 		static std::string try_bind_socket(uint16_t port, std::shared_ptr<asio::ip::udp::socket>& skt, const std::string& ip = "");
 
-		// receive data from socket and hand it to the associated udp_connection
+		// receive data from socket and hand it to the associated udp_connection, then
+		// update the connections that received data or have something due
 		void update();
+		// send the datagrams held back by connection pacers as they become due,
+		// until <deadline> or until no connection has anything left to pace
+		void pace(const net_time_point deadline);
+		// block until a datagram arrives, a connection's timer or departure comes
+		// due, or notify() is called, for at most <timeout>; returns right away if
+		// the last update() left work behind, false if <timeout> simply passed
+		bool wait(net_time_range timeout);
+		// makes a blocked wait() return, e.g. after another thread queued work
+		// for the network thread; may be called from any thread
+		void notify() { m_waiter.notify(); }
 
 		void set_accepting_connections(const bool enable) { m_accept_new_connections = enable; }
+		// longest update() spends receiving, and again updating ready connections
+		void set_update_budget(net_time_range budget) { m_update_budget = budget; }
+		// datagrams per second and burst each source address may send without
+		// belonging to a connection (<= 0 for unlimited), excess is dropped unparsed
+		void set_source_rate_limit(int32_t rate, int32_t burst) { m_source_limiter.set_rate(rate, burst); }
 		bool is_accepting_connections() const { return m_accept_new_connections; }
 		bool has_incoming_connections() const { return (!m_waiting_conns.empty()); }
 
-		// initiate a connection to ip:port
+		// initiate a connection to ip:port, hostnames have to be resolved first
+		// (e.g. by netresolver.resolve)
 		std::shared_ptr<udp_connection> spawn_connection(const std::string& ip, uint16_t port);
+		std::shared_ptr<udp_connection> spawn_connection(const asio::ip::udp::endpoint& address);
 
 		std::weak_ptr<udp_connection> preview_connection() { return (m_waiting_conns.front()); }
 		std::shared_ptr<udp_connection> accept_connection();
@@ -54,6 +82,64 @@ namespace arelion {
 		void reject_connection() { m_waiting_conns.pop(); }
 		void update_connections();
 
+		// may be called from any thread
+		listener_metrics get_metrics() const { return m_metrics; }
+
+		// write every datagram received or sent on the socket to a pcap file
+		bool start_capture(const std::string& file_name);
+		void stop_capture();
+
+	private:
+		// ids are <tag:16><slot:16>, the random tag keeps stale or guessed ids
+		// of a reused slot from matching
+		enum {
+			MAX_CONN_SLOTS = 1 << 16,
+		};
+
+		// <conn> expires once neither m_active_conns nor its owner hold it
+		struct conn_slot {
+			std::weak_ptr<udp_connection> conn;
+			uint32_t conn_id = 0;
+		};
+
+		struct departure {
+			bool operator < (const departure& d) const { return (time > d.time); }
+
+			net_time_point time;
+			std::weak_ptr<udp_connection> conn;
+		};
+
+		void schedule_departure(const std::shared_ptr<udp_connection>& conn);
+		// called as <conn> leaves the ready list
+		void update_connection(udp_connection* conn);
+
+		// registers an accepted connection under a new id, 0 if all slots are taken
+		uint32_t assign_conn_id(const std::shared_ptr<udp_connection>& conn);
+		void release_conn_id(const udp_connection* conn);
+
+		// (re)files <conn> under <address>; a different connection filed there
+		// before loses its id and timer, nothing reaches it through us anymore
+		void file_connection(const asio::ip::udp::endpoint& address, const std::shared_ptr<udp_connection>& conn);
+
+		const conn_slot* find_conn_slot(uint32_t conn_id) const {
+			const uint32_t index = conn_id & (MAX_CONN_SLOTS - 1);
+
+			if (conn_id == 0 || index >= m_conn_slots.size() || m_conn_slots[index].conn_id != conn_id)
+				return nullptr;
+
+			return &m_conn_slots[index];
+		}
+
+		// stateless proof that a new client receives at <endpoint>, valid for
+		// the time slot it was issued in and the next one
+		uint64_t make_cookie(const asio::ip::udp::endpoint& endpoint, uint32_t time_slot) const;
+		bool check_cookie(const asio::ip::udp::endpoint& endpoint, uint64_t cookie) const;
+		uint32_t get_cookie_time_slot() const;
+		void send_cookie(const asio::ip::udp::endpoint& endpoint, uint32_t request_size);
+
+		// a datagram carrying the id of <conn> came from an address it is not known by
+		void migrate_connection(udp_connection* conn, const asio::ip::udp::endpoint& address, udp_packet& pkt);
+
 	private:
 		// do we accept packets from (and create a connection for) unknown senders?
 		bool m_accept_new_connections = false;
@@ -62,12 +148,41 @@ namespace arelion {
 		std::shared_ptr<asio::ip::udp::socket> m_socket;
 
 		std::vector<uint8_t> m_recv_buffer;
+		std::vector<uint8_t> m_send_buffer;
+
+		// all connections, by address and (for those accepted here) by id; the
+		// table keeps them alive until their owner has released them
+		endpoint_table< std::shared_ptr<udp_connection> > m_active_conns;
+		std::vector<conn_slot> m_conn_slots;
+		std::vector<uint32_t> m_free_conn_slots;
 
-		// all connections
-		std::map< asio::ip::udp::endpoint, std::weak_ptr<udp_connection> > m_active_conns;
-		std::map< std::string, uint32_t> m_dropped_ips;
 
 		std::queue< std::shared_ptr<udp_connection> > m_waiting_conns;
+
+		// updates every connection once it has received data, was woken or its next
+		// update time has come, so idle ones cost nothing between their deadlines
+		timer_wheel<udp_connection> m_timers;
+
+		// heap of paced connections by next departure time, earliest first, pushed
+		// whenever one is updated; entries that came due are dropped every update,
+		// their connections' timers cover them
+		std::vector<departure> m_departures;
+
+		// sleeps in wait() until the socket or notify() wakes it
+		net_waiter m_waiter;
+
+		listener_metrics m_metrics;
+		source_limiter m_source_limiter;
+
+		net_time_range m_update_budget;
+
+		util::crc32_t m_crc;
+
+		// siphash key of connection cookies
+		uint64_t m_cookie_key[2];
+
+		std::shared_ptr<pcap_writer> m_capture;
+		asio::ip::udp::endpoint m_local_address;
 	};
 }
 
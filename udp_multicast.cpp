@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <cassert>
+
+#include <asio/ip/multicast.hpp>
+
+#include "udp_multicast.hpp"
+#include "alloc_audit.hpp"
+#include "config.hpp"
+#include "socket_helper.hpp"
+#include "udp_connection.hpp"
+
+namespace arelion {
+	udp_multicast_group::udp_multicast_group(const std::string& address, uint16_t port, uint8_t stream, const std::string& interface): m_stream(stream) {
+		assert(stream < base_connection::MAX_STREAMS);
+
+		asio::error_code error_code;
+
+		m_endpoint = asio::ip::udp::endpoint(wrap_ip(address, &error_code), port);
+		m_socket.reset(new asio::ip::udp::socket(netservice));
+
+		if (!error_code)
+			m_socket->open(m_endpoint.protocol(), error_code);
+		// members on the sending host receive through loopback
+		if (!error_code)
+			m_socket->set_option(asio::ip::multicast::enable_loopback(true), error_code);
+		// LAN only
+		if (!error_code)
+			m_socket->set_option(asio::ip::multicast::hops(1), error_code);
+		if (!error_code && !interface.empty() && m_endpoint.address().is_v4())
+			m_socket->set_option(asio::ip::multicast::outbound_interface(wrap_ip(interface, &error_code).to_v4()), error_code);
+
+		if (check_error_code(error_code))
+			fprintf(stderr, "[udp_multicast_group::%s] failed to set up sending to %s:%u", __func__, address.c_str(), port);
+	}
+
+
+	void udp_multicast_group::add_connection(std::shared_ptr<udp_connection> conn) {
+		std::unique_ptr<udp_multicast_state> state(new udp_multicast_state());
+
+		state->prv_report_time = std::chrono::high_resolution_clock::now();
+		state->prv_repair_time = state->prv_report_time;
+
+		state->last_inorder = m_packet_chunk_num - 1;
+		state->first_chunk = m_packet_chunk_num;
+		state->first_sequence = m_next_sequence;
+		state->stream = m_stream;
+		state->report_due = true;
+
+		udp_broadcast_group::add_connection(conn);
+		conn->set_multicast_state(std::move(state));
+	}
+
+	void udp_multicast_group::remove_connection(const udp_connection* conn) {
+		for (const std::weak_ptr<udp_connection>& ptr: m_connections) {
+			const std::shared_ptr<udp_connection> locked = ptr.lock();
+
+			if (locked != nullptr && locked.get() == conn)
+				locked->set_multicast_state(nullptr);
+		}
+
+		udp_broadcast_group::remove_connection(conn);
+	}
+
+
+	void udp_multicast_group::flush() {
+		udp_broadcast_group::flush();
+		send_packets();
+	}
+
+	void udp_multicast_group::send_block(const udp_broadcast_block& block) {
+		const uint8_t delivery = block.channel & 3;
+
+		for (size_t n = 0; n < block.payloads.size(); ++n) {
+			const std::shared_ptr<udp_packet_chunk> chunk = udp_packet_chunk::create();
+
+			chunk->chunk_size = block.payload_sizes[n];
+			chunk->channel = block.channel | udp_packet_chunk::CHANNEL_MULTICAST;
+			chunk->msg_id = block.msg_id;
+			chunk->payload = block.payloads[n];
+
+			if (delivery == base_connection::DELIVERY_RELIABLE_ORDERED)
+				chunk->stream_seq = m_next_sequence++;
+
+			m_new_chunks.push_back(chunk);
+
+			if (!chunk->is_reliable()) {
+				chunk->chunk_number = m_unreliable_chunk_num++;
+				continue;
+			}
+
+			chunk->chunk_number = m_packet_chunk_num++;
+			m_history.push_back(chunk);
+		}
+	}
+
+	void udp_multicast_group::send_packets() {
+		while (!m_new_chunks.empty()) {
+			// receivers only look at the chunks of group datagrams
+			udp_packet pkt(-1, 0);
+
+			for (uint32_t size = pkt.calc_size(); !m_new_chunks.empty(); m_new_chunks.pop_front()) {
+				if ((size += m_new_chunks.front()->calc_size()) > uint32_t(config::max_transmission_unit) && !pkt.chunks.empty())
+					break;
+
+				pkt.chunks.push_back(m_new_chunks.front());
+			}
+
+			pkt.checksum = pkt.calc_checksum(m_crc);
+			pkt.serialize(m_send_buffer);
+
+			asio::error_code error_code;
+			m_socket->send_to(asio::buffer(m_send_buffer), m_endpoint, 0, error_code);
+
+			if (check_error_code(error_code))
+				break;
+		}
+	}
+
+
+	void udp_multicast_group::update() {
+		ALLOC_AUDIT_SCOPE("broadcast");
+
+		const net_time_point cur_time = std::chrono::high_resolution_clock::now();
+		const net_time_range repair_time = std::chrono::milliseconds(config::multicast_repair_ms);
+
+		// members further behind than the history would keep it growing forever
+		const int32_t min_history_chunk = m_packet_chunk_num - int32_t(config::multicast_history_chunks);
+
+		int32_t min_acked = m_packet_chunk_num - 1;
+
+		for (size_t n = 0; n < m_connections.size(); ) {
+			const std::shared_ptr<udp_connection> conn = m_connections[n].lock();
+			udp_multicast_state* state = (conn != nullptr)? conn->get_multicast_state(): nullptr;
+
+			if (state == nullptr) {
+				n += 1;
+				continue;
+			}
+
+			if (state->last_inorder < min_history_chunk) {
+				fprintf(stderr, "[udp_multicast_group::%s] dropping member %s, %d chunks behind", __func__, conn->get_full_address().c_str(), m_packet_chunk_num - 1 - state->last_inorder);
+				remove_connection(conn.get());
+				continue;
+			}
+
+			const net_time_range resend_time = conn->get_max_unack_time();
+
+			while (!state->repaired_chunks.empty() && state->repaired_chunks.begin()->first <= state->last_inorder) {
+				state->repaired_chunks.erase(state->repaired_chunks.begin());
+			}
+
+			for (const int32_t chunk_num: state->naks) {
+				queue_repair(*state, chunk_num, cur_time, resend_time);
+			}
+
+			if (!state->naks.empty())
+				conn->wake();
+
+			state->naks.clear();
+
+			// losses at the tail of a burst are not revealed by any later chunk
+			if (state->last_inorder < (m_packet_chunk_num - 1) && (cur_time - state->prv_report_time) > repair_time && (cur_time - state->prv_repair_time) > repair_time) {
+				for (int32_t chunk_num = state->last_inorder + 1; chunk_num < m_packet_chunk_num && chunk_num <= (state->last_inorder + 32); ++chunk_num) {
+					queue_repair(*state, chunk_num, cur_time, resend_time);
+				}
+
+				state->prv_repair_time = cur_time;
+				conn->wake();
+			}
+
+			min_acked = std::min(min_acked, state->last_inorder);
+			n += 1;
+		}
+
+		while (!m_history.empty() && m_history.front()->chunk_number <= min_acked) {
+			m_history.pop_front();
+		}
+	}
+
+	void udp_multicast_group::queue_repair(udp_multicast_state& state, int32_t chunk_num, const net_time_point& cur_time, const net_time_range& resend_time) {
+		if (m_history.empty() || chunk_num <= state.last_inorder)
+			return;
+
+		const int32_t index = chunk_num - m_history.front()->chunk_number;
+
+		if (index < 0 || size_t(index) >= m_history.size())
+			return;
+
+		net_time_point& repair_time = state.repaired_chunks[chunk_num];
+
+		// the nak crossed the last repair, or that one is still queued
+		if (repair_time != net_time_point() && (cur_time - repair_time) < resend_time)
+			return;
+
+		repair_time = cur_time;
+		state.repair_chunks.push_back(m_history[index]);
+	}
+}
+
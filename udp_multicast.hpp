@@ -0,0 +1,126 @@
+#ifndef ARELION_UDP_MULTICAST_HDR
+#define ARELION_UDP_MULTICAST_HDR
+
+#include <asio/ip/udp.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base_connection.hpp"
+#include "mem_pool.hpp"
+#include "udp_broadcast.hpp"
+#include "udp_packet.hpp"
+#include "util.hpp"
+
+
+namespace arelion {
+	// multicast bookkeeping of a udp_connection, on either end; the receiving
+	// end joined a group with udp_connection::join_multicast, the sending end
+	// was added to a udp_multicast_group
+	struct udp_multicast_state {
+	public:
+		// receiving end: socket bound to the group
+		std::shared_ptr<asio::ip::udp::socket> socket;
+		// receiving end: reliable group chunks received past <last_inorder>
+		pool_set<int32_t> received_chunks;
+		// receiving end: chunks that arrived before the join point was known
+		pool_deque< std::shared_ptr<udp_packet_chunk> > early_chunks;
+
+		// sending end: group chunks to resend over this connection
+		pool_deque< std::shared_ptr<udp_packet_chunk> > repair_chunks;
+		// sending end: group chunks the other end reported missing
+		std::vector<int32_t> naks;
+		// sending end: when chunks past <last_inorder> were last queued for repair,
+		// which repeated naks do not queue again before it could have been acked
+		pool_map<int32_t, net_time_point> repaired_chunks;
+
+		// receiving end: when missing chunks were last reported
+		// sending end: when <last_inorder> last advanced
+		net_time_point prv_report_time;
+		// sending end: when missing chunks were last repaired without a nak
+		net_time_point prv_repair_time;
+
+		// receiving end: last reliable group chunk received contiguously
+		// sending end: last reliable group chunk the other end has acked
+		int32_t last_inorder = -1;
+
+		// join point: first reliable group chunk and stream sequence number the
+		// receiving end is responsible for, everything before is ignored
+		int32_t first_chunk = 0;
+		int32_t first_sequence = 0;
+
+		// carries the group's data on the receiving end
+		uint8_t stream = 0;
+
+		bool receiving = false;
+		// receiving end: the join point is known
+		// sending end: the other end has confirmed it
+		bool synced = false;
+		// acks or the join point should be sent without waiting for other traffic
+		bool report_due = false;
+	};
+
+
+	// sends the same messages to all members with one datagram per batch on a
+	// multicast address, numbering chunks in the group's own reliable sequence;
+	// members ack and nak that sequence alongside their own over unicast, and
+	// whatever they miss is repaired over their udp_connection
+	//
+	// all data goes out on one stream, which members must not use otherwise;
+	// like udp_broadcast_group, ordered blocks are never compressed
+	class udp_multicast_group: public udp_broadcast_group {
+	public:
+		// sends to <address>:<port> through the interface with local IPv4 address
+		// <interface>, or the default route if empty (e.g. "127.0.0.1" to test on
+		// a single host through loopback)
+		udp_multicast_group(const std::string& address, uint16_t port, uint8_t stream = base_connection::MAX_STREAMS - 1, const std::string& interface = "");
+
+		// members join at the next chunk the group sends
+		void add_connection(std::shared_ptr<udp_connection> conn) override;
+		void remove_connection(const udp_connection* conn) override;
+
+		void send_data(std::shared_ptr<const raw_packet> data, const uint8_t delivery = base_connection::DELIVERY_RELIABLE_ORDERED) {
+			udp_broadcast_group::send_data(std::move(data), delivery, m_stream);
+		}
+
+		void flush() override;
+		// queues repairs for what members missed and forgets what all of them
+		// have, call regularly (before the members are updated)
+		void update();
+
+		const asio::ip::udp::endpoint& get_endpoint() const { return m_endpoint; }
+		uint8_t get_stream() const { return m_stream; }
+
+	protected:
+		void send_block(const udp_broadcast_block& block) override;
+
+	private:
+		void send_packets();
+		// skips chunks repaired less than <resend_time> before <cur_time>
+		void queue_repair(udp_multicast_state& state, int32_t chunk_num, const net_time_point& cur_time, const net_time_range& resend_time);
+
+	private:
+		std::shared_ptr<asio::ip::udp::socket> m_socket;
+		asio::ip::udp::endpoint m_endpoint;
+
+		// chunks not yet sent to the group
+		pool_deque< std::shared_ptr<udp_packet_chunk> > m_new_chunks;
+		// reliable chunks sent but not acked by every member, for repairs
+		pool_deque< std::shared_ptr<udp_packet_chunk> > m_history;
+
+		std::vector<uint8_t> m_send_buffer;
+
+		util::crc32_t m_crc;
+
+		int32_t m_packet_chunk_num = 0;
+		int32_t m_unreliable_chunk_num = 0;
+		int32_t m_next_sequence = 0;
+
+		uint8_t m_stream = 0;
+	};
+}
+
+#endif
+
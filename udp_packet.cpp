@@ -1,4 +1,8 @@
+#include <algorithm>
+#include <cassert>
+
 #include "udp_packet.hpp"
+#include "alloc_audit.hpp"
 #include "packet_packer.hpp"
 #include "packet_unpacker.hpp"
 #include "util.hpp"
@@ -7,19 +11,28 @@ namespace arelion {
 	void udp_packet_chunk::update_checksum(util::crc32_t& crc) const {
 		crc.update(chunk_number);
 		crc.update(static_cast<uint32_t>(chunk_size));
+		crc.update(channel);
+
+		if (has_sequence())
+			crc.update(stream_seq);
 
-		if (data.empty())
+		if (chunk_size == 0)
 			return;
 
-		crc.update(&data[0], data.size());
+		crc.update(get_data(), chunk_size);
 	}
 
 
 	udp_packet::udp_packet(const uint8_t* data, uint32_t length) {
+		ALLOC_AUDIT_SCOPE("parse_packet");
+
 		packet_unpacker buf(data, length);
+		buf.unpack(version);
 		buf.unpack(last_continuous);
 		buf.unpack(nak_type);
+		buf.unpack(flags);
 		buf.unpack(checksum);
+		buf.unpack(conn_id);
 
 		if (nak_type > 0) {
 			naks.reserve(nak_type);
@@ -35,17 +48,50 @@ namespace arelion {
 			}
 		}
 
+		if ((flags & PKT_FLAG_MCAST_ACK) != 0 && buf.bytes_remaining() >= (sizeof(mcast_last_continuous) + sizeof(uint8_t))) {
+			uint8_t num_naks = 0;
+
+			buf.unpack(mcast_last_continuous);
+			buf.unpack(num_naks);
+
+			buf.unpack(mcast_naks, std::min(uint32_t(num_naks), buf.bytes_remaining()));
+		}
+
+		if ((flags & PKT_FLAG_MCAST_SYNC) != 0 && buf.bytes_remaining() >= (sizeof(mcast_first_chunk) + sizeof(mcast_first_sequence))) {
+			buf.unpack(mcast_first_chunk);
+			buf.unpack(mcast_first_sequence);
+		}
+
+		if ((flags & (PKT_FLAG_PATH_CHALLENGE | PKT_FLAG_PATH_RESPONSE)) != 0 && buf.bytes_remaining() >= sizeof(path_nonce))
+			buf.unpack(path_nonce);
+		if ((flags & (PKT_FLAG_COOKIE_CHALLENGE | PKT_FLAG_COOKIE_ECHO)) != 0 && buf.bytes_remaining() >= sizeof(cookie))
+			buf.unpack(cookie);
+
 		while (buf.bytes_remaining() > udp_packet_chunk::hdr_size()) {
-			std::shared_ptr<udp_packet_chunk> chunk(new udp_packet_chunk());
+			const std::shared_ptr<udp_packet_chunk> chunk = udp_packet_chunk::create();
 
 			buf.unpack(chunk->chunk_number);
 			buf.unpack(chunk->chunk_size);
+			buf.unpack(chunk->channel);
+
+			if (chunk->has_sequence()) {
+				if (buf.bytes_remaining() < sizeof(chunk->stream_seq))
+					break;
+
+				buf.unpack(chunk->stream_seq);
+			}
 
 			// defective, ignore
-			if (buf.bytes_remaining() < chunk->chunk_size)
+			if (buf.bytes_remaining() < chunk->chunk_size || chunk->chunk_size > udp_packet_chunk::max_size())
 				break;
 
-			buf.unpack(chunk->data, chunk->chunk_size);
+			if (chunk->chunk_size > 0) {
+				const std::shared_ptr<udp_chunk_payload> payload = udp_chunk_payload::create();
+
+				buf.unpack(payload->data, chunk->chunk_size);
+				chunk->payload = payload;
+			}
+
 			chunks.push_back(chunk);
 		}
 	}
@@ -54,6 +100,15 @@ namespace arelion {
 	uint32_t udp_packet::calc_size() const {
 		uint32_t size = hdr_size() + naks.size();
 
+		if ((flags & PKT_FLAG_MCAST_ACK) != 0)
+			size += (sizeof(mcast_last_continuous) + sizeof(uint8_t) + mcast_naks.size());
+		if ((flags & PKT_FLAG_MCAST_SYNC) != 0)
+			size += (sizeof(mcast_first_chunk) + sizeof(mcast_first_sequence));
+		if ((flags & (PKT_FLAG_PATH_CHALLENGE | PKT_FLAG_PATH_RESPONSE)) != 0)
+			size += sizeof(path_nonce);
+		if ((flags & (PKT_FLAG_COOKIE_CHALLENGE | PKT_FLAG_COOKIE_ECHO)) != 0)
+			size += sizeof(cookie);
+
 		for (const auto& chunk: chunks) {
 			size += chunk->calc_size();
 		}
@@ -63,12 +118,30 @@ namespace arelion {
 
 	uint8_t udp_packet::calc_checksum(util::crc32_t& crc) const {
 		crc.init_digest();
+		crc.update(version);
 		crc.update(last_continuous);
 		crc.update(static_cast<uint32_t>(nak_type));
+		crc.update(flags);
+		crc.update(conn_id);
 
 		if (!naks.empty())
 			crc.update(&naks[0], naks.size());
 
+		if ((flags & PKT_FLAG_MCAST_ACK) != 0) {
+			crc.update(mcast_last_continuous);
+
+			if (!mcast_naks.empty())
+				crc.update(&mcast_naks[0], mcast_naks.size());
+		}
+		if ((flags & PKT_FLAG_MCAST_SYNC) != 0) {
+			crc.update(mcast_first_chunk);
+			crc.update(mcast_first_sequence);
+		}
+		if ((flags & (PKT_FLAG_PATH_CHALLENGE | PKT_FLAG_PATH_RESPONSE)) != 0)
+			crc.update(path_nonce);
+		if ((flags & (PKT_FLAG_COOKIE_CHALLENGE | PKT_FLAG_COOKIE_ECHO)) != 0)
+			crc.update(cookie);
+
 		for (auto& chunk: chunks) {
 			chunk->update_checksum(crc);
 		}
@@ -81,15 +154,39 @@ namespace arelion {
 		data.reserve(calc_size());
 
 		packet_packer buf(data);
+		buf.pack(version);
 		buf.pack(last_continuous);
 		buf.pack(nak_type);
+		buf.pack(flags);
 		buf.pack(checksum);
+		buf.pack(conn_id);
 		buf.pack(naks);
 
+		if ((flags & PKT_FLAG_MCAST_ACK) != 0) {
+			assert(mcast_naks.size() <= 255);
+
+			buf.pack(mcast_last_continuous);
+			buf.pack(uint8_t(mcast_naks.size()));
+			buf.pack(mcast_naks);
+		}
+		if ((flags & PKT_FLAG_MCAST_SYNC) != 0) {
+			buf.pack(mcast_first_chunk);
+			buf.pack(mcast_first_sequence);
+		}
+		if ((flags & (PKT_FLAG_PATH_CHALLENGE | PKT_FLAG_PATH_RESPONSE)) != 0)
+			buf.pack(path_nonce);
+		if ((flags & (PKT_FLAG_COOKIE_CHALLENGE | PKT_FLAG_COOKIE_ECHO)) != 0)
+			buf.pack(cookie);
+
 		for (const auto& chunk: chunks) {
 			buf.pack(chunk->chunk_number);
 			buf.pack(chunk->chunk_size);
-			buf.pack(chunk->data);
+			buf.pack(chunk->channel);
+
+			if (chunk->has_sequence())
+				buf.pack(chunk->stream_seq);
+			if (chunk->chunk_size > 0)
+				buf.pack(chunk->get_data(), chunk->chunk_size);
 		}
 	}
 }
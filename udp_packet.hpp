@@ -1,58 +1,164 @@
 #ifndef ARELION_UDP_PACKET_HDR
 #define ARELION_UDP_PACKET_HDR
 
+#include <chrono>
 #include <cstdint>
+#include <cstring>
 
-#include <list>
 #include <vector>
 
 #include <memory>
 
+#include "mem_pool.hpp"
+
 
 namespace util {
 	struct crc32_t;
 };
 
 namespace arelion {
+	// chunk data is held by reference, so a broadcast can share one payload
+	// between the chunks (and resend queues) of many connections
+	struct udp_chunk_payload {
+	public:
+		enum {
+			MAX_DATA_SIZE = 254,
+		};
+
+		static std::shared_ptr<udp_chunk_payload> create() { return (make_pooled<udp_chunk_payload>()); }
+
+	public:
+		uint8_t data[MAX_DATA_SIZE];
+	};
+
+
 	struct udp_packet_chunk {
 	public:
-		static constexpr uint32_t hdr_size() { return (sizeof(int32_t) + sizeof(uint8_t)); }
-		static constexpr uint32_t max_size() { return 254; }
+		enum {
+			MAX_DATA_SIZE = udp_chunk_payload::MAX_DATA_SIZE,
+		};
+		enum {
+			CHANNEL_MULTICAST = 1 << 6,
+		};
+
+		static constexpr uint32_t hdr_size() { return (sizeof(int32_t) + sizeof(uint8_t) + sizeof(uint8_t)); }
+		static constexpr uint32_t max_size() { return MAX_DATA_SIZE; }
+
+		// chunks are recycled through mem_pool, as are their payloads
+		static std::shared_ptr<udp_packet_chunk> create() { return (make_pooled<udp_packet_chunk>()); }
+
+		const uint8_t* get_data() const { return payload->data; }
 
-		uint32_t calc_size() const { return (hdr_size() + data.size()); }
+		uint32_t calc_size() const { return (hdr_size() + sizeof(uint16_t) * has_sequence() + chunk_size); }
+		uint8_t get_delivery() const { return (channel & 3); }
+		uint8_t get_stream() const { return ((channel >> 2) & 15); }
+
+		// numbered in the sequence of a udp_multicast_group rather than the connection's
+		bool is_multicast() const { return ((channel & CHANNEL_MULTICAST) != 0); }
+
+		// only ordered chunks carry a per-stream sequence number
+		bool has_sequence() const { return (get_delivery() == 0); }
+
+		// reliable chunks are numbered in one sequence, unreliable ones in another
+		bool is_reliable() const { return (get_delivery() < 2); }
 		void update_checksum(util::crc32_t& crc) const;
 
 	public:
 		int32_t chunk_number = 0;
 		uint8_t chunk_size = 0;
+		// delivery class in bits 0-1, stream in bits 2-5, CHANNEL_MULTICAST in bit 6
+		uint8_t channel = 0;
+		uint16_t stream_seq = 0;
+
+		// local bookkeeping, never sent; times are only set while tracking latency
+		bool resent = false;
+		// id of the largest message in the chunk (or its block), only while counting traffic
+		uint8_t msg_id = 0;
+
+		std::chrono::high_resolution_clock::time_point create_time;
+		std::chrono::high_resolution_clock::time_point send_time;
 
-		std::vector<uint8_t> data;
+		// first <chunk_size> bytes are used, null if there are none
+		std::shared_ptr<const udp_chunk_payload> payload;
 	};
 
 
 	struct udp_packet {
 	public:
+		enum {
+			// bumped whenever the layout of a datagram changes; receivers drop
+			// datagrams of any other version unparsed
+			PROTOCOL_VERSION = 1,
+		};
+		enum {
+			// sender accepts LZ-compressed stream blocks
+			PKT_FLAG_STREAM_LZ = 1 << 0,
+			// multicast progress of the sender follows the naks
+			PKT_FLAG_MCAST_ACK = 1 << 1,
+			// where the receiver joins the sender's multicast group follows the naks
+			PKT_FLAG_MCAST_SYNC = 1 << 2,
+			// receiver must echo <path_nonce> to prove it can be reached at the
+			// address this datagram was sent to
+			PKT_FLAG_PATH_CHALLENGE = 1 << 3,
+			// <path_nonce> echoes a challenge
+			PKT_FLAG_PATH_RESPONSE = 1 << 4,
+			// udp_listener accepts the receiver once it echoes <cookie>
+			PKT_FLAG_COOKIE_CHALLENGE = 1 << 5,
+			// <cookie> echoes a challenge
+			PKT_FLAG_COOKIE_ECHO = 1 << 6,
+		};
+
 		udp_packet(const uint8_t* data, uint32_t length);
 		udp_packet(int32_t _last_continuous, int8_t _nak_type): last_continuous(_last_continuous), nak_type(_nak_type) {
 		}
 
-		static constexpr uint32_t hdr_size() { return (sizeof(int32_t) + sizeof(int8_t) + sizeof(uint8_t)); }
+		// header layout: <uint8 version><int32 last_continuous><int8 nak_type><uint8 flags><uint8 checksum><uint32 conn_id>
+		static constexpr uint32_t hdr_size() { return (sizeof(uint8_t) + sizeof(int32_t) + sizeof(int8_t) + sizeof(uint8_t) + sizeof(uint8_t) + sizeof(uint32_t)); }
 		static constexpr uint32_t max_size() { return 4096; }
 
+		// true if <data> holds a whole header of this protocol version, checked before parsing
+		static bool has_valid_header(const uint8_t* data, uint32_t length) { return (length >= hdr_size() && data[0] == PROTOCOL_VERSION); }
+
+		// <conn_id> of a serialized packet of at least hdr_size() bytes, without parsing it
+		static uint32_t peek_conn_id(const uint8_t* data) {
+			uint32_t conn_id = 0;
+			std::memcpy(&conn_id, data + hdr_size() - sizeof(conn_id), sizeof(conn_id));
+			return conn_id;
+		}
+
 		uint32_t calc_size() const;
 		uint8_t calc_checksum(util::crc32_t& crc) const;
 
 		void serialize(std::vector<uint8_t>& data) const;
 
 	public:
+		uint8_t version = PROTOCOL_VERSION;
 		int32_t last_continuous = 0;
 		/// if < 0, -<nak_type> packets were lost since <last_continuous>
 		//  if > 0,  <nak_type> equals the number of no-acknowledge chunks
 		int8_t nak_type = 0;
+		uint8_t flags = 0;
 		uint8_t checksum = 0;
+		// assigned by the accepting udp_listener, which routes on it rather than
+		// the sender's address; zero until the connecting end has learned it
+		uint32_t conn_id = 0;
 
 		std::vector<uint8_t> naks;
-		std::list< std::shared_ptr<udp_packet_chunk> > chunks;
+
+		// with PKT_FLAG_MCAST_ACK, like <last_continuous> and <naks> but for
+		// the chunks of the multicast group the sender has joined
+		int32_t mcast_last_continuous = -1;
+		std::vector<uint8_t> mcast_naks;
+		// with PKT_FLAG_MCAST_SYNC, first multicast chunk and stream sequence
+		// number the receiver is responsible for
+		int32_t mcast_first_chunk = 0;
+		int32_t mcast_first_sequence = 0;
+		// with PKT_FLAG_PATH_CHALLENGE or PKT_FLAG_PATH_RESPONSE
+		uint32_t path_nonce = 0;
+		// with PKT_FLAG_COOKIE_CHALLENGE or PKT_FLAG_COOKIE_ECHO
+		uint64_t cookie = 0;
+
+		pool_list< std::shared_ptr<udp_packet_chunk> > chunks;
 	};
 }
 
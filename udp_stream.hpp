@@ -0,0 +1,62 @@
+#ifndef ARELION_UDP_STREAM_HDR
+#define ARELION_UDP_STREAM_HDR
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "base_connection.hpp"
+#include "delta_codec.hpp"
+#include "mem_pool.hpp"
+#include "raw_packet.hpp"
+#include "stream_codec.hpp"
+#include "udp_packet.hpp"
+
+
+namespace arelion {
+	// one logical stream of a udp_connection; all streams share chunk numbering
+	// (and thereby acks, resends and bandwidth) but every stream is sequenced and
+	// reassembled on its own, so a lost chunk only stalls the stream it belongs to
+	struct udp_stream {
+	public:
+		// maps a wire sequence number onto the full one nearest to the expected next
+		int32_t unwrap_sequence(uint16_t seq) const {
+			return (last_inorder + 1 + int16_t(seq - uint16_t(last_inorder + 1)));
+		}
+
+	public:
+		// outgoing data (without header) waiting to be sent
+		pool_deque< std::shared_ptr<const raw_packet> > outgoing_data;
+		// when each packet in outgoing_data was queued, only while tracking latency
+		pool_deque<net_time_point> outgoing_times;
+		// ordered chunks we have received but not yet reassembled, by sequence number
+		pool_map<int32_t, std::shared_ptr<const udp_packet_chunk> > waiting_chunks;
+		// when each waiting chunk arrived, only while tracking latency
+		pool_map<int32_t, net_time_point> waiting_times;
+		// complete packets we received but did not yet consume
+		pool_deque< std::shared_ptr<const raw_packet> > msg_queue;
+
+		// trailing part of a packet continued in the next block
+		std::vector<uint8_t> fragment_buffer;
+
+		stream_encoder stream_enc;
+		stream_decoder stream_dec;
+
+		delta_encoder delta_enc;
+		delta_decoder delta_dec;
+
+		// when the oldest packet in outgoing_data was queued, and how long it may wait
+		net_time_point queue_time;
+		net_time_range latency_budget;
+
+		// sequence number of the next ordered chunk to send
+		int32_t next_sequence = 0;
+		// sequence number of the last ordered chunk reassembled
+		int32_t last_inorder = -1;
+		// chunk number of the last sequenced unreliable chunk delivered
+		int32_t last_sequenced = -1;
+	};
+}
+
+#endif
+
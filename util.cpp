@@ -7,5 +7,61 @@ namespace util {
 	};
 
 	static static_initializer_t init; 
+
+
+	static inline uint64_t rotl(uint64_t v, uint32_t n) { return ((v << n) | (v >> (64 - n))); }
+
+	static inline void sip_round(uint64_t v[4]) {
+		v[0] += v[1]; v[1] = rotl(v[1], 13); v[1] ^= v[0]; v[0] = rotl(v[0], 32);
+		v[2] += v[3]; v[3] = rotl(v[3], 16); v[3] ^= v[2];
+		v[0] += v[3]; v[3] = rotl(v[3], 21); v[3] ^= v[0];
+		v[2] += v[1]; v[1] = rotl(v[1], 17); v[1] ^= v[2]; v[2] = rotl(v[2], 32);
+	}
+
+	uint64_t siphash24(const uint64_t key[2], const void* data, size_t size) {
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+
+		uint64_t v[4] = {
+			key[0] ^ 0x736f6d6570736575ull,
+			key[1] ^ 0x646f72616e646f6dull,
+			key[0] ^ 0x6c7967656e657261ull,
+			key[1] ^ 0x7465646279746573ull,
+		};
+
+		size_t pos = 0;
+
+		for (; (pos + 8) <= size; pos += 8) {
+			uint64_t m = 0;
+
+			// little-endian words as per the reference, independent of the host
+			for (uint32_t i = 0; i < 8; ++i) {
+				m |= (uint64_t(bytes[pos + i]) << (i * 8));
+			}
+
+			v[3] ^= m;
+			sip_round(v);
+			sip_round(v);
+			v[0] ^= m;
+		}
+
+		uint64_t m = uint64_t(size) << 56;
+
+		for (uint32_t i = 0; (pos + i) < size; ++i) {
+			m |= (uint64_t(bytes[pos + i]) << (i * 8));
+		}
+
+		v[3] ^= m;
+		sip_round(v);
+		sip_round(v);
+		v[0] ^= m;
+
+		v[2] ^= 0xff;
+		sip_round(v);
+		sip_round(v);
+		sip_round(v);
+		sip_round(v);
+
+		return (v[0] ^ v[1] ^ v[2] ^ v[3]);
+	}
 }
 
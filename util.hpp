@@ -1,8 +1,10 @@
 #ifndef ARELION_UTIL_HDR
 #define ARELION_UTIL_HDR
 
+#include <chrono>
 #include <cstdint>
 #include <random>
+#include <thread>
 
 extern "C" {
 	#include <7zCrc.h>
@@ -13,6 +15,19 @@ namespace util {
 		return (std::max(vmin, std::min(v, vmax)));
 	}
 
+	// sleeps until shortly before <t> and spins the rest, since the
+	// scheduler alone can overshoot by far more than a millisecond
+	template<typename C, typename D> void sleep_until(const std::chrono::time_point<C, D>& t) {
+		const std::chrono::microseconds spin_time{200};
+
+		if ((t - C::now()) > spin_time)
+			std::this_thread::sleep_for(t - C::now() - spin_time);
+
+		while (C::now() < t) {
+			std::this_thread::yield();
+		}
+	}
+
 
 	struct crc32_t {
 	public:
@@ -32,6 +47,11 @@ namespace util {
 	};
 
 
+	// SipHash-2-4, a keyed hash short enough for single datagrams that an
+	// attacker cannot forge without the 128-bit key
+	uint64_t siphash24(const uint64_t key[2], const void* data, size_t size);
+
+
 	template<typename T> struct rng11_t {
 	public:
 		rng11_t(uint64_t seed = 0) { m_sampler.seed(seed); }